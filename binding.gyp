@@ -4,6 +4,23 @@
       'target_name': '_spi',
       'sources': [ 'src/ntk3900_spi2.cc',
                    'src/spi_driver.cc',
+                   'src/noritake.cc',
+                   'src/profile.cc',
+                   'src/encoder.cc',
+                   'src/framebuffer.cc',
+                   'src/frame_diff.cc',
+                   'src/packer.cc',
+                   'src/dither.cc',
+                   'src/font.cc',
+                   'src/scroller.cc',
+                   'src/asset_cache.cc',
+                   'src/page_flipper.cc',
+                   'src/compositor.cc',
+                   'src/text_screen.cc',
+                   'src/optimizer.cc',
+                   'src/macros.cc',
+                   'src/histogram.cc',
+                   'src/trace.cc',
                    'src/bcm2835.c' ],
       'include_dirs': ["<!@(node -p \"require('node-addon-api').include\")"],
       'dependencies': ["<!(node -p \"require('node-addon-api').gyp\")"],
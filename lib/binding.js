@@ -23,7 +23,30 @@ var ORDER = {
 
 var DRIVER = {
     SPIDEV: _spi.DRIVER_SPIDEV,
-    BCM2835: _spi.DRIVER_BCM2835
+    BCM2835: _spi.DRIVER_BCM2835,
+    PARALLEL: _spi.DRIVER_PARALLEL
+};
+
+var FLOW = {
+    STRICT: _spi.FLOW_STRICT,
+    CREDIT: _spi.FLOW_CREDIT
+};
+
+var RDY_WAIT = {
+    POLL: _spi.RDY_WAIT_POLL,
+    EVENT: _spi.RDY_WAIT_EVENT
+};
+
+var PIXEL = {
+    GRAY: _spi.PIXEL_GRAY,
+    RGBA: _spi.PIXEL_RGBA
+};
+
+var DITHER = {
+    NONE: _spi.DITHER_NONE,
+    FLOYD_STEINBERG: _spi.DITHER_FLOYD_STEINBERG,
+    ATKINSON: _spi.DITHER_ATKINSON,
+    BAYER: _spi.DITHER_BAYER
 };
 
 function isFunction(object) {
@@ -168,7 +191,8 @@ Spi.prototype.delay = function(delay) {
 
 Spi.prototype.driver = function(driver) {
     if (typeof(driver) != 'undefined')
-	if (driver == DRIVER['BCM2835'] || driver == DRIVER['SPIDEV']) {
+	if (driver == DRIVER['BCM2835'] || driver == DRIVER['SPIDEV'] ||
+	    driver == DRIVER['PARALLEL']) {
             this._spi['driver'](driver);
             return this._spi;
 	}
@@ -223,6 +247,27 @@ Spi.prototype.rdyPin = function(pin) {
     return this._spi['rdyPin']();
 }
 
+/**
+ * GPIOs for D0..D7 when using the PARALLEL driver (array of 8 pins)
+ */
+Spi.prototype.dataPins = function(pins) {
+    if (typeof(pins) != 'undefined') {
+        this._spi['dataPins'](pins);
+    } else
+    return this._spi['dataPins']();
+}
+
+/**
+ * GPIO driving the 74HC595 storage register clock, enables pipelined
+ * transfers (see README)
+ */
+Spi.prototype.latchPin = function(pin) {
+    if (typeof(pin) != 'undefined') {
+        this._spi['latchPin'](pin);
+    } else
+    return this._spi['latchPin']();
+}
+
 Spi.prototype.invertRdy = function(flag) {
     if (typeof(flag) != 'undefined') {
         this._spi['invertRdy'](flag);
@@ -237,9 +282,262 @@ Spi.prototype.bSeries = function(pin) {
     return this._spi['bSeries']();
 }
 
+/**
+ * Display profile (protocol and timings) used by the native driver:
+ * "GU-3900", "GU-3900B" (bSeries) or "GU-7000" (invertRdy). Read only,
+ * picked when the device is opened.
+ */
+Spi.prototype.profile = function() {
+    return this._spi['profile']();
+}
+
+/**
+ * BUSY displays: timeouts (ns) for BUSY to go up after text, param, data,
+ * end and slow bytes, e.g. busyTiming({ data: 1500 }). 0 restores the
+ * profile value.
+ */
+Spi.prototype.busyTiming = function(timing) {
+    if (typeof(timing) != 'undefined') {
+        this._spi['busyTiming'](timing);
+    } else
+    return this._spi['busyTiming']();
+}
+
+/**
+ * Slowest BUSY rise seen since open (ns), per kind of byte, to tune
+ * busyTiming()
+ */
+Spi.prototype.busyLatency = function() {
+    return this._spi['busyLatency']();
+}
+
+/**
+ * optimize(true) runs every transfer through the native peephole pass that
+ * drops commands changing nothing on the display and merges side by side
+ * bit images. Turning it on again forgets the display state.
+ */
+Spi.prototype.optimize = function(flag) {
+    if (typeof(flag) != 'undefined') {
+        this._spi['optimize'](!!flag);
+        return this;
+    } else
+    return this._spi['optimize']();
+}
+
+/**
+ * autoDma(false) makes transfer() check RDY for every byte. By default the
+ * bit image payloads found in the stream go out in DMA mode when the
+ * display profile allows it.
+ */
+Spi.prototype.autoDma = function(flag) {
+    if (typeof(flag) != 'undefined') {
+        this._spi['autoDma'](!!flag);
+        return this;
+    } else
+    return this._spi['autoDma']();
+}
+
+/**
+ * Bytes in and out of the optimizer, commands dropped, bit images merged
+ */
+Spi.prototype.optimizerStats = function() {
+    return this._spi['optimizerStats']();
+}
+
+/**
+ * Bus usage counters: bytes and transfers, DMA vs RDY checked bytes, time
+ * spent waiting for RDY and in settle delays
+ */
+Spi.prototype.stats = function() {
+    return this._spi['stats']();
+}
+
+Spi.prototype.resetStats = function() {
+    this._spi['resetStats']();
+    return this;
+}
+
+/**
+ * Latency distributions (queue, rdyWait, total), each for checked and DMA
+ * transfers, with the given percentiles (default [50, 90, 99, 99.9])
+ */
+Spi.prototype.latency = function(percentiles) {
+    return this._spi['latency'](percentiles);
+}
+
+/**
+ * trace(bytes) keeps the last bus events in a ring of that size (true for
+ * the default size, 64MB at most), trace(false) stops tracing
+ */
+Spi.prototype.trace = function(bytes) {
+    if (typeof(bytes) != 'undefined') {
+        this._spi['trace'](bytes);
+        return this;
+    } else
+    return this._spi['trace']();
+}
+
+/**
+ * Traced events as Chrome trace JSON, for Perfetto or chrome://tracing
+ */
+Spi.prototype.chromeTrace = function() {
+    return this._spi['chromeTrace']();
+}
+
+Spi.prototype.flowControl = function(flow) {
+    if (typeof(flow) != 'undefined')
+	if (flow == FLOW['STRICT'] || flow == FLOW['CREDIT']) {
+            this._spi['flowControl'](flow);
+            return this._spi;
+	}
+        else {
+	    console.log('Illegal flow control setting');
+	    return -1;
+	}
+    else
+	return this._spi['flowControl']();
+}
+
+/**
+ * Estimated time (in ns) the display takes to consume one data byte, used
+ * by the FLOW.CREDIT flow control
+ */
+Spi.prototype.drainTime = function(ns) {
+    if (typeof(ns) != 'undefined') {
+        this._spi['drainTime'](ns);
+    } else
+    return this._spi['drainTime']();
+}
+
+Spi.prototype.rdyWait = function(wait) {
+    if (typeof(wait) != 'undefined')
+	if (wait == RDY_WAIT['POLL'] || wait == RDY_WAIT['EVENT']) {
+            this._spi['rdyWait'](wait);
+            return this._spi;
+	}
+        else {
+	    console.log('Illegal RDY wait setting');
+	    return -1;
+	}
+    else
+	return this._spi['rdyWait']();
+}
+
+/**
+ * Native Noritake command encoder. Commands are appended to a reusable
+ * native buffer (all methods can be chained), and flush(spi) sends them
+ * to the device in one go, bitmap payloads in DMA mode.
+ */
+var Encoder = _spi.Encoder;
+
+/**
+ * Native 1bpp framebuffer (default 256x64) in the display memory layout.
+ * It records what changed as drawing happens, and flush(spi) only sends
+ * real time bit image writes for the dirty areas. Blank or fully lit
+ * areas are sent as filled boxes unless fillAreas(false).
+ */
+var FrameBuffer = _spi.FrameBuffer;
+
+/**
+ * Native frame diff engine. plan(prev, next) picks the cheapest set of bit
+ * image writes (or a full frame write) to go from one frame to the other
+ * according to costModel(), flush(spi, prev, next) also sends them and
+ * reports the actual time it took. Frames are Buffers in the display
+ * memory layout or FrameBuffers.
+ */
+var FrameDiff = _spi.FrameDiff;
+
+/**
+ * Native image packer: new ImagePacker(width, height), then pack(image, out)
+ * thresholds a grayscale or RGBA image (e.g. node-canvas ImageData.data)
+ * into the display memory layout, using NEON or SSE2 when available. The
+ * result can go straight to dmaTransfer() or into a FrameBuffer.
+ * dither(DITHER.*) selects error diffusion or ordered dithering instead,
+ * threads(n) splits it in horizontal bands.
+ */
+var ImagePacker = _spi.ImagePacker;
+
+/**
+ * Native bitmap font: new Font(bdf) loads a BDF font (string or Buffer, e.g.
+ * from fs.readFileSync()) into a glyph atlas in the display memory layout.
+ * draw(framebuffer, text, x, y) renders into a FrameBuffer, render(text)
+ * returns a Buffer of rows() bytes per column for bitImage() or
+ * dmaTransfer().
+ */
+var Font = _spi.Font;
+
+/**
+ * Native hardware scroller for tickers and scrolling graphs. push(columns)
+ * queues new columns, start(spi) then writes them into the hidden part of
+ * the display memory and scrolls the screen over them every interval() ms
+ * from a native thread, so each step only sends the new columns.
+ */
+var Scroller = _spi.Scroller;
+
+/**
+ * Display RAM cache: image(encoder, width, rows, data) and text(encoder,
+ * font, text) store images in the display bit image RAM and glyphs as
+ * downloaded characters the first time, and only send a short command to
+ * show them afterwards. Least recently used ones are evicted when full.
+ */
+var AssetCache = _spi.AssetCache;
+
+/**
+ * Native page flipping: flip(spi, frame) writes the frame into a hidden
+ * page of the display memory, then moves the display start over it in one
+ * command. start(spi) and submit(frame) do the same from a native thread,
+ * while JS renders the next frame.
+ */
+var PageFlipper = _spi.PageFlipper;
+
+/**
+ * Native window compositor: window(name, x, y, width, height) defines
+ * stacked screen regions, update(name, content) replaces the content of
+ * one, and flush(spi) sends the changes of all windows in one go. Blank or
+ * fully lit areas are sent as filled boxes unless fillAreas(false).
+ */
+var Compositor = _spi.Compositor;
+
+/**
+ * Native text screen: write(column, line, text, reverse) fills character
+ * cells shown with the display fonts, and flush(spi) only sends the cells
+ * that changed since the last flush.
+ */
+var TextScreen = _spi.TextScreen;
+
+/**
+ * Native command stream optimizer: optimize(buffer) returns the stream
+ * without the commands that change nothing given the previous streams, the
+ * same pass as Spi.optimize(true)
+ */
+var Optimizer = _spi.Optimizer;
+
+/**
+ * Native display macro: define(commands) or learn(stream) + pick() choose
+ * a sequence, install(spi) stores it in the display RAM macro, and
+ * transfer(spi, stream) sends streams with macro calls in its place.
+ */
+var Macros = _spi.Macros;
+
 
 module.exports.MODE = MODE;
 module.exports.CS = CS;
 module.exports.ORDER = ORDER;
 module.exports.DRIVER = DRIVER;
+module.exports.FLOW = FLOW;
+module.exports.RDY_WAIT = RDY_WAIT;
+module.exports.PIXEL = PIXEL;
+module.exports.DITHER = DITHER;
 module.exports.Spi = Spi;
+module.exports.Encoder = Encoder;
+module.exports.FrameBuffer = FrameBuffer;
+module.exports.FrameDiff = FrameDiff;
+module.exports.ImagePacker = ImagePacker;
+module.exports.Font = Font;
+module.exports.Scroller = Scroller;
+module.exports.AssetCache = AssetCache;
+module.exports.PageFlipper = PageFlipper;
+module.exports.Compositor = Compositor;
+module.exports.TextScreen = TextScreen;
+module.exports.Optimizer = Optimizer;
+module.exports.Macros = Macros;
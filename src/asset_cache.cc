@@ -0,0 +1,380 @@
+#include "asset_cache.h"
+#include "encoder.h"
+#include "font.h"
+#include "spi_driver.h"
+
+#include <string.h>
+#include <algorithm>
+
+Napi::FunctionReference AssetCache::constructor;
+
+// Widest downloaded character for each pattern height in bytes (fonts
+// 6x8, 8x16, 12x24 and 16x32)
+static const uint8_t max_char_width[] = { 6, 8, 12, 16 };
+
+/**
+ * FNV-1a over the size and the columns, so that identical assets are
+ * found again whoever sends them
+ */
+static uint64_t asset_hash(uint16_t width, uint16_t rows, const uint8_t *data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint8_t size[4] = { (uint8_t)width, (uint8_t)(width >> 8), (uint8_t)rows, (uint8_t)(rows >> 8) };
+
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ size[i]) * 0x100000001b3ULL;
+    }
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+Napi::Object AssetCache::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "AssetCache",
+        {
+            InstanceMethod("capacity", &AssetCache::capacity),
+            InstanceMethod("characters", &AssetCache::characters),
+            InstanceMethod("image", &AssetCache::image),
+            InstanceMethod("text", &AssetCache::text),
+            InstanceMethod("flush", &AssetCache::flush),
+            InstanceMethod("invalidate", &AssetCache::invalidate),
+            InstanceMethod("stats", &AssetCache::stats),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("AssetCache", func);
+
+    return exports;
+}
+
+/**
+ * new AssetCache(capacity): bytes of display bit image RAM to use, 8192 by
+ * default
+ */
+AssetCache::AssetCache(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<AssetCache>(info),
+    m_capacity(info[0].IsNumber() ? info[0].As<Napi::Number>().Uint32Value() : 8192),
+    m_first(0x80),
+    m_last(0xFF),
+    m_download_on(false),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0),
+    m_saved(0) {
+
+    if (m_capacity > 0xFFFFFF) {
+        EXCEPTION("Capacity must be less than 16MB");
+        m_capacity = 0;
+    }
+}
+
+/**
+ * Forgets everything stored in the display
+ */
+void AssetCache::reset() {
+    m_images.clear();
+    m_image_index.clear();
+    m_chars.clear();
+    m_char_index.clear();
+    m_download_on = false;
+}
+
+/**
+ * Bytes of bit image RAM to use. Changing it forgets the stored images.
+ */
+Napi::Value AssetCache::capacity(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        uint32_t in_value = info[0].As<Napi::Number>().Uint32Value();
+        if (in_value > 0xFFFFFF) {
+            EXCEPTION("Capacity must be less than 16MB");
+        } else {
+            m_capacity = in_value;
+            m_images.clear();
+            m_image_index.clear();
+        }
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), m_capacity);
+    }
+}
+
+/**
+ * characters(first, last): character codes used for downloaded glyphs,
+ * 0x80 to 0xFF by default. These codes no longer show the built-in
+ * characters once a glyph is downloaded. Returns [first, last] without
+ * arguments.
+ */
+Napi::Value AssetCache::characters(const Napi::CallbackInfo& info) {
+    if (info.Length() > 1 && info[0].IsNumber() && info[1].IsNumber()) {
+        uint32_t first = info[0].As<Napi::Number>().Uint32Value();
+        uint32_t last = info[1].As<Napi::Number>().Uint32Value();
+        if (first < 0x20 || last > 0xFF || first > last) {
+            EXCEPTION("Character codes must be between 0x20 and 0xFF");
+        } else {
+            m_first = first;
+            m_last = last;
+            m_chars.clear();
+            m_char_index.clear();
+        }
+        return info.This();
+    } else {
+        Napi::Array codes = Napi::Array::New(info.Env(), 2);
+        codes.Set((uint32_t)0, Napi::Number::New(info.Env(), m_first));
+        codes.Set((uint32_t)1, Napi::Number::New(info.Env(), m_last));
+        return codes;
+    }
+}
+
+/**
+ * Finds room for an image in the bit image RAM, evicting the least
+ * recently used ones until it fits
+ */
+bool AssetCache::allocate(uint32_t length, uint32_t& address) {
+    std::vector<std::pair<uint32_t, uint32_t>> used;
+
+    if (!length || length > m_capacity)
+        return false;
+
+    while (true) {
+        used.clear();
+        for (const StoredImage& stored : m_images) {
+            used.push_back(std::make_pair(stored.address, stored.length));
+        }
+        std::sort(used.begin(), used.end());
+
+        uint32_t pos = 0;
+        for (const auto& range : used) {
+            if (range.first - pos >= length) {
+                address = pos;
+                return true;
+            }
+            pos = range.first + range.second;
+        }
+        if (m_capacity - pos >= length) {
+            address = pos;
+            return true;
+        }
+
+        m_image_index.erase(m_images.back().hash);
+        m_images.pop_back();
+        m_evictions++;
+    }
+}
+
+/**
+ * Shows an image at the cursor: from the bit image RAM when it is there,
+ * otherwise stores it first. Images too small to gain anything and images
+ * larger than the RAM are sent as real time bit images.
+ */
+void AssetCache::put_image(CommandBuffer& commands, uint16_t width, uint16_t rows, const uint8_t *data) {
+    uint32_t length = (uint32_t)width * rows;
+    uint32_t address;
+
+    if (NTK_BIT_IMAGE_BYTES + length <= NTK_STORED_IMAGE_BYTES) {
+        commands.bit_image(width, rows, data);
+        return;
+    }
+
+    uint64_t hash = asset_hash(width, rows, data, length);
+    auto found = m_image_index.find(hash);
+    if (found != m_image_index.end()) {
+        m_images.splice(m_images.begin(), m_images, found->second);
+        commands.stored_image(found->second->address, rows, width, rows);
+        m_hits++;
+        m_saved += NTK_BIT_IMAGE_BYTES + length - NTK_STORED_IMAGE_BYTES;
+        return;
+    }
+
+    m_misses++;
+    if (!this->allocate(length, address)) {
+        commands.bit_image(width, rows, data);
+        return;
+    }
+    memcpy(commands.define_image(address, length), data, length);
+    commands.stored_image(address, rows, width, rows);
+    m_saved -= NTK_DEFINE_IMAGE_BYTES + NTK_STORED_IMAGE_BYTES - NTK_BIT_IMAGE_BYTES;
+
+    StoredImage stored = { hash, address, length };
+    m_images.push_front(stored);
+    m_image_index[hash] = m_images.begin();
+}
+
+/**
+ * Gets a character code showing a glyph, downloading it first if needed
+ * (in place of the least recently used one when all codes are taken)
+ */
+uint8_t AssetCache::put_char(CommandBuffer& commands, uint8_t rows, uint8_t width, const uint8_t *data) {
+    size_t length = (size_t)width * rows;
+    uint64_t hash = asset_hash(width, rows, data, length);
+
+    auto found = m_char_index.find(hash);
+    if (found != m_char_index.end()) {
+        m_chars.splice(m_chars.begin(), m_chars, found->second);
+        m_hits++;
+        m_saved += length - 1;
+        return found->second->code;
+    }
+
+    m_misses++;
+    if (!m_download_on) {
+        commands.download_characters(true);
+        m_download_on = true;
+        m_saved -= 3;
+    }
+
+    uint8_t code;
+    if (m_chars.size() < (size_t)(m_last - m_first + 1)) {
+        code = m_first + m_chars.size();
+    } else {
+        code = m_chars.back().code;
+        m_char_index.erase(m_chars.back().hash);
+        m_chars.pop_back();
+        m_evictions++;
+    }
+    memcpy(commands.define_character(rows, code, width), data, length);
+    m_saved -= NTK_DEFINE_CHAR_BYTES + 1;
+
+    StoredChar stored = { hash, code };
+    m_chars.push_front(stored);
+    m_char_index[hash] = m_chars.begin();
+    return code;
+}
+
+/**
+ * image(encoder, width, rows, data): adds to the encoder the commands
+ * showing a bit image at the cursor (width in dots, rows of 8 dots, data
+ * column by column like Encoder.bitImage()), through the bit image RAM
+ */
+Napi::Value AssetCache::image(const Napi::CallbackInfo& info) {
+    Encoder *encoder = Encoder::FromValue(info[0]);
+    if (!encoder) {
+        EXCEPTION("Argument 1 must be an Encoder");
+        return info.This();
+    }
+    if (!info[1].IsNumber() || !info[2].IsNumber() || !info[3].IsBuffer()) {
+        EXCEPTION("Wrong arguments");
+        return info.This();
+    }
+    uint32_t width = info[1].As<Napi::Number>().Uint32Value();
+    uint32_t rows = info[2].As<Napi::Number>().Uint32Value();
+    Napi::Buffer<uint8_t> data = info[3].As<Napi::Buffer<uint8_t>>();
+    if (width > 0xFFFF || rows > 0xFFFF || data.Length() != (size_t)width * rows) {
+        EXCEPTION("Buffer size must be width * rows");
+        return info.This();
+    }
+
+    this->put_image(encoder->commands(), width, rows, data.Data());
+    return info.This();
+}
+
+/**
+ * text(encoder, font, text): adds the text to the encoder as downloaded
+ * characters made from the font glyphs. The display font size has to
+ * match the font height (font(1) up to 8 dots, font(2) up to 16...).
+ * Returns the width of the text in dots.
+ */
+Napi::Value AssetCache::text(const Napi::CallbackInfo& info) {
+    Encoder *encoder = Encoder::FromValue(info[0]);
+    if (!encoder) {
+        EXCEPTION("Argument 1 must be an Encoder");
+        return info.Env().Undefined();
+    }
+    Font *font = Font::FromValue(info[1]);
+    if (!font) {
+        EXCEPTION("Argument 2 must be a Font");
+        return info.Env().Undefined();
+    }
+    if (!Font::text_codes(info[2], m_codes)) {
+        EXCEPTION("Argument 3 must be a string or a Buffer");
+        return info.Env().Undefined();
+    }
+
+    int rows = font->strip_rows();
+    if (rows > (int)sizeof(max_char_width)) {
+        EXCEPTION("Font too tall for downloaded characters");
+        return info.Env().Undefined();
+    }
+    for (uint32_t code : m_codes) {
+        const Glyph *g = font->glyph(code);
+        if (g && g->advance > max_char_width[rows - 1]) {
+            EXCEPTION("Glyph too wide for downloaded characters");
+            return info.Env().Undefined();
+        }
+    }
+
+    CommandBuffer& commands = encoder->commands();
+    uint32_t width = 0;
+    for (uint32_t code : m_codes) {
+        const Glyph *g = font->glyph(code);
+        if (!g || !g->advance)
+            continue;
+        uint8_t c = this->put_char(commands, rows, g->advance, font->glyph_columns(g));
+        commands.raw(&c, 1);
+        width += g->advance;
+    }
+    return Napi::Number::New(info.Env(), width);
+}
+
+/**
+ * flush(spi, encoder): sends the encoder commands like Encoder.flush().
+ * Images and glyphs are recorded as stored when they are encoded, so when
+ * the send fails the cache forgets everything: the display RAM may not
+ * hold what it thinks. The commands stay in the encoder.
+ */
+Napi::Value AssetCache::flush(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.This();
+    }
+    Encoder *encoder = Encoder::FromValue(info[1]);
+    if (!encoder) {
+        EXCEPTION("Argument 2 must be an Encoder");
+        return info.This();
+    }
+
+    const char *error = spi->transmit_commands(encoder->commands());
+    if (error) {
+        this->reset();
+        Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+        return info.This();
+    }
+    encoder->commands().reset();
+    return info.This();
+}
+
+/**
+ * Forgets what is stored in the display, to be called after it was reset
+ * (initialize command or power cycle)
+ */
+Napi::Value AssetCache::invalidate(const Napi::CallbackInfo& info) {
+    this->reset();
+    return info.This();
+}
+
+/**
+ * Hit and miss counts, evictions, bytes saved compared to sending every
+ * image and glyph as a real time bit image (negative while the cache is
+ * filling up), and what is currently stored
+ */
+Napi::Value AssetCache::stats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Object stats = Napi::Object::New(env);
+    uint32_t used = 0;
+
+    for (const StoredImage& stored : m_images) {
+        used += stored.length;
+    }
+    stats.Set("hits", Napi::Number::New(env, m_hits));
+    stats.Set("misses", Napi::Number::New(env, m_misses));
+    stats.Set("evictions", Napi::Number::New(env, m_evictions));
+    stats.Set("bytesSaved", Napi::Number::New(env, (double)m_saved));
+    stats.Set("images", Napi::Number::New(env, m_images.size()));
+    stats.Set("imageBytes", Napi::Number::New(env, used));
+    stats.Set("characters", Napi::Number::New(env, m_chars.size()));
+    return stats;
+}
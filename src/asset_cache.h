@@ -0,0 +1,65 @@
+#pragma once
+
+#include <napi.h>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "noritake.h"
+
+/**
+ * Keeps track of the images and characters stored in the display RAM, so
+ * that showing them again only takes a short command. Bit images go to the
+ * bit image RAM, font glyphs become downloaded characters. Both are evicted
+ * least recently used first.
+ */
+class AssetCache : public Napi::ObjectWrap<AssetCache> {
+    public:
+        AssetCache(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value capacity(const Napi::CallbackInfo& info);
+        Napi::Value characters(const Napi::CallbackInfo& info);
+        Napi::Value image(const Napi::CallbackInfo& info);
+        Napi::Value text(const Napi::CallbackInfo& info);
+        Napi::Value flush(const Napi::CallbackInfo& info);
+        Napi::Value invalidate(const Napi::CallbackInfo& info);
+        Napi::Value stats(const Napi::CallbackInfo& info);
+
+    private:
+        // Image stored in the bit image RAM
+        struct StoredImage {
+            uint64_t hash;
+            uint32_t address;
+            uint32_t length;
+        };
+        // Glyph stored as a downloaded character
+        struct StoredChar {
+            uint64_t hash;
+            uint8_t code;
+        };
+
+        static Napi::FunctionReference constructor;
+        bool allocate(uint32_t length, uint32_t& address);
+        void put_image(CommandBuffer& commands, uint16_t width, uint16_t rows, const uint8_t *data);
+        uint8_t put_char(CommandBuffer& commands, uint8_t rows, uint8_t width, const uint8_t *data);
+        void reset();
+
+        uint32_t m_capacity;          // Bytes of bit image RAM to use
+        uint8_t m_first;              // Character codes to use
+        uint8_t m_last;
+
+        // Most recently used first
+        std::list<StoredImage> m_images;
+        std::unordered_map<uint64_t, std::list<StoredImage>::iterator> m_image_index;
+        std::list<StoredChar> m_chars;
+        std::unordered_map<uint64_t, std::list<StoredChar>::iterator> m_char_index;
+        bool m_download_on;           // Downloaded characters enabled
+
+        uint32_t m_hits;
+        uint32_t m_misses;
+        uint32_t m_evictions;
+        int64_t m_saved;              // Bytes not sent thanks to hits
+
+        std::vector<uint32_t> m_codes;
+};
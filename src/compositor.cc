@@ -0,0 +1,367 @@
+#include "compositor.h"
+#include "framebuffer.h"
+#include "spi_driver.h"
+
+#include <string.h>
+#include <algorithm>
+
+Napi::FunctionReference Compositor::constructor;
+
+#define INT_ARG(N, DEFAULT) (info[N].IsNumber() ? info[N].As<Napi::Number>().Int32Value() : (DEFAULT))
+
+// Cursor set + bit image header: resending up to that many unchanged
+// bytes is cheaper than starting a new write
+#define WRITE_HEADER_BYTES (NTK_CURSOR_BYTES + NTK_BIT_IMAGE_BYTES)
+
+Napi::Object Compositor::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "Compositor",
+        {
+            InstanceMethod("window", &Compositor::window),
+            InstanceMethod("remove", &Compositor::remove),
+            InstanceMethod("windows", &Compositor::windows),
+            InstanceMethod("update", &Compositor::update),
+            InstanceMethod("dirty", &Compositor::dirty),
+            InstanceMethod("invalidate", &Compositor::invalidate),
+            InstanceMethod("encode", &Compositor::encode),
+            InstanceMethod("flush", &Compositor::flush),
+            InstanceMethod("fillAreas", &Compositor::fillAreas),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("Compositor", func);
+
+    return exports;
+}
+
+/**
+ * new Compositor(width, height): screen size in dots, defaults to 256x64
+ */
+Compositor::Compositor(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<Compositor>(info),
+    m_width(INT_ARG(0, 256)),
+    m_rows(INT_ARG(1, 64) / NTK_ROW_DOTS),
+    m_known(false),
+    m_fill(true) {
+
+    if (m_width <= 0 || m_rows <= 0 || m_width > 0xFFFF || m_rows > 0xFFFF) {
+        EXCEPTION("Wrong screen size");
+        m_width = 1;
+        m_rows = 1;
+    }
+    m_screen.resize((size_t)m_width * m_rows, 0);
+    m_shown.resize((size_t)m_width * m_rows, 0);
+}
+
+Compositor::Window *Compositor::find(const std::string& name) {
+    for (Window& w : m_windows) {
+        if (w.name == name)
+            return &w;
+    }
+    return NULL;
+}
+
+/**
+ * Adds an area to look at on the next flush
+ */
+void Compositor::mark(int x, int row, int width, int rows) {
+    DiffWrite area = { (uint16_t)x, (uint16_t)row, (uint16_t)width, (uint16_t)rows };
+    if (width > 0 && rows > 0)
+        m_dirty.push_back(area);
+}
+
+/**
+ * window(name, x, y, width, height): creates a window on top of the others,
+ * or moves an existing one (its content is then cleared). y and height
+ * must be multiples of 8. window(name) returns its geometry, or undefined.
+ */
+Napi::Value Compositor::window(const Napi::CallbackInfo& info) {
+    if (!info[0].IsString()) {
+        EXCEPTION("Argument 1 must be a window name");
+        return info.Env().Undefined();
+    }
+    std::string name = info[0].As<Napi::String>().Utf8Value();
+    Window *w = this->find(name);
+
+    if (info.Length() < 5) {
+        if (!w)
+            return info.Env().Undefined();
+        Napi::Object geometry = Napi::Object::New(info.Env());
+        geometry.Set("x", Napi::Number::New(info.Env(), w->x));
+        geometry.Set("y", Napi::Number::New(info.Env(), w->row * NTK_ROW_DOTS));
+        geometry.Set("width", Napi::Number::New(info.Env(), w->width));
+        geometry.Set("height", Napi::Number::New(info.Env(), w->rows * NTK_ROW_DOTS));
+        return geometry;
+    }
+
+    for (size_t i = 1; i < 5; i++) {
+        if (!info[i].IsNumber()) {
+            EXCEPTION("Wrong arguments");
+            return info.This();
+        }
+    }
+    int x = INT_ARG(1, 0);
+    int y = INT_ARG(2, 0);
+    int width = INT_ARG(3, 0);
+    int height = INT_ARG(4, 0);
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > m_width ||
+        y % NTK_ROW_DOTS || height % NTK_ROW_DOTS ||
+        (y + height) / NTK_ROW_DOTS > m_rows) {
+        EXCEPTION("Window must be on screen, y and height multiples of 8");
+        return info.This();
+    }
+
+    if (w) {
+        this->mark(w->x, w->row, w->width, w->rows);
+    } else {
+        m_windows.push_back(Window());
+        w = &m_windows.back();
+        w->name = name;
+    }
+    w->x = x;
+    w->row = y / NTK_ROW_DOTS;
+    w->width = width;
+    w->rows = height / NTK_ROW_DOTS;
+    w->content.assign((size_t)w->width * w->rows, 0);
+    this->mark(w->x, w->row, w->width, w->rows);
+    return info.This();
+}
+
+/**
+ * remove(name): deletes a window, what was below shows up again on the
+ * next flush
+ */
+Napi::Value Compositor::remove(const Napi::CallbackInfo& info) {
+    std::string name = info[0].IsString() ? info[0].As<Napi::String>().Utf8Value() : "";
+
+    for (auto it = m_windows.begin(); it != m_windows.end(); ++it) {
+        if (it->name == name) {
+            this->mark(it->x, it->row, it->width, it->rows);
+            m_windows.erase(it);
+            break;
+        }
+    }
+    return info.This();
+}
+
+/**
+ * Window names, bottom first
+ */
+Napi::Value Compositor::windows(const Napi::CallbackInfo& info) {
+    Napi::Array names = Napi::Array::New(info.Env(), m_windows.size());
+
+    for (size_t i = 0; i < m_windows.size(); i++) {
+        names.Set(i, Napi::String::New(info.Env(), m_windows[i].name));
+    }
+    return names;
+}
+
+/**
+ * update(name, content): new content for a window, a Buffer in display
+ * layout or a FrameBuffer of the window size. It is copied, and only sent
+ * on the next flush.
+ */
+Napi::Value Compositor::update(const Napi::CallbackInfo& info) {
+    Window *w = info[0].IsString() ? this->find(info[0].As<Napi::String>().Utf8Value()) : NULL;
+    if (!w) {
+        EXCEPTION("Argument 1 must be a window name");
+        return info.This();
+    }
+
+    const uint8_t *data = NULL;
+    FrameBuffer *fb = FrameBuffer::FromValue(info[1]);
+    if (fb && fb->columns() == w->width && fb->rows() == w->rows) {
+        data = fb->data();
+    } else if (info[1].IsBuffer() && info[1].As<Napi::Buffer<uint8_t>>().Length() == w->content.size()) {
+        data = info[1].As<Napi::Buffer<uint8_t>>().Data();
+    }
+    if (!data) {
+        EXCEPTION("Content must be a Buffer or a FrameBuffer of the window size");
+        return info.This();
+    }
+
+    memcpy(w->content.data(), data, w->content.size());
+    this->mark(w->x, w->row, w->width, w->rows);
+    return info.This();
+}
+
+/**
+ * Tells whether something is waiting for a flush
+ */
+Napi::Value Compositor::dirty(const Napi::CallbackInfo& info) {
+    return Napi::Boolean::New(info.Env(), !m_dirty.empty() || !m_known);
+}
+
+/**
+ * Forgets what the display shows: the next flush selects the base window
+ * and writes the whole screen. To be called after something else wrote to
+ * the display.
+ */
+Napi::Value Compositor::invalidate(const Napi::CallbackInfo& info) {
+    m_known = false;
+    return info.This();
+}
+
+/**
+ * Paints the windows bottom first into the screen
+ */
+void Compositor::compose() {
+    std::fill(m_screen.begin(), m_screen.end(), 0);
+
+    for (const Window& w : m_windows) {
+        for (int c = 0; c < w.width; c++) {
+            memcpy(&m_screen[(size_t)(w.x + c) * m_rows + w.row], &w.content[(size_t)c * w.rows], w.rows);
+        }
+    }
+}
+
+/**
+ * Finds the changed column spans of an area, with their changed rows, and
+ * merges neighbours when resending the columns between them is cheaper
+ * than another write header. What gets written is copied to m_shown, so
+ * overlapping areas are only sent once.
+ */
+void Compositor::diff_area(const DiffWrite& area) {
+    DiffWrite span = { 0, 0, 0, 0 };
+
+    for (int c = area.x; c <= area.x + area.width; c++) {
+        int lo = -1, hi = -1;
+        if (c < area.x + area.width) {
+            const uint8_t *s = &m_screen[(size_t)c * m_rows];
+            const uint8_t *d = &m_shown[(size_t)c * m_rows];
+            for (int r = area.row; r < area.row + area.rows; r++) {
+                if (s[r] != d[r]) {
+                    lo = lo < 0 ? r : lo;
+                    hi = r;
+                }
+            }
+            if (lo < 0)
+                continue;
+        }
+
+        if (span.width) {
+            int top = lo >= 0 && lo < span.row ? lo : span.row;
+            int bottom = hi > span.row + span.rows - 1 ? hi : span.row + span.rows - 1;
+            int gap = c - (span.x + span.width);
+            if (lo >= 0 && gap * (bottom - top + 1) <= WRITE_HEADER_BYTES) {
+                span.width = c + 1 - span.x;
+                span.row = top;
+                span.rows = bottom - top + 1;
+                continue;
+            }
+            m_writes.push_back(span);
+            for (int k = span.x; k < span.x + span.width; k++) {
+                memcpy(&m_shown[(size_t)k * m_rows + span.row], &m_screen[(size_t)k * m_rows + span.row], span.rows);
+            }
+            span.width = 0;
+        }
+        if (lo >= 0) {
+            span.x = c;
+            span.row = lo;
+            span.width = 1;
+            span.rows = hi - lo + 1;
+        }
+    }
+}
+
+/**
+ * Turns the pending updates into commands: writes from all windows are
+ * gathered, side by side writes over the same rows are merged, and the
+ * whole screen goes out in one write when nothing is known
+ */
+void Compositor::encode_updates(CommandBuffer& commands) {
+    commands.reset();
+    m_writes.clear();
+    this->compose();
+
+    if (!m_known) {
+        DiffWrite all = { 0, 0, (uint16_t)m_width, (uint16_t)m_rows };
+        m_writes.push_back(all);
+        m_shown = m_screen;
+        commands.window(0);
+        m_known = true;
+    } else {
+        for (const DiffWrite& area : m_dirty) {
+            this->diff_area(area);
+        }
+    }
+    m_dirty.clear();
+
+    std::sort(m_writes.begin(), m_writes.end(), [](const DiffWrite& a, const DiffWrite& b) {
+        return a.row != b.row ? a.row < b.row : a.rows != b.rows ? a.rows < b.rows : a.x < b.x;
+    });
+    size_t count = 0;
+    for (size_t i = 0; i < m_writes.size(); i++) {
+        DiffWrite& last = m_writes[count ? count - 1 : 0];
+        const DiffWrite& w = m_writes[i];
+        if (count && w.row == last.row && w.rows == last.rows && w.x >= last.x + last.width &&
+            (w.x - last.x - last.width) * w.rows <= WRITE_HEADER_BYTES) {
+            last.width = w.x + w.width - last.x;
+        } else {
+            m_writes[count++] = w;
+        }
+    }
+    m_writes.resize(count);
+
+    for (const DiffWrite& w : m_writes) {
+        commands.image_area(m_screen.data(), m_rows, w.x, w.row, w.width, w.rows, m_fill);
+        // Columns merged in between windows are sent too
+        for (int c = 0; c < w.width; c++) {
+            memcpy(&m_shown[(size_t)(w.x + c) * m_rows + w.row], &m_screen[(size_t)(w.x + c) * m_rows + w.row], w.rows);
+        }
+    }
+}
+
+/**
+ * encode(): returns the commands of the next flush as a Buffer, and
+ * considers them sent
+ */
+Napi::Value Compositor::encode(const Napi::CallbackInfo& info) {
+    this->encode_updates(m_commands);
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_commands.data(), m_commands.length());
+}
+
+/**
+ * flush(spi): sends all pending updates in one go, under the bus lock.
+ * Returns the number of writes and bytes sent.
+ */
+Napi::Value Compositor::flush(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.Env().Undefined();
+    }
+
+    this->encode_updates(m_commands);
+    if (m_commands.length()) {
+        const char *error = spi->transmit_commands(m_commands);
+        if (error) {
+            // Don't know what made it to the display
+            m_known = false;
+            Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
+    }
+
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("writes", Napi::Number::New(info.Env(), m_writes.size()));
+    result.Set("bytes", Napi::Number::New(info.Env(), m_commands.length()));
+    return result;
+}
+
+/**
+ * Draws blank or fully lit areas of the updates with the display filled
+ * box command when that is shorter than their bit image bytes. On by
+ * default.
+ */
+Napi::Value Compositor::fillAreas(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsBoolean()) {
+        m_fill = info[0].As<Napi::Boolean>().Value();
+        return info.This();
+    } else {
+        return Napi::Boolean::New(info.Env(), m_fill);
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <napi.h>
+#include <string>
+#include <vector>
+
+#include "noritake.h"
+#include "frame_diff.h"
+
+/**
+ * Owns named screen regions updated independently (clock, status bar...),
+ * and turns all their pending updates into a single command stream per
+ * flush, sent in one go. Windows are stacked in creation order.
+ */
+class Compositor : public Napi::ObjectWrap<Compositor> {
+    public:
+        Compositor(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value window(const Napi::CallbackInfo& info);
+        Napi::Value remove(const Napi::CallbackInfo& info);
+        Napi::Value windows(const Napi::CallbackInfo& info);
+        Napi::Value update(const Napi::CallbackInfo& info);
+        Napi::Value dirty(const Napi::CallbackInfo& info);
+        Napi::Value invalidate(const Napi::CallbackInfo& info);
+        Napi::Value encode(const Napi::CallbackInfo& info);
+        Napi::Value flush(const Napi::CallbackInfo& info);
+        Napi::Value fillAreas(const Napi::CallbackInfo& info);
+
+    private:
+        struct Window {
+            std::string name;
+            int x;
+            int row;
+            int width;
+            int rows;
+            std::vector<uint8_t> content;   // Display layout, window sized
+        };
+
+        static Napi::FunctionReference constructor;
+        Window *find(const std::string& name);
+        void mark(int x, int row, int width, int rows);
+        void compose();
+        void diff_area(const DiffWrite& area);
+        void encode_updates(CommandBuffer& commands);
+
+        int m_width;
+        int m_rows;
+        std::vector<Window> m_windows;        // Bottom first
+        std::vector<DiffWrite> m_dirty;       // Areas to look at on flush
+        std::vector<uint8_t> m_screen;        // Composed screen
+        std::vector<uint8_t> m_shown;         // What the display shows
+        bool m_known;                         // m_shown and the display
+                                              // state can be trusted
+        bool m_fill;                          // Filled boxes for uniform
+                                              // areas
+        std::vector<DiffWrite> m_writes;
+        CommandBuffer m_commands;
+};
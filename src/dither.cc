@@ -0,0 +1,106 @@
+#include "dither.h"
+#include "packer.h"
+
+#include <string.h>
+
+// Error diffusion margin on each side of a line
+#define ERROR_MARGIN 2
+
+static const uint8_t bayer8[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+/**
+ * Error diffusion over one line. Errors are kept in 1/16th so that both the
+ * Floyd-Steinberg (x/16) and Atkinson (1/8) weights stay integers.
+ */
+static void diffuse_line(DitherBand& band, const uint8_t *gray, int y,
+                         int *e0, int *e1, int *e2) {
+    uint8_t *out = band.out + y / 8;
+    uint8_t bit = 0x80 >> (y & 7);
+    bool serpentine = band.mode == DITHER_FLOYD_STEINBERG && ((y - band.y0) & 1);
+    int dir = serpentine ? -1 : 1;
+    int x = serpentine ? band.width - 1 : 0;
+
+    for (int i = 0; i < band.width; i++, x += dir) {
+        int value = band.invert ? 255 - gray[x] : gray[x];
+        value += e0[x] / 16;
+
+        int error = value;
+        if (value >= band.threshold) {
+            out[x * band.stride] |= bit;
+            error -= 255;
+        }
+
+        if (band.mode == DITHER_FLOYD_STEINBERG) {
+            e0[x + dir] += error * 7;
+            e1[x - dir] += error * 3;
+            e1[x] += error * 5;
+            e1[x + dir] += error;
+        } else {
+            // Atkinson only spreads 6/8 of the error, which keeps contrast
+            error *= 2;
+            e0[x + 1] += error;
+            e0[x + 2] += error;
+            e1[x - 1] += error;
+            e1[x] += error;
+            e1[x + 1] += error;
+            e2[x] += error;
+        }
+    }
+}
+
+static void bayer_line(DitherBand& band, const uint8_t *gray, int y) {
+    uint8_t *out = band.out + y / 8;
+    uint8_t bit = 0x80 >> (y & 7);
+    int bias = band.threshold - 128;
+
+    for (int x = 0; x < band.width; x++) {
+        int value = band.invert ? 255 - gray[x] : gray[x];
+        if (value - bias >= bayer8[y & 7][x & 7] * 4 + 2)
+            out[x * band.stride] |= bit;
+    }
+}
+
+void dither_band(DitherBand& band) {
+    int line = band.width + 2 * ERROR_MARGIN;
+
+    if (band.bpp == 4)
+        band.gray.resize(band.width);
+    band.error.assign(3 * line, 0);
+
+    // Start from blank bytes, including the padding dots of the last row
+    for (int row = band.y0 / 8; row < (band.y1 + 7) / 8; row++) {
+        for (int x = 0; x < band.width; x++) {
+            band.out[x * band.stride + row] = 0;
+        }
+    }
+
+    for (int y = band.y0; y < band.y1; y++) {
+        const uint8_t *gray = band.src + (size_t)y * band.width * band.bpp;
+        if (band.bpp == 4) {
+            band.kernel->rgba_to_gray(gray, band.gray.data(), band.width);
+            gray = band.gray.data();
+        }
+
+        if (band.mode == DITHER_BAYER) {
+            bayer_line(band, gray, y);
+            continue;
+        }
+
+        // Ring of 3 error lines: current, next and the one after
+        int n = y - band.y0;
+        int *e0 = band.error.data() + (n % 3) * line + ERROR_MARGIN;
+        int *e1 = band.error.data() + ((n + 1) % 3) * line + ERROR_MARGIN;
+        int *e2 = band.error.data() + ((n + 2) % 3) * line + ERROR_MARGIN;
+        diffuse_line(band, gray, y, e0, e1, e2);
+        memset(e0 - ERROR_MARGIN, 0, line * sizeof(int));
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+struct PackKernel;
+
+// Dithering modes
+#define DITHER_NONE            0    // Plain threshold
+#define DITHER_FLOYD_STEINBERG 1
+#define DITHER_ATKINSON        2
+#define DITHER_BAYER           3    // 8x8 ordered
+
+/**
+ * Dithers lines [y0, y1) of a grayscale or RGBA image straight into the
+ * display memory layout. Bands that start on a multiple of 8 lines write
+ * disjoint output bytes, so several of them can run in parallel (error
+ * diffusion then restarts at the top of each band).
+ */
+struct DitherBand {
+    const uint8_t *src;
+    int bpp;
+    int width;
+    int y0;
+    int y1;
+    uint8_t *out;
+    int stride;             // Output bytes per column
+    int mode;
+    uint8_t threshold;
+    bool invert;
+    const PackKernel *kernel;
+
+    // Scratch space, kept between frames
+    std::vector<uint8_t> gray;
+    std::vector<int> error;
+};
+
+void dither_band(DitherBand& band);
@@ -0,0 +1,264 @@
+#include "encoder.h"
+#include "spi_driver.h"
+
+Napi::FunctionReference Encoder::constructor;
+
+// Checks that the first count arguments are numbers
+#define ASSERT_NUMBERS(COUNT)                                                  \
+    for (size_t i = 0; i < (COUNT); i++) {                                     \
+        if (!info[i].IsNumber()) {                                             \
+            EXCEPTION("Wrong arguments");                                      \
+            return info.This();                                                \
+        }                                                                      \
+    }
+
+#define ARG(N) info[N].As<Napi::Number>().Uint32Value()
+
+Napi::Object Encoder::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "Encoder",
+        {
+            InstanceMethod("initialize", &Encoder::initialize),
+            InstanceMethod("clear", &Encoder::clear),
+            InstanceMethod("home", &Encoder::home),
+            InstanceMethod("cursor", &Encoder::cursor),
+            InstanceMethod("font", &Encoder::font),
+            InstanceMethod("magnify", &Encoder::magnify),
+            InstanceMethod("reverse", &Encoder::reverse),
+            InstanceMethod("brightness", &Encoder::brightness),
+            InstanceMethod("window", &Encoder::window),
+            InstanceMethod("defineWindow", &Encoder::defineWindow),
+            InstanceMethod("scroll", &Encoder::scroll),
+            InstanceMethod("wait", &Encoder::wait),
+            InstanceMethod("bitImage", &Encoder::bitImage),
+            InstanceMethod("memoryWrite", &Encoder::memoryWrite),
+            InstanceMethod("text", &Encoder::text),
+            InstanceMethod("raw", &Encoder::raw),
+            InstanceMethod("length", &Encoder::length),
+            InstanceMethod("reset", &Encoder::reset),
+            InstanceMethod("buffer", &Encoder::buffer),
+            InstanceMethod("flush", &Encoder::flush),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("Encoder", func);
+
+    return exports;
+}
+
+Encoder::Encoder(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<Encoder>(info) {
+
+}
+
+/**
+ * Gets the native encoder behind a JS value, or NULL
+ */
+Encoder *Encoder::FromValue(Napi::Value value) {
+    if (!value.IsObject() || !value.As<Napi::Object>().InstanceOf(constructor.Value()))
+        return NULL;
+    return Encoder::Unwrap(value.As<Napi::Object>());
+}
+
+Napi::Value Encoder::initialize(const Napi::CallbackInfo& info) {
+    m_commands.initialize();
+    return info.This();
+}
+
+Napi::Value Encoder::clear(const Napi::CallbackInfo& info) {
+    m_commands.clear();
+    return info.This();
+}
+
+Napi::Value Encoder::home(const Napi::CallbackInfo& info) {
+    m_commands.home();
+    return info.This();
+}
+
+/**
+ * cursor(x, y): x in dots, y in rows of 8 dots
+ */
+Napi::Value Encoder::cursor(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(2);
+    m_commands.cursor(ARG(0), ARG(1));
+    return info.This();
+}
+
+Napi::Value Encoder::font(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(1);
+    m_commands.font(ARG(0));
+    return info.This();
+}
+
+Napi::Value Encoder::magnify(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(2);
+    m_commands.magnify(ARG(0), ARG(1));
+    return info.This();
+}
+
+Napi::Value Encoder::reverse(const Napi::CallbackInfo& info) {
+    m_commands.reverse(info[0].IsBoolean() && info[0].As<Napi::Boolean>().Value());
+    return info.This();
+}
+
+Napi::Value Encoder::brightness(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(1);
+    m_commands.brightness(ARG(0));
+    return info.This();
+}
+
+Napi::Value Encoder::window(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(1);
+    m_commands.window(ARG(0));
+    return info.This();
+}
+
+/**
+ * defineWindow(n, x, y, width, height): x and width in dots, y and height
+ * in rows of 8 dots
+ */
+Napi::Value Encoder::defineWindow(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(5);
+    m_commands.define_window(ARG(0), ARG(1), ARG(2), ARG(3), ARG(4));
+    return info.This();
+}
+
+/**
+ * scroll(shift, count, speed): shift is in bytes of display memory
+ */
+Napi::Value Encoder::scroll(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(3);
+    m_commands.scroll(ARG(0), ARG(1), ARG(2));
+    return info.This();
+}
+
+Napi::Value Encoder::wait(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(1);
+    m_commands.wait(ARG(0));
+    return info.This();
+}
+
+/**
+ * bitImage(width, rows, buffer): real time bit image at the cursor, the
+ * buffer holds width columns of rows bytes each
+ */
+Napi::Value Encoder::bitImage(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(2);
+    if (!info[2].IsBuffer()) {
+        EXCEPTION("Argument 3 must be a Buffer");
+        return info.This();
+    }
+
+    uint32_t width = ARG(0);
+    uint32_t rows = ARG(1);
+    Napi::Buffer<uint8_t> data = info[2].As<Napi::Buffer<uint8_t>>();
+    if (width > 0xFFFF || rows > 0xFFFF) {
+        EXCEPTION("Image size must be less than 65536");
+        return info.This();
+    }
+    if (data.Length() < (size_t)width * rows) {
+        EXCEPTION("Buffer is too small for the image size");
+        return info.This();
+    }
+
+    m_commands.bit_image(width, rows, data.Data());
+    return info.This();
+}
+
+/**
+ * memoryWrite(address, buffer): writes the buffer straight into the
+ * display memory from address (column by column, rows bytes per column),
+ * without moving the cursor. The payload is RDY checked.
+ */
+Napi::Value Encoder::memoryWrite(const Napi::CallbackInfo& info) {
+    ASSERT_NUMBERS(1);
+    if (!info[1].IsBuffer()) {
+        EXCEPTION("Argument 2 must be a Buffer");
+        return info.This();
+    }
+
+    Napi::Buffer<uint8_t> data = info[1].As<Napi::Buffer<uint8_t>>();
+    uint8_t *payload = m_commands.dad_write(ARG(0), data.Length());
+    memcpy(payload, data.Data(), data.Length());
+    return info.This();
+}
+
+/**
+ * text(string or Buffer): strings are sent as ISO-8859-1, characters that
+ * don't fit are replaced by '?'
+ */
+Napi::Value Encoder::text(const Napi::CallbackInfo& info) {
+    if (info[0].IsBuffer()) {
+        Napi::Buffer<uint8_t> data = info[0].As<Napi::Buffer<uint8_t>>();
+        m_commands.raw(data.Data(), data.Length());
+    } else if (info[0].IsString()) {
+        std::string str = info[0].As<Napi::String>().Utf8Value();
+        for (size_t i = 0; i < str.size(); i++) {
+            uint8_t c = str[i];
+            uint8_t out = c;
+            if (c >= 0x80) {
+                // Decode the UTF-8 sequence, only keep what fits in a byte
+                uint32_t cp = 0;
+                size_t extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+                cp = c & (0x3F >> extra);
+                for (size_t j = 0; j < extra && i + 1 < str.size(); j++)
+                    cp = (cp << 6) | (str[++i] & 0x3F);
+                out = cp < 0x100 ? cp : '?';
+            }
+            m_commands.raw(&out, 1);
+        }
+    } else {
+        EXCEPTION("Argument 1 must be a string or a Buffer");
+    }
+    return info.This();
+}
+
+Napi::Value Encoder::raw(const Napi::CallbackInfo& info) {
+    if (!info[0].IsBuffer()) {
+        EXCEPTION("Argument 1 must be a Buffer");
+        return info.This();
+    }
+    Napi::Buffer<uint8_t> data = info[0].As<Napi::Buffer<uint8_t>>();
+    m_commands.raw(data.Data(), data.Length());
+    return info.This();
+}
+
+Napi::Value Encoder::length(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), m_commands.length());
+}
+
+Napi::Value Encoder::reset(const Napi::CallbackInfo& info) {
+    m_commands.reset();
+    return info.This();
+}
+
+/**
+ * Returns a copy of the pending commands
+ */
+Napi::Value Encoder::buffer(const Napi::CallbackInfo& info) {
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_commands.data(), m_commands.length());
+}
+
+/**
+ * flush(spi): sends all pending commands to an opened Spi device, then
+ * empties the buffer. Bitmap payloads go out in DMA mode. When the send
+ * fails, the commands are kept so that flush() can be tried again.
+ */
+Napi::Value Encoder::flush(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.This();
+    }
+
+    const char *error = spi->transmit_commands(m_commands);
+    if (error) {
+        Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+        return info.This();
+    }
+    m_commands.reset();
+    return info.This();
+}
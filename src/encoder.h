@@ -0,0 +1,44 @@
+#pragma once
+
+#include <napi.h>
+
+#include "noritake.h"
+
+/**
+ * Native Noritake command encoder: commands are appended to a reusable
+ * native buffer, which is then sent to a Spi device in one go.
+ */
+class Encoder : public Napi::ObjectWrap<Encoder> {
+    public:
+        Encoder(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value initialize(const Napi::CallbackInfo& info);
+        Napi::Value clear(const Napi::CallbackInfo& info);
+        Napi::Value home(const Napi::CallbackInfo& info);
+        Napi::Value cursor(const Napi::CallbackInfo& info);
+        Napi::Value font(const Napi::CallbackInfo& info);
+        Napi::Value magnify(const Napi::CallbackInfo& info);
+        Napi::Value reverse(const Napi::CallbackInfo& info);
+        Napi::Value brightness(const Napi::CallbackInfo& info);
+        Napi::Value window(const Napi::CallbackInfo& info);
+        Napi::Value defineWindow(const Napi::CallbackInfo& info);
+        Napi::Value scroll(const Napi::CallbackInfo& info);
+        Napi::Value wait(const Napi::CallbackInfo& info);
+        Napi::Value bitImage(const Napi::CallbackInfo& info);
+        Napi::Value memoryWrite(const Napi::CallbackInfo& info);
+        Napi::Value text(const Napi::CallbackInfo& info);
+        Napi::Value raw(const Napi::CallbackInfo& info);
+        Napi::Value length(const Napi::CallbackInfo& info);
+        Napi::Value reset(const Napi::CallbackInfo& info);
+        Napi::Value buffer(const Napi::CallbackInfo& info);
+        Napi::Value flush(const Napi::CallbackInfo& info);
+
+        static Encoder *FromValue(Napi::Value value);
+        CommandBuffer& commands() { return m_commands; }
+
+    private:
+        static Napi::FunctionReference constructor;
+
+        CommandBuffer m_commands;
+};
@@ -50,6 +50,7 @@ struct spi_ioc_transfer {
 #define BCM2835_SPI_MODE3 3
 #define BCM2835_SPI_CS0 0
 #define BCM2835_SPI_CS1 1
+#define BCM2835_SPI_CS_NONE 3
 #define BCM2835_GPIO_FSEL_OUTP 1
 #define BCM2835_GPIO_FSEL_INPT 0
 #define BCM2835_GPIO_PUD_UP 1
@@ -60,7 +61,9 @@ static inline void bcm2835_gpio_write(int pin, int value) { (void)pin; (void)val
 static inline int bcm2835_gpio_lev(int pin) { (void)pin; return 0; }
 static inline void bcm2835_gpio_clr(int pin) { (void)pin; }
 static inline void bcm2835_gpio_set(int pin) { (void)pin; }
+static inline void bcm2835_gpio_write_mask(uint32_t value, uint32_t mask) { (void)value; (void)mask; }
 static inline unsigned char bcm2835_spi_transfer(unsigned char value) { (void)value; return 0; }
+static inline void bcm2835_spi_write(uint16_t data) { (void)data; }
 
 // Stub BCM2835 functions
 static inline int bcm2835_init() { return 1; }
@@ -71,4 +74,10 @@ static inline void bcm2835_spi_set_speed_hz(unsigned int hz) { (void)hz; }
 static inline void bcm2835_spi_chipSelect(int cs) { (void)cs; }
 static inline void bcm2835_spi_setChipSelectPolarity(int cs, int active) { (void)cs; (void)active; }
 static inline void bcm2835_gpio_fsel(int pin, int mode) { (void)pin; (void)mode; }
-static inline void bcm2835_gpio_set_pud(int pin, int pud) { (void)pin; (void)pud; }
\ No newline at end of file
+static inline void bcm2835_gpio_set_pud(int pin, int pud) { (void)pin; (void)pud; }
+static inline void bcm2835_gpio_ren(int pin) { (void)pin; }
+static inline void bcm2835_gpio_fen(int pin) { (void)pin; }
+static inline void bcm2835_gpio_clr_ren(int pin) { (void)pin; }
+static inline void bcm2835_gpio_clr_fen(int pin) { (void)pin; }
+static inline int bcm2835_gpio_eds(int pin) { (void)pin; return 1; }
+static inline void bcm2835_gpio_set_eds(int pin) { (void)pin; }
\ No newline at end of file
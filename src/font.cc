@@ -0,0 +1,334 @@
+#include "font.h"
+#include "framebuffer.h"
+#include "spi_driver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+
+Napi::FunctionReference Font::constructor;
+
+Napi::Object Font::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "Font",
+        {
+            InstanceMethod("height", &Font::height),
+            InstanceMethod("ascent", &Font::ascent),
+            InstanceMethod("rows", &Font::rows),
+            InstanceMethod("glyphs", &Font::glyphs),
+            InstanceMethod("measure", &Font::measure),
+            InstanceMethod("render", &Font::render),
+            InstanceMethod("draw", &Font::draw),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("Font", func);
+
+    return exports;
+}
+
+/**
+ * new Font(bdf): loads a BDF font, given as a string or a Buffer
+ */
+Font::Font(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<Font>(info),
+    m_ascent(0),
+    m_height(0),
+    m_rows(0),
+    m_latin(256, -1),
+    m_default(-1) {
+
+    std::string bdf;
+    if (info[0].IsBuffer()) {
+        Napi::Buffer<char> data = info[0].As<Napi::Buffer<char>>();
+        bdf.assign(data.Data(), data.Length());
+    } else if (info[0].IsString()) {
+        bdf = info[0].As<Napi::String>().Utf8Value();
+    } else {
+        EXCEPTION("Argument 1 must be a BDF font");
+        return;
+    }
+
+    std::string error;
+    if (!load_bdf(bdf, error)) {
+        Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+    }
+}
+
+/**
+ * Gets the native font behind a JS value, or NULL
+ */
+Font *Font::FromValue(Napi::Value value) {
+    if (!value.IsObject() || !value.As<Napi::Object>().InstanceOf(constructor.Value()))
+        return NULL;
+    return Font::Unwrap(value.As<Napi::Object>());
+}
+
+/**
+ * Parses the BDF source and renders every encoded glyph into a cell of the
+ * font height, baseline 'ascent' dots from the top, clipped to its advance
+ * width.
+ */
+bool Font::load_bdf(const std::string& bdf, std::string& error) {
+    std::istringstream in(bdf);
+    std::string line;
+    int bbox_height = 0, bbox_y = 0;
+    int ascent = -1, descent = -1, default_char = -1;
+    bool started = false;
+
+    int32_t code = -1;
+    int advance = 0;
+    int bw = 0, bh = 0, bx = 0, by = 0;
+    bool bitmap = false;
+    int bitmap_line = 0;
+    uint32_t offset = 0;
+
+    while (std::getline(in, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.resize(line.size() - 1);
+        const char *l = line.c_str();
+
+        if (bitmap) {
+            if (!strncmp(l, "ENDCHAR", 7)) {
+                bitmap = false;
+                if (code < 0) {
+                    m_atlas.resize(offset);
+                } else {
+                    Glyph glyph = { offset, (uint16_t)advance };
+                    if (code < 256)
+                        m_latin[code] = m_glyphs.size();
+                    else
+                        m_others[code] = m_glyphs.size();
+                    m_glyphs.push_back(glyph);
+                }
+                continue;
+            }
+
+            // Hex rows, MSB is the leftmost dot
+            int y = m_ascent - (by + bh) + bitmap_line++;
+            for (int c = 0; c < bw && (size_t)(c / 4) < line.size(); c++) {
+                char h = l[c / 4];
+                int nibble = (h >= '0' && h <= '9') ? h - '0' :
+                             (h >= 'A' && h <= 'F') ? h - 'A' + 10 :
+                             (h >= 'a' && h <= 'f') ? h - 'a' + 10 : 0;
+                int x = bx + c;
+                if (!(nibble & (8 >> (c % 4))) || x < 0 || x >= advance || y < 0 || y >= m_height)
+                    continue;
+                m_atlas[offset + x * m_rows + y / NTK_ROW_DOTS] |= 0x80 >> (y % NTK_ROW_DOTS);
+            }
+            continue;
+        }
+
+        if (!strncmp(l, "STARTFONT", 9)) {
+            started = true;
+        } else if (!strncmp(l, "FONTBOUNDINGBOX ", 16)) {
+            int w, x;
+            sscanf(l + 16, "%d %d %d %d", &w, &bbox_height, &x, &bbox_y);
+        } else if (!strncmp(l, "FONT_ASCENT ", 12)) {
+            ascent = atoi(l + 12);
+        } else if (!strncmp(l, "FONT_DESCENT ", 13)) {
+            descent = atoi(l + 13);
+        } else if (!strncmp(l, "DEFAULT_CHAR ", 13)) {
+            default_char = atoi(l + 13);
+        } else if (!strncmp(l, "STARTCHAR", 9)) {
+            if (!started) {
+                error = "Not a BDF font";
+                return false;
+            }
+            if (!m_height) {
+                m_ascent = ascent >= 0 ? ascent : bbox_height + bbox_y;
+                m_height = m_ascent + (descent >= 0 ? descent : -bbox_y);
+                if (m_height <= 0 || m_height > 0xFFFF) {
+                    error = "Wrong font height";
+                    return false;
+                }
+                m_rows = (m_height + NTK_ROW_DOTS - 1) / NTK_ROW_DOTS;
+            }
+            code = -1;
+            advance = 0;
+            bw = bh = bx = by = 0;
+        } else if (!strncmp(l, "ENCODING ", 9)) {
+            code = atoi(l + 9);
+        } else if (!strncmp(l, "DWIDTH ", 7)) {
+            advance = atoi(l + 7);
+        } else if (!strncmp(l, "BBX ", 4)) {
+            sscanf(l + 4, "%d %d %d %d", &bw, &bh, &bx, &by);
+        } else if (!strncmp(l, "BITMAP", 6)) {
+            if (advance <= 0)
+                advance = bx + bw > 0 ? bx + bw : 0;
+            if (advance > 0xFFFF) {
+                error = "Wrong glyph width";
+                return false;
+            }
+            bitmap = true;
+            bitmap_line = 0;
+            offset = m_atlas.size();
+            m_atlas.resize(offset + (size_t)advance * m_rows, 0);
+        }
+    }
+
+    if (m_glyphs.empty()) {
+        error = "No glyphs in font";
+        return false;
+    }
+
+    const Glyph *fallback = (default_char >= 0) ? glyph(default_char) : NULL;
+    fallback = fallback ? fallback : glyph('?');
+    m_default = fallback ? fallback - m_glyphs.data() : -1;
+    return true;
+}
+
+/**
+ * Gets the glyph for a code point, the default one if the font lacks it,
+ * or NULL
+ */
+const Glyph *Font::glyph(uint32_t code) const {
+    int32_t index = -1;
+
+    if (code < 256) {
+        index = m_latin[code];
+    } else {
+        auto it = m_others.find(code);
+        if (it != m_others.end())
+            index = it->second;
+    }
+    index = index >= 0 ? index : m_default;
+    return index >= 0 ? &m_glyphs[index] : NULL;
+}
+
+/**
+ * Gets the code points of a string (UTF-8 decoded) or of a Buffer (one
+ * byte per character)
+ */
+bool Font::text_codes(const Napi::Value& value, std::vector<uint32_t>& codes) {
+    codes.clear();
+
+    if (value.IsBuffer()) {
+        Napi::Buffer<uint8_t> data = value.As<Napi::Buffer<uint8_t>>();
+        codes.assign(data.Data(), data.Data() + data.Length());
+        return true;
+    }
+    if (!value.IsString())
+        return false;
+
+    std::string str = value.As<Napi::String>().Utf8Value();
+    for (size_t i = 0; i < str.size(); ) {
+        uint8_t c = str[i];
+        int extra = c < 0x80 ? 0 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : 3;
+        uint32_t code = extra ? c & (0x3F >> extra) : c;
+        for (int k = 1; k <= extra && i + k < str.size(); k++) {
+            code = (code << 6) | (str[i + k] & 0x3F);
+        }
+        codes.push_back(code);
+        i += extra + 1;
+    }
+    return true;
+}
+
+/**
+ * Renders a string into the strip, one memcpy per glyph. Returns its width.
+ */
+int Font::render_strip(const std::vector<uint32_t>& codes) {
+    size_t width = 0;
+
+    for (uint32_t code : codes) {
+        const Glyph *g = glyph(code);
+        width += g ? g->advance : 0;
+    }
+    m_strip.resize(width * m_rows);
+
+    uint8_t *dst = m_strip.data();
+    for (uint32_t code : codes) {
+        const Glyph *g = glyph(code);
+        if (!g)
+            continue;
+        size_t size = (size_t)g->advance * m_rows;
+        memcpy(dst, &m_atlas[g->offset], size);
+        dst += size;
+    }
+    return width;
+}
+
+/**
+ * Cell height in dots
+ */
+Napi::Value Font::height(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), m_height);
+}
+
+/**
+ * Distance from the top of the cell to the baseline, in dots
+ */
+Napi::Value Font::ascent(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), m_ascent);
+}
+
+/**
+ * Bytes per column of rendered text, i.e. the bit image height in rows
+ */
+Napi::Value Font::rows(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), m_rows);
+}
+
+Napi::Value Font::glyphs(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), m_glyphs.size());
+}
+
+/**
+ * measure(text): width of the rendered text in dots
+ */
+Napi::Value Font::measure(const Napi::CallbackInfo& info) {
+    if (!text_codes(info[0], m_codes)) {
+        EXCEPTION("Argument 1 must be a string or a Buffer");
+        return info.Env().Undefined();
+    }
+
+    size_t width = 0;
+    for (uint32_t code : m_codes) {
+        const Glyph *g = glyph(code);
+        width += g ? g->advance : 0;
+    }
+    return Napi::Number::New(info.Env(), width);
+}
+
+/**
+ * render(text): returns the text as a Buffer in display layout (rows()
+ * bytes per column), ready for Encoder.bitImage() or dmaTransfer()
+ */
+Napi::Value Font::render(const Napi::CallbackInfo& info) {
+    if (!text_codes(info[0], m_codes)) {
+        EXCEPTION("Argument 1 must be a string or a Buffer");
+        return info.Env().Undefined();
+    }
+
+    int width = render_strip(m_codes);
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_strip.data(), (size_t)width * m_rows);
+}
+
+/**
+ * draw(framebuffer, text, x, y): draws the text cell with its top left
+ * corner at x, y (any dot position, fastest when y is a multiple of 8).
+ * Returns the width drawn.
+ */
+Napi::Value Font::draw(const Napi::CallbackInfo& info) {
+    FrameBuffer *fb = FrameBuffer::FromValue(info[0]);
+    if (!fb) {
+        EXCEPTION("Argument 1 must be a FrameBuffer");
+        return info.Env().Undefined();
+    }
+    if (!text_codes(info[1], m_codes)) {
+        EXCEPTION("Argument 2 must be a string or a Buffer");
+        return info.Env().Undefined();
+    }
+    int x = info[2].IsNumber() ? info[2].As<Napi::Number>().Int32Value() : 0;
+    int y = info[3].IsNumber() ? info[3].As<Napi::Number>().Int32Value() : 0;
+
+    int width = render_strip(m_codes);
+    if (width)
+        fb->blit_columns(m_strip.data(), m_rows, x, y, width, m_height);
+    return Napi::Number::New(info.Env(), width);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <napi.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "noritake.h"
+
+// Glyph in the atlas: 'advance' columns of Font::m_rows bytes each
+struct Glyph {
+    uint32_t offset;
+    uint16_t advance;
+};
+
+/**
+ * Bitmap font loaded once from BDF into an atlas in the display memory
+ * layout, so that rendering a string is a memcpy per glyph.
+ */
+class Font : public Napi::ObjectWrap<Font> {
+    public:
+        Font(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value height(const Napi::CallbackInfo& info);
+        Napi::Value ascent(const Napi::CallbackInfo& info);
+        Napi::Value rows(const Napi::CallbackInfo& info);
+        Napi::Value glyphs(const Napi::CallbackInfo& info);
+        Napi::Value measure(const Napi::CallbackInfo& info);
+        Napi::Value render(const Napi::CallbackInfo& info);
+        Napi::Value draw(const Napi::CallbackInfo& info);
+
+        // Native API, also used by the other native objects
+        static Font *FromValue(Napi::Value value);
+        static bool text_codes(const Napi::Value& value, std::vector<uint32_t>& codes);
+        const Glyph *glyph(uint32_t code) const;
+        const uint8_t *glyph_columns(const Glyph *glyph) const { return &m_atlas[glyph->offset]; }
+        int render_strip(const std::vector<uint32_t>& codes);
+        const uint8_t *strip() const { return m_strip.data(); }
+        int strip_rows() const { return m_rows; }
+        int cell_height() const { return m_height; }
+
+    private:
+        static Napi::FunctionReference constructor;
+        bool load_bdf(const std::string& bdf, std::string& error);
+
+        int m_ascent;
+        int m_height;
+        int m_rows;
+        std::vector<uint8_t> m_atlas;
+        std::vector<int32_t> m_latin;   // Glyph index for codes < 256, or -1
+        std::unordered_map<uint32_t, uint32_t> m_others;
+        std::vector<Glyph> m_glyphs;
+        int32_t m_default;
+
+        std::vector<uint32_t> m_codes;
+        std::vector<uint8_t> m_strip;
+};
@@ -0,0 +1,293 @@
+#include "frame_diff.h"
+#include "framebuffer.h"
+#include "spi_driver.h"
+
+#include <string.h>
+#include <limits.h>
+
+Napi::FunctionReference FrameDiff::constructor;
+
+#define WRITE_HEADER_BYTES (NTK_CURSOR_BYTES + NTK_BIT_IMAGE_BYTES)
+
+Napi::Object FrameDiff::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "FrameDiff",
+        {
+            InstanceMethod("costModel", &FrameDiff::costModel),
+            InstanceMethod("plan", &FrameDiff::plan),
+            InstanceMethod("flush", &FrameDiff::flush),
+            InstanceMethod("fillAreas", &FrameDiff::fillAreas),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("FrameDiff", func);
+
+    return exports;
+}
+
+/**
+ * new FrameDiff(width, height): frame size in dots, defaults to 256x64
+ */
+FrameDiff::FrameDiff(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<FrameDiff>(info),
+    m_width(info[0].IsNumber() ? info[0].As<Napi::Number>().Int32Value() : 256),
+    m_rows((info[1].IsNumber() ? info[1].As<Napi::Number>().Int32Value() : 64) / NTK_ROW_DOTS),
+    m_speed(1000000),
+    m_byte_overhead(500),
+    m_rdy_overhead(1500),
+    m_transfer_overhead(5000),
+    m_fill(true),
+    m_strategy("none"),
+    m_bytes(0) {
+
+    if (m_width <= 0 || m_rows <= 0) {
+        EXCEPTION("Wrong frame size");
+        m_width = m_rows = 0;
+    }
+}
+
+/**
+ * Gets a frame argument, either a Buffer in display layout or a FrameBuffer
+ * of the same size (without copying it). Returns NULL on size mismatch.
+ */
+const uint8_t *FrameDiff::frame(const Napi::CallbackInfo& info, size_t index) {
+    FrameBuffer *fb = FrameBuffer::FromValue(info[index]);
+
+    if (fb) {
+        if (fb->columns() != m_width || fb->rows() != m_rows)
+            return NULL;
+        return fb->data();
+    }
+    if (info[index].IsBuffer()) {
+        Napi::Buffer<uint8_t> buf = info[index].As<Napi::Buffer<uint8_t>>();
+        if (buf.Length() == (size_t)m_width * m_rows)
+            return buf.Data();
+    }
+    return NULL;
+}
+
+/**
+ * Estimated time in ns to send one cursor set + bit image write: the header
+ * is RDY checked, the payload goes out in DMA mode, and each of them is a
+ * separate transfer.
+ */
+double FrameDiff::write_cost(uint16_t width, uint16_t rows, uint32_t speed) const {
+    double bit_time = 8e9 / speed;
+
+    return WRITE_HEADER_BYTES * (bit_time + m_byte_overhead + m_rdy_overhead) +
+           (double)width * rows * (bit_time + m_byte_overhead) +
+           2 * m_transfer_overhead;
+}
+
+/**
+ * Finds the changed column spans between two frames, then picks the
+ * grouping of consecutive spans that minimizes the estimated transmit time
+ * (merging two spans resends the unchanged columns between them, but saves
+ * a header and a transfer). Falls back to a full frame write when that's
+ * cheaper. Returns the estimated time in ns.
+ */
+double FrameDiff::diff(const uint8_t *prev, const uint8_t *next, uint32_t speed) {
+    struct Span {
+        int x;
+        int width;
+        int lo;
+        int hi;
+    };
+    std::vector<Span> spans;
+
+    m_writes.clear();
+    m_bytes = 0;
+
+    for (int c = 0; c < m_width; c++) {
+        const uint8_t *p = prev + c * m_rows;
+        const uint8_t *n = next + c * m_rows;
+        if (!memcmp(p, n, m_rows))
+            continue;
+
+        int lo = 0;
+        int hi = m_rows - 1;
+        while (p[lo] == n[lo])
+            lo++;
+        while (p[hi] == n[hi])
+            hi--;
+
+        if (!spans.empty() && spans.back().x + spans.back().width == c) {
+            Span& s = spans.back();
+            s.width++;
+            s.lo = lo < s.lo ? lo : s.lo;
+            s.hi = hi > s.hi ? hi : s.hi;
+        } else {
+            Span s = { c, 1, lo, hi };
+            spans.push_back(s);
+        }
+    }
+
+    if (spans.empty()) {
+        m_strategy = "none";
+        return 0;
+    }
+
+    // best[k]: cheapest way to send the first k spans, from[k]: first span
+    // of the last write in that solution
+    size_t n = spans.size();
+    std::vector<double> best(n + 1, 0);
+    std::vector<size_t> from(n + 1, 0);
+    for (size_t k = 1; k <= n; k++) {
+        int lo = INT_MAX;
+        int hi = -1;
+        best[k] = -1;
+        for (size_t i = k; i-- > 0; ) {
+            lo = spans[i].lo < lo ? spans[i].lo : lo;
+            hi = spans[i].hi > hi ? spans[i].hi : hi;
+            int width = spans[k - 1].x + spans[k - 1].width - spans[i].x;
+            double cost = best[i] + write_cost(width, hi - lo + 1, speed);
+            if (best[k] < 0 || cost < best[k]) {
+                best[k] = cost;
+                from[k] = i;
+            }
+        }
+    }
+
+    double full = write_cost(m_width, m_rows, speed);
+    if (full <= best[n]) {
+        DiffWrite w = { 0, 0, (uint16_t)m_width, (uint16_t)m_rows };
+        m_writes.push_back(w);
+        m_strategy = "full";
+        m_bytes = WRITE_HEADER_BYTES + (size_t)m_width * m_rows;
+        return full;
+    }
+
+    for (size_t k = n; k > 0; k = from[k]) {
+        size_t i = from[k];
+        int lo = INT_MAX;
+        int hi = -1;
+        for (size_t j = i; j < k; j++) {
+            lo = spans[j].lo < lo ? spans[j].lo : lo;
+            hi = spans[j].hi > hi ? spans[j].hi : hi;
+        }
+        DiffWrite w = { (uint16_t)spans[i].x, (uint16_t)lo,
+                        (uint16_t)(spans[k - 1].x + spans[k - 1].width - spans[i].x),
+                        (uint16_t)(hi - lo + 1) };
+        m_writes.insert(m_writes.begin(), w);
+        m_bytes += WRITE_HEADER_BYTES + (size_t)w.width * w.rows;
+    }
+    m_strategy = (m_writes.size() == 1 && n > 1) ? "merged" : "spans";
+    return best[n];
+}
+
+/**
+ * Describes the result of the last diff
+ */
+Napi::Object FrameDiff::report(const Napi::CallbackInfo& info, double estimate) {
+    Napi::Env env = info.Env();
+    Napi::Object result = Napi::Object::New(env);
+    Napi::Array writes = Napi::Array::New(env, m_writes.size());
+
+    for (size_t i = 0; i < m_writes.size(); i++) {
+        Napi::Object w = Napi::Object::New(env);
+        w.Set("x", Napi::Number::New(env, m_writes[i].x));
+        w.Set("y", Napi::Number::New(env, m_writes[i].row * NTK_ROW_DOTS));
+        w.Set("width", Napi::Number::New(env, m_writes[i].width));
+        w.Set("height", Napi::Number::New(env, m_writes[i].rows * NTK_ROW_DOTS));
+        writes.Set(i, w);
+    }
+    result.Set("strategy", Napi::String::New(env, m_strategy));
+    result.Set("writes", writes);
+    result.Set("bytes", Napi::Number::New(env, m_bytes));
+    result.Set("estimatedUs", Napi::Number::New(env, estimate / 1000));
+    return result;
+}
+
+/**
+ * costModel({ speed, byteOverhead, rdyOverhead, transferOverhead }): sets
+ * the model parameters that are given (overheads in ns, speed in Hz, only
+ * used by plan() since flush() uses the device speed), and returns them all.
+ */
+Napi::Value FrameDiff::costModel(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    if (info[0].IsObject()) {
+        Napi::Object in = info[0].As<Napi::Object>();
+        if (in.Get("speed").IsNumber() && in.Get("speed").As<Napi::Number>().Uint32Value())
+            m_speed = in.Get("speed").As<Napi::Number>().Uint32Value();
+        if (in.Get("byteOverhead").IsNumber())
+            m_byte_overhead = in.Get("byteOverhead").As<Napi::Number>().Uint32Value();
+        if (in.Get("rdyOverhead").IsNumber())
+            m_rdy_overhead = in.Get("rdyOverhead").As<Napi::Number>().Uint32Value();
+        if (in.Get("transferOverhead").IsNumber())
+            m_transfer_overhead = in.Get("transferOverhead").As<Napi::Number>().Uint32Value();
+    }
+
+    Napi::Object model = Napi::Object::New(env);
+    model.Set("speed", Napi::Number::New(env, m_speed));
+    model.Set("byteOverhead", Napi::Number::New(env, m_byte_overhead));
+    model.Set("rdyOverhead", Napi::Number::New(env, m_rdy_overhead));
+    model.Set("transferOverhead", Napi::Number::New(env, m_transfer_overhead));
+    return model;
+}
+
+/**
+ * plan(prev, next): what flush() would send, without sending it
+ */
+Napi::Value FrameDiff::plan(const Napi::CallbackInfo& info) {
+    const uint8_t *prev = frame(info, 0);
+    const uint8_t *next = frame(info, 1);
+    if (!prev || !next) {
+        EXCEPTION("Frames must be Buffers or FrameBuffers of the diff size");
+        return info.Env().Undefined();
+    }
+
+    return report(info, diff(prev, next, m_speed));
+}
+
+/**
+ * flush(spi, prev, next): sends the changes from prev to next, and reports
+ * the estimated and actual transmit times so that the model can be tuned,
+ * and the bytes actually sent (less than estimated when areas were filled)
+ */
+Napi::Value FrameDiff::flush(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    const uint8_t *prev = frame(info, 1);
+    const uint8_t *next = frame(info, 2);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.Env().Undefined();
+    }
+    if (!prev || !next) {
+        EXCEPTION("Frames must be Buffers or FrameBuffers of the diff size");
+        return info.Env().Undefined();
+    }
+
+    double estimate = diff(prev, next, spi->speed());
+
+    m_commands.reset();
+    for (const DiffWrite& w : m_writes) {
+        m_commands.image_area(next, m_rows, w.x, w.row, w.width, w.rows, m_fill);
+    }
+
+    uint64_t start = now_ns();
+    spi->send_commands(info, m_commands);
+    uint64_t elapsed = now_ns() - start;
+
+    Napi::Object result = report(info, estimate);
+    result.Set("sentBytes", Napi::Number::New(info.Env(), m_commands.length()));
+    result.Set("actualUs", Napi::Number::New(info.Env(), elapsed / 1000.0));
+    return result;
+}
+
+/**
+ * Draws blank or fully lit areas of the updates with the display filled
+ * box command when that is shorter than their bit image bytes. On by
+ * default.
+ */
+Napi::Value FrameDiff::fillAreas(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsBoolean()) {
+        m_fill = info[0].As<Napi::Boolean>().Value();
+        return info.This();
+    } else {
+        return Napi::Boolean::New(info.Env(), m_fill);
+    }
+}
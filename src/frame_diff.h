@@ -0,0 +1,53 @@
+#pragma once
+
+#include <napi.h>
+#include <vector>
+
+#include "noritake.h"
+
+// Changed area, horizontally in dots and vertically in rows of 8 dots
+struct DiffWrite {
+    uint16_t x;
+    uint16_t row;
+    uint16_t width;
+    uint16_t rows;
+};
+
+/**
+ * Compares two frames in the display memory layout and picks the cheapest
+ * way to go from one to the other (several small bit image writes, merged
+ * writes or a full frame write) according to a transmit time cost model.
+ */
+class FrameDiff : public Napi::ObjectWrap<FrameDiff> {
+    public:
+        FrameDiff(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value costModel(const Napi::CallbackInfo& info);
+        Napi::Value plan(const Napi::CallbackInfo& info);
+        Napi::Value flush(const Napi::CallbackInfo& info);
+        Napi::Value fillAreas(const Napi::CallbackInfo& info);
+
+    private:
+        static Napi::FunctionReference constructor;
+        const uint8_t *frame(const Napi::CallbackInfo& info, size_t index);
+        double write_cost(uint16_t width, uint16_t rows, uint32_t speed) const;
+        double diff(const uint8_t *prev, const uint8_t *next, uint32_t speed);
+        Napi::Object report(const Napi::CallbackInfo& info, double estimate);
+
+        int m_width;
+        int m_rows;
+
+        // Cost model, in ns
+        uint32_t m_speed;             // SPI clock used by plan()
+        uint32_t m_byte_overhead;     // Per byte strobe and call overhead
+        uint32_t m_rdy_overhead;      // Extra per RDY checked byte
+        uint32_t m_transfer_overhead; // Per transfer setup
+        bool m_fill;                  // Filled boxes for uniform areas
+
+        // Result of the last diff
+        const char *m_strategy;
+        std::vector<DiffWrite> m_writes;
+        size_t m_bytes;
+        CommandBuffer m_commands;
+};
@@ -0,0 +1,372 @@
+#include "framebuffer.h"
+#include "spi_driver.h"
+
+#include <string.h>
+
+Napi::FunctionReference FrameBuffer::constructor;
+
+// Cursor set + real time bit image header, what an extra dirty rectangle
+// costs on top of its payload
+#define RECT_HEADER_BYTES (NTK_CURSOR_BYTES + NTK_BIT_IMAGE_BYTES)
+
+#define INT_ARG(N, DEFAULT) (info[N].IsNumber() ? info[N].As<Napi::Number>().Int32Value() : (DEFAULT))
+#define BOOL_ARG(N, DEFAULT) (info[N].IsBoolean() ? info[N].As<Napi::Boolean>().Value() : (DEFAULT))
+
+Napi::Object FrameBuffer::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "FrameBuffer",
+        {
+            InstanceMethod("width", &FrameBuffer::width),
+            InstanceMethod("height", &FrameBuffer::height),
+            InstanceMethod("setPixel", &FrameBuffer::setPixel),
+            InstanceMethod("getPixel", &FrameBuffer::getPixel),
+            InstanceMethod("fillRect", &FrameBuffer::fillRect),
+            InstanceMethod("clear", &FrameBuffer::clear),
+            InstanceMethod("blit", &FrameBuffer::blit),
+            InstanceMethod("buffer", &FrameBuffer::buffer),
+            InstanceMethod("invalidate", &FrameBuffer::invalidate),
+            InstanceMethod("dirty", &FrameBuffer::dirty),
+            InstanceMethod("flush", &FrameBuffer::flush),
+            InstanceMethod("fillAreas", &FrameBuffer::fillAreas),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("FrameBuffer", func);
+
+    return exports;
+}
+
+/**
+ * new FrameBuffer(width, height): defaults to the 256x64 GU-3900 screen.
+ * The height must be a multiple of 8.
+ */
+FrameBuffer::FrameBuffer(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<FrameBuffer>(info),
+    m_width(INT_ARG(0, 256)),
+    m_height(INT_ARG(1, 64)),
+    m_fill(true) {
+
+    if (m_width <= 0 || m_height <= 0 || m_height % NTK_ROW_DOTS) {
+        EXCEPTION("Height must be a positive multiple of 8");
+        m_width = m_height = 0;
+    }
+    m_rows = m_height / NTK_ROW_DOTS;
+    m_data.resize((size_t)m_width * m_rows);
+}
+
+/**
+ * Gets the native framebuffer behind a JS value, or NULL
+ */
+FrameBuffer *FrameBuffer::FromValue(Napi::Value value) {
+    if (!value.IsObject() || !value.As<Napi::Object>().InstanceOf(constructor.Value()))
+        return NULL;
+    return FrameBuffer::Unwrap(value.As<Napi::Object>());
+}
+
+/**
+ * Clips a rectangle to the framebuffer, returns false if nothing is left
+ */
+bool FrameBuffer::clip(int& x, int& y, int& w, int& h) const {
+    if (x < 0) {
+        w += x;
+        x = 0;
+    }
+    if (y < 0) {
+        h += y;
+        y = 0;
+    }
+    if (x + w > m_width)
+        w = m_width - x;
+    if (y + h > m_height)
+        h = m_height - y;
+    return w > 0 && h > 0;
+}
+
+void FrameBuffer::set_pixel(int x, int y, bool on) {
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return;
+
+    uint8_t *byte = &m_data[x * m_rows + y / NTK_ROW_DOTS];
+    uint8_t bit = 0x80 >> (y % NTK_ROW_DOTS);
+    if (on) {
+        *byte |= bit;
+    } else {
+        *byte &= ~bit;
+    }
+    mark_dirty(x, y, 1, 1);
+}
+
+void FrameBuffer::fill_rect(int x, int y, int w, int h, bool on) {
+    if (!clip(x, y, w, h))
+        return;
+
+    for (int cx = x; cx < x + w; cx++) {
+        uint8_t *col = &m_data[cx * m_rows];
+        for (int py = y; py < y + h; ) {
+            int bit = py % NTK_ROW_DOTS;
+            int n = (8 - bit) < (y + h - py) ? (8 - bit) : (y + h - py);
+            uint8_t mask = (0xFF >> bit) & ~(0xFF >> (bit + n));
+            if (on) {
+                col[py / NTK_ROW_DOTS] |= mask;
+            } else {
+                col[py / NTK_ROW_DOTS] &= ~mask;
+            }
+            py += n;
+        }
+    }
+    mark_dirty(x, y, w, h);
+}
+
+/**
+ * Copies a w x h dots image in display layout (src_rows bytes per column)
+ * at x, y. Byte aligned destinations are plain column copies, others are
+ * shifted into place.
+ */
+void FrameBuffer::blit_columns(const uint8_t *src, int src_rows, int x, int y, int w, int h) {
+    int row0 = (y >= 0) ? y / NTK_ROW_DOTS : -((-y + NTK_ROW_DOTS - 1) / NTK_ROW_DOTS);
+    int shift = y - row0 * NTK_ROW_DOTS;
+    int src_used = (h + NTK_ROW_DOTS - 1) / NTK_ROW_DOTS;
+
+    for (int c = 0; c < w; c++) {
+        int cx = x + c;
+        if (cx < 0 || cx >= m_width)
+            continue;
+
+        const uint8_t *s = src + c * src_rows;
+        uint8_t *col = &m_data[cx * m_rows];
+
+        if (shift == 0 && row0 >= 0 && row0 + src_used <= m_rows) {
+            int full = h / NTK_ROW_DOTS;
+            memcpy(col + row0, s, full);
+            if (full < src_used) {
+                uint8_t m = (uint8_t)(0xFF << (NTK_ROW_DOTS - h % NTK_ROW_DOTS));
+                col[row0 + full] = (col[row0 + full] & ~m) | (s[full] & m);
+            }
+            continue;
+        }
+
+        for (int r = 0; r < src_used; r++) {
+            // Only the top bits of the last source byte may be valid
+            int valid = h - r * NTK_ROW_DOTS;
+            uint8_t m = valid >= 8 ? 0xFF : (uint8_t)(0xFF << (8 - valid));
+            uint8_t v = s[r] & m;
+            int d = row0 + r;
+
+            if (d >= 0 && d < m_rows)
+                col[d] = (col[d] & ~(m >> shift)) | (v >> shift);
+            if (shift && d + 1 >= 0 && d + 1 < m_rows) {
+                uint8_t m2 = (uint8_t)(m << (8 - shift));
+                col[d + 1] = (col[d + 1] & ~m2) | (uint8_t)(v << (8 - shift));
+            }
+        }
+    }
+    mark_dirty(x, y, w, h);
+}
+
+static inline uint32_t rect_area(const DirtyRect& r) {
+    return (uint32_t)r.width * r.rows;
+}
+
+static inline DirtyRect rect_union(const DirtyRect& a, const DirtyRect& b) {
+    DirtyRect u;
+    u.x = a.x < b.x ? a.x : b.x;
+    u.row = a.row < b.row ? a.row : b.row;
+    u.width = (a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width) - u.x;
+    u.rows = (a.row + a.rows > b.row + b.rows ? a.row + a.rows : b.row + b.rows) - u.row;
+    return u;
+}
+
+/**
+ * Records an area to resend on the next flush. Rectangles are merged when
+ * a single write of their union costs no more bytes than two separate
+ * writes (overlaps would be sent twice otherwise), and the list is capped
+ * by merging the cheapest pair.
+ */
+void FrameBuffer::mark_dirty(int x, int y, int w, int h) {
+    if (!clip(x, y, w, h))
+        return;
+
+    DirtyRect r;
+    r.x = x;
+    r.row = y / NTK_ROW_DOTS;
+    r.width = w;
+    r.rows = (y + h + NTK_ROW_DOTS - 1) / NTK_ROW_DOTS - r.row;
+
+    for (;;) {
+        bool merged = false;
+        for (size_t i = 0; i < m_dirty.size(); i++) {
+            DirtyRect u = rect_union(r, m_dirty[i]);
+            if (rect_area(u) <= rect_area(r) + rect_area(m_dirty[i]) + RECT_HEADER_BYTES) {
+                r = u;
+                m_dirty.erase(m_dirty.begin() + i);
+                merged = true;
+                break;
+            }
+        }
+        if (merged)
+            continue;
+        if (m_dirty.size() < MAX_DIRTY_RECTS)
+            break;
+
+        // Too many rectangles, merge with the one that wastes the least
+        size_t best = 0;
+        uint32_t best_cost = UINT32_MAX;
+        for (size_t i = 0; i < m_dirty.size(); i++) {
+            uint32_t cost = rect_area(rect_union(r, m_dirty[i])) - rect_area(m_dirty[i]);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = i;
+            }
+        }
+        r = rect_union(r, m_dirty[best]);
+        m_dirty.erase(m_dirty.begin() + best);
+    }
+    m_dirty.push_back(r);
+}
+
+/**
+ * Appends real time bit image writes for every dirty area to commands.
+ * The areas stay dirty until they are known to be sent.
+ */
+void FrameBuffer::encode_dirty(CommandBuffer& commands) {
+    for (const DirtyRect& r : m_dirty) {
+        commands.image_area(m_data.data(), m_rows, r.x, r.row, r.width, r.rows, m_fill);
+    }
+}
+
+Napi::Value FrameBuffer::width(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), m_width);
+}
+
+Napi::Value FrameBuffer::height(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), m_height);
+}
+
+/**
+ * setPixel(x, y, on): on defaults to true
+ */
+Napi::Value FrameBuffer::setPixel(const Napi::CallbackInfo& info) {
+    set_pixel(INT_ARG(0, -1), INT_ARG(1, -1), BOOL_ARG(2, true));
+    return info.This();
+}
+
+Napi::Value FrameBuffer::getPixel(const Napi::CallbackInfo& info) {
+    int x = INT_ARG(0, -1);
+    int y = INT_ARG(1, -1);
+
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return Napi::Boolean::New(info.Env(), false);
+    return Napi::Boolean::New(info.Env(),
+        (m_data[x * m_rows + y / NTK_ROW_DOTS] & (0x80 >> (y % NTK_ROW_DOTS))) != 0);
+}
+
+/**
+ * fillRect(x, y, width, height, on): on defaults to true
+ */
+Napi::Value FrameBuffer::fillRect(const Napi::CallbackInfo& info) {
+    fill_rect(INT_ARG(0, 0), INT_ARG(1, 0), INT_ARG(2, 0), INT_ARG(3, 0), BOOL_ARG(4, true));
+    return info.This();
+}
+
+/**
+ * clear(on): fills the whole framebuffer, on defaults to false
+ */
+Napi::Value FrameBuffer::clear(const Napi::CallbackInfo& info) {
+    fill_rect(0, 0, m_width, m_height, BOOL_ARG(0, false));
+    return info.This();
+}
+
+/**
+ * blit(buffer, x, y, width, height): copies an image in the display layout
+ * (columns of ceil(height / 8) bytes, MSB at the top)
+ */
+Napi::Value FrameBuffer::blit(const Napi::CallbackInfo& info) {
+    if (!info[0].IsBuffer()) {
+        EXCEPTION("Argument 1 must be a Buffer");
+        return info.This();
+    }
+
+    Napi::Buffer<uint8_t> src = info[0].As<Napi::Buffer<uint8_t>>();
+    int w = INT_ARG(3, 0);
+    int h = INT_ARG(4, 0);
+    int src_rows = (h + NTK_ROW_DOTS - 1) / NTK_ROW_DOTS;
+    if (w < 0 || h < 0 || src.Length() < (size_t)w * src_rows) {
+        EXCEPTION("Buffer is too small for the image size");
+        return info.This();
+    }
+
+    blit_columns(src.Data(), src_rows, INT_ARG(1, 0), INT_ARG(2, 0), w, h);
+    return info.This();
+}
+
+/**
+ * Returns a copy of the framebuffer contents, in display layout
+ */
+Napi::Value FrameBuffer::buffer(const Napi::CallbackInfo& info) {
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_data.data(), m_data.size());
+}
+
+/**
+ * Marks everything dirty, for instance after the display was cleared
+ * behind our back
+ */
+Napi::Value FrameBuffer::invalidate(const Napi::CallbackInfo& info) {
+    mark_dirty(0, 0, m_width, m_height);
+    return info.This();
+}
+
+/**
+ * Returns the list of areas that the next flush will send, in dots
+ */
+Napi::Value FrameBuffer::dirty(const Napi::CallbackInfo& info) {
+    Napi::Array rects = Napi::Array::New(info.Env(), m_dirty.size());
+
+    for (size_t i = 0; i < m_dirty.size(); i++) {
+        Napi::Object rect = Napi::Object::New(info.Env());
+        rect.Set("x", Napi::Number::New(info.Env(), m_dirty[i].x));
+        rect.Set("y", Napi::Number::New(info.Env(), m_dirty[i].row * NTK_ROW_DOTS));
+        rect.Set("width", Napi::Number::New(info.Env(), m_dirty[i].width));
+        rect.Set("height", Napi::Number::New(info.Env(), m_dirty[i].rows * NTK_ROW_DOTS));
+        rects.Set(i, rect);
+    }
+    return rects;
+}
+
+/**
+ * flush(spi): sends the dirty areas only, bitmap payloads in DMA mode. If
+ * the transfer fails they stay dirty, for the next flush to send again.
+ */
+Napi::Value FrameBuffer::flush(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.This();
+    }
+
+    m_commands.reset();
+    encode_dirty(m_commands);
+    const char *error = spi->transmit_commands(m_commands);
+    if (error) {
+        Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+        return info.This();
+    }
+    m_dirty.clear();
+    return info.This();
+}
+
+/**
+ * Draws blank or fully lit areas of the updates with the display filled
+ * box command when that is shorter than their bit image bytes. On by
+ * default.
+ */
+Napi::Value FrameBuffer::fillAreas(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsBoolean()) {
+        m_fill = info[0].As<Napi::Boolean>().Value();
+        return info.This();
+    } else {
+        return Napi::Boolean::New(info.Env(), m_fill);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <napi.h>
+#include <vector>
+
+#include "noritake.h"
+
+// Area to resend, horizontally in dots and vertically in rows of 8 dots
+// since bit images are always written as whole bytes
+struct DirtyRect {
+    uint16_t x;
+    uint16_t row;
+    uint16_t width;
+    uint16_t rows;
+};
+
+#define MAX_DIRTY_RECTS 8
+
+/**
+ * 1bpp framebuffer in the display memory layout (columns of 8 dot high
+ * bytes, MSB at the top) that tracks what changed since the last flush.
+ */
+class FrameBuffer : public Napi::ObjectWrap<FrameBuffer> {
+    public:
+        FrameBuffer(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+        static FrameBuffer *FromValue(Napi::Value value);
+
+        Napi::Value width(const Napi::CallbackInfo& info);
+        Napi::Value height(const Napi::CallbackInfo& info);
+        Napi::Value setPixel(const Napi::CallbackInfo& info);
+        Napi::Value getPixel(const Napi::CallbackInfo& info);
+        Napi::Value fillRect(const Napi::CallbackInfo& info);
+        Napi::Value clear(const Napi::CallbackInfo& info);
+        Napi::Value blit(const Napi::CallbackInfo& info);
+        Napi::Value buffer(const Napi::CallbackInfo& info);
+        Napi::Value invalidate(const Napi::CallbackInfo& info);
+        Napi::Value dirty(const Napi::CallbackInfo& info);
+        Napi::Value flush(const Napi::CallbackInfo& info);
+        Napi::Value fillAreas(const Napi::CallbackInfo& info);
+
+        // Native drawing API, also used by the other native objects
+        void set_pixel(int x, int y, bool on);
+        void fill_rect(int x, int y, int w, int h, bool on);
+        void blit_columns(const uint8_t *src, int src_rows, int x, int y, int w, int h);
+        void mark_dirty(int x, int y, int w, int h);
+        void encode_dirty(CommandBuffer& commands);
+        uint8_t *data() { return m_data.data(); }
+        int columns() const { return m_width; }
+        int rows() const { return m_rows; }
+
+    private:
+        static Napi::FunctionReference constructor;
+        bool clip(int& x, int& y, int& w, int& h) const;
+
+        int m_width;
+        int m_height;
+        int m_rows;
+        std::vector<uint8_t> m_data;
+        std::vector<DirtyRect> m_dirty;
+        bool m_fill;                  // Filled boxes for uniform areas
+        CommandBuffer m_commands;
+};
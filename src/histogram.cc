@@ -0,0 +1,99 @@
+#include "histogram.h"
+
+#define SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+
+/**
+ * Bucket of a value: below 2 * SUB_COUNT the value itself, then SUB_COUNT
+ * buckets per power of two
+ */
+uint32_t LatencyHistogram::bucket(uint64_t ns) {
+    if (ns >> HISTOGRAM_MAX_BITS)
+        return HISTOGRAM_BUCKETS - 1;
+    if (ns < 2 * SUB_COUNT)
+        return (uint32_t)ns;
+
+    int shift = 63 - __builtin_clzll(ns) - HISTOGRAM_SUB_BITS;
+    return (uint32_t)(shift * SUB_COUNT + (ns >> shift));
+}
+
+/**
+ * Largest value that goes in a bucket
+ */
+uint64_t LatencyHistogram::bucket_top(uint32_t index) {
+    if (index == HISTOGRAM_BUCKETS - 1)
+        return UINT64_MAX;
+    if (index < 2 * SUB_COUNT)
+        return index;
+
+    int shift = index / SUB_COUNT - 1;
+    uint64_t top = index - shift * SUB_COUNT;
+    return ((top + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    m_counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(ns, std::memory_order_relaxed);
+    // Single writer, see the class comment
+    if (ns < m_min.load(std::memory_order_relaxed))
+        m_min.store(ns, std::memory_order_relaxed);
+    if (ns > m_max.load(std::memory_order_relaxed))
+        m_max.store(ns, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        m_counts[i].store(0, std::memory_order_relaxed);
+    }
+    m_sum.store(0, std::memory_order_relaxed);
+    m_min.store(UINT64_MAX, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t count = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        count += m_counts[i].load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+double LatencyHistogram::mean() const {
+    uint64_t count = this->count();
+
+    return count ? (double)m_sum.load(std::memory_order_relaxed) / count : 0;
+}
+
+uint64_t LatencyHistogram::percentile(double percent) const {
+    uint32_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total = 0;
+
+    // Work on a snapshot, so that records coming in meanwhile can't make
+    // the rank fall past the last bucket
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        counts[i] = m_counts[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (!total)
+        return 0;
+
+    if (percent < 0)
+        percent = 0;
+    if (percent > 100)
+        percent = 100;
+    uint64_t rank = (uint64_t)(percent / 100 * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            // The bucket top can be past anything actually recorded
+            uint64_t top = bucket_top(i);
+            uint64_t max = this->max();
+            return top < max ? top : max;
+        }
+    }
+    return this->max();
+}
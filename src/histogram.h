@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Log-linear buckets in the HDR histogram way: values below
+// 2^(HISTOGRAM_SUB_BITS + 1) get their own bucket, larger ones are rounded
+// down to HISTOGRAM_SUB_BITS + 1 significant bits (about 3% precision).
+// Values from 2^HISTOGRAM_MAX_BITS ns (68s) on go in the last bucket.
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_MAX_BITS 36
+#define HISTOGRAM_BUCKETS (((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS) << HISTOGRAM_SUB_BITS) + \
+                           (1 << HISTOGRAM_SUB_BITS))
+
+/**
+ * Fixed memory latency distribution, in ns. A single thread records (the
+ * bus lock holder), others can read at any time with relaxed atomics: a
+ * read during a record may miss it, nothing worse.
+ */
+class LatencyHistogram {
+    public:
+        LatencyHistogram() { reset(); }
+
+        void record(uint64_t ns);
+        void reset();
+
+        uint64_t count() const;
+        uint64_t min() const { return m_min.load(std::memory_order_relaxed); }
+        uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+        double mean() const;
+        // Smallest value that percent % of the recorded values don't
+        // exceed, at the bucket precision. 0 when empty.
+        uint64_t percentile(double percent) const;
+
+    private:
+        static uint32_t bucket(uint64_t ns);
+        static uint64_t bucket_top(uint32_t index);
+
+        std::atomic<uint32_t> m_counts[HISTOGRAM_BUCKETS];
+        std::atomic<uint64_t> m_sum;
+        std::atomic<uint64_t> m_min;
+        std::atomic<uint64_t> m_max;
+};
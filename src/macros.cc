@@ -0,0 +1,319 @@
+#include "macros.h"
+#include "spi_driver.h"
+
+#include <string.h>
+
+Napi::FunctionReference Macros::constructor;
+
+// Sequences remembered while learning, to bound the memory used
+#define MAX_CANDIDATES 256
+
+// The display runs the macro again until the next byte comes in: keep the
+// result on screen for the longest time, without idle time in between
+#define MACRO_TIME 0xFF
+#define MACRO_IDLE 0
+
+// Since it runs again and again, a macro may only draw at the position it
+// sets: besides text, these commands. Anything that takes long (clear,
+// scroll, initialize, wait...) or changes a setting (font, window, write
+// mixture, screen mode...) is left out.
+static const uint32_t drawing_commands[] = {
+    0x1F24,                 // US $: cursor
+    NTK_CMD_BIT_IMAGE,
+    0x1F286610,             // US ( f 10h: downloaded bit image
+    0x1F286410,             // US ( d 10h: dot
+};
+
+/**
+ * FNV-1a, to find the sequences seen before
+ */
+static uint64_t sequence_hash(const uint8_t *data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+Napi::Object Macros::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "Macros",
+        {
+            InstanceMethod("define", &Macros::define),
+            InstanceMethod("learn", &Macros::learn),
+            InstanceMethod("pick", &Macros::pick),
+            InstanceMethod("encode", &Macros::encode),
+            InstanceMethod("install", &Macros::install),
+            InstanceMethod("substitute", &Macros::substitute),
+            InstanceMethod("transfer", &Macros::transfer),
+            InstanceMethod("invalidate", &Macros::invalidate),
+            InstanceMethod("stats", &Macros::stats),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("Macros", func);
+
+    return exports;
+}
+
+Macros::Macros(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<Macros>(info),
+    m_installed(false),
+    m_calls(0),
+    m_saved(0) {
+
+}
+
+/**
+ * Tells whether a sequence can be a macro: whole commands that only draw
+ * (see drawing_commands), and shorter with a call. It has to start with a
+ * cursor set, since each repeat would otherwise draw where the previous
+ * one left the cursor.
+ */
+bool Macros::storable(const uint8_t *data, size_t length) {
+    CommandParser parser;
+
+    if (length <= NTK_MACRO_CALL_BYTES || length > NTK_MACRO_MAX_BYTES)
+        return false;
+    if (data[0] != NTK_US || data[1] != '$')
+        return false;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t cls = parser.feed(data[i]);
+        if (parser.lost() || cls == NTK_BYTE_SLOW)
+            return false;
+        if (cls == NTK_BYTE_END) {
+            bool drawing = false;
+            for (uint32_t command : drawing_commands) {
+                drawing = drawing || parser.command() == command;
+            }
+            if (!drawing)
+                return false;
+        }
+    }
+    return parser.idle();
+}
+
+void Macros::set_macro(const uint8_t *data, size_t length) {
+    m_macro.assign(data, data + length);
+    m_installed = false;
+}
+
+/**
+ * define(commands): the sequence to keep in the display, whole drawing
+ * commands starting with a cursor set (6 to 512 bytes). It has to be
+ * installed again.
+ */
+Napi::Value Macros::define(const Napi::CallbackInfo& info) {
+    if (!info[0].IsBuffer()) {
+        EXCEPTION("Argument 1 must be a Buffer");
+        return info.This();
+    }
+    Napi::Buffer<uint8_t> data = info[0].As<Napi::Buffer<uint8_t>>();
+    if (!storable(data.Data(), data.Length())) {
+        EXCEPTION("Macro must be 6 to 512 bytes of whole drawing commands starting with a cursor set");
+        return info.This();
+    }
+
+    this->set_macro(data.Data(), data.Length());
+    return info.This();
+}
+
+/**
+ * learn(stream): counts the sequences of a stream of whole commands. Each
+ * one starts at a cursor set, so the same drawing at the same place is
+ * found again whatever comes around it. What comes before the first cursor
+ * set can't be a macro.
+ */
+Napi::Value Macros::learn(const Napi::CallbackInfo& info) {
+    if (!info[0].IsBuffer()) {
+        EXCEPTION("Argument 1 must be a Buffer");
+        return info.This();
+    }
+    Napi::Buffer<uint8_t> buf = info[0].As<Napi::Buffer<uint8_t>>();
+    const uint8_t *data = buf.Data();
+    size_t length = buf.Length();
+    CommandParser parser;
+    size_t start = 0;
+
+    for (size_t i = 0; i <= length; i++) {
+        bool boundary = parser.idle();
+        if (i == length || (boundary && i > start && data[i] == NTK_US &&
+                            i + 1 < length && data[i + 1] == '$')) {
+            if (!boundary || parser.lost())
+                break;
+            uint64_t hash = sequence_hash(data + start, i - start);
+            auto found = m_candidates.find(hash);
+            if (found != m_candidates.end()) {
+                found->second.count++;
+            } else if (m_candidates.size() < MAX_CANDIDATES && storable(data + start, i - start)) {
+                Candidate& c = m_candidates[hash];
+                c.count = 1;
+                c.bytes.assign(data + start, data + i);
+            }
+            start = i;
+        }
+        if (i < length)
+            parser.feed(data[i]);
+    }
+    return info.This();
+}
+
+/**
+ * Makes the learned sequence that saves the most bytes, definition
+ * included, the macro. Returns it, or undefined when none would save
+ * anything.
+ */
+Napi::Value Macros::pick(const Napi::CallbackInfo& info) {
+    const Candidate *best = NULL;
+    int64_t best_saved = 0;
+
+    for (const auto& entry : m_candidates) {
+        const Candidate& c = entry.second;
+        int64_t saved = (int64_t)c.count * (c.bytes.size() - NTK_MACRO_CALL_BYTES) -
+                        (NTK_DEFINE_MACRO_BYTES + c.bytes.size());
+        if (saved > best_saved) {
+            best = &c;
+            best_saved = saved;
+        }
+    }
+    if (!best)
+        return info.Env().Undefined();
+
+    this->set_macro(best->bytes.data(), best->bytes.size());
+    m_candidates.clear();
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_macro.data(), m_macro.size());
+}
+
+void Macros::encode_definition() {
+    m_commands.reset();
+    memcpy(m_commands.define_macro(m_macro.size()), m_macro.data(), m_macro.size());
+    m_saved -= m_commands.length();
+}
+
+/**
+ * encode(): returns the macro definition command as a Buffer, and
+ * considers the macro installed
+ */
+Napi::Value Macros::encode(const Napi::CallbackInfo& info) {
+    if (m_macro.empty()) {
+        EXCEPTION("No macro defined");
+        return info.Env().Undefined();
+    }
+
+    this->encode_definition();
+    m_installed = true;
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_commands.data(), m_commands.length());
+}
+
+/**
+ * install(spi): stores the macro in the display, to be done once after
+ * open, and again after the display was reset
+ */
+Napi::Value Macros::install(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.This();
+    }
+    if (m_macro.empty()) {
+        EXCEPTION("No macro defined");
+        return info.This();
+    }
+
+    this->encode_definition();
+    const char *error = spi->transmit_commands(m_commands);
+    if (error) {
+        Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+        return info.This();
+    }
+    m_installed = true;
+    return info.This();
+}
+
+/**
+ * Copies a stream of whole commands into m_commands, with calls in place
+ * of the macro. Only matches at command boundaries.
+ */
+void Macros::replace_calls(const uint8_t *data, size_t length) {
+    CommandParser parser;
+    size_t size = m_macro.size();
+    size_t copied = 0;
+
+    m_commands.reset();
+    for (size_t i = 0; i < length && m_installed; ) {
+        if (parser.lost())
+            break;
+        if (parser.idle() && length - i >= size && data[i] == m_macro[0] &&
+            !memcmp(data + i, m_macro.data(), size)) {
+            m_commands.raw(data + copied, i - copied);
+            m_commands.macro(0, MACRO_TIME, MACRO_IDLE);
+            m_calls++;
+            m_saved += size - NTK_MACRO_CALL_BYTES;
+            i += size;
+            copied = i;
+            continue;
+        }
+        parser.feed(data[i++]);
+    }
+    m_commands.raw(data + copied, length - copied);
+}
+
+/**
+ * substitute(stream): returns the stream with macro calls in place of the
+ * macro sequence, once the macro is installed
+ */
+Napi::Value Macros::substitute(const Napi::CallbackInfo& info) {
+    if (!info[0].IsBuffer()) {
+        EXCEPTION("Argument 1 must be a Buffer");
+        return info.Env().Undefined();
+    }
+    Napi::Buffer<uint8_t> data = info[0].As<Napi::Buffer<uint8_t>>();
+
+    this->replace_calls(data.Data(), data.Length());
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_commands.data(), m_commands.length());
+}
+
+/**
+ * transfer(spi, stream): sends the stream with macro calls substituted
+ */
+Napi::Value Macros::transfer(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.This();
+    }
+    if (!info[1].IsBuffer()) {
+        EXCEPTION("Argument 2 must be a Buffer");
+        return info.This();
+    }
+    Napi::Buffer<uint8_t> data = info[1].As<Napi::Buffer<uint8_t>>();
+
+    this->replace_calls(data.Data(), data.Length());
+    spi->send(info, m_commands.data(), NULL, m_commands.length(), false);
+    return info.This();
+}
+
+/**
+ * Forgets that the display has the macro, to be called after it was reset.
+ * Streams are then left as is until install().
+ */
+Napi::Value Macros::invalidate(const Napi::CallbackInfo& info) {
+    m_installed = false;
+    return info.This();
+}
+
+/**
+ * Macro calls made, and bytes saved by them once the definitions sent are
+ * paid for
+ */
+Napi::Value Macros::stats(const Napi::CallbackInfo& info) {
+    Napi::Object stats = Napi::Object::New(info.Env());
+    stats.Set("calls", Napi::Number::New(info.Env(), m_calls));
+    stats.Set("bytesSaved", Napi::Number::New(info.Env(), (double)m_saved));
+    stats.Set("installed", Napi::Boolean::New(info.Env(), m_installed));
+    return stats;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <napi.h>
+#include <unordered_map>
+#include <vector>
+
+#include "noritake.h"
+
+/**
+ * Keeps a command sequence that comes back often (screen template,
+ * animation step...) as the display RAM macro, so that sending it again
+ * only takes a 5 byte macro call. The sequence is either given, or picked
+ * among the ones seen most while learning.
+ */
+class Macros : public Napi::ObjectWrap<Macros> {
+    public:
+        Macros(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value define(const Napi::CallbackInfo& info);
+        Napi::Value learn(const Napi::CallbackInfo& info);
+        Napi::Value pick(const Napi::CallbackInfo& info);
+        Napi::Value encode(const Napi::CallbackInfo& info);
+        Napi::Value install(const Napi::CallbackInfo& info);
+        Napi::Value substitute(const Napi::CallbackInfo& info);
+        Napi::Value transfer(const Napi::CallbackInfo& info);
+        Napi::Value invalidate(const Napi::CallbackInfo& info);
+        Napi::Value stats(const Napi::CallbackInfo& info);
+
+    private:
+        // Sequence seen while learning
+        struct Candidate {
+            uint32_t count;
+            std::vector<uint8_t> bytes;
+        };
+
+        static Napi::FunctionReference constructor;
+        static bool storable(const uint8_t *data, size_t length);
+        void set_macro(const uint8_t *data, size_t length);
+        void encode_definition();
+        void replace_calls(const uint8_t *data, size_t length);
+
+        std::vector<uint8_t> m_macro;
+        bool m_installed;             // The display has it
+        std::unordered_map<uint64_t, Candidate> m_candidates;
+
+        uint32_t m_calls;
+        int64_t m_saved;              // Definitions sent count negative
+        CommandBuffer m_commands;
+};
@@ -0,0 +1,872 @@
+#include "noritake.h"
+
+#include <string.h>
+
+CommandBuffer::CommandBuffer() {
+    // Enough for a full 256x64 bit image and its header, so that the
+    // usual frames never reallocate
+    m_data.reserve(2048 + 64);
+}
+
+/**
+ * Empties the buffer, but keeps the memory for the next batch of commands
+ */
+void CommandBuffer::reset() {
+    m_data.clear();
+    m_dma.clear();
+}
+
+/**
+ * 16-bit parameters are sent low byte first (xL xH)
+ */
+void CommandBuffer::put16(uint16_t value) {
+    put(value & 0xFF);
+    put(value >> 8);
+}
+
+/**
+ * Extended commands: US ( group function ...
+ */
+void CommandBuffer::command(uint8_t group, uint8_t function) {
+    put(NTK_US);
+    put('(');
+    put(group);
+    put(function);
+}
+
+void CommandBuffer::raw(const uint8_t *data, size_t length) {
+    m_data.insert(m_data.end(), data, data + length);
+}
+
+/**
+ * Marks bytes already in the buffer as the payload of a command, merged
+ * with the previous segment when it continues it
+ */
+void CommandBuffer::dma_segment(size_t start, size_t end, uint32_t command) {
+    if (start >= end)
+        return;
+    if (!m_dma.empty() && m_dma.back().end == start && m_dma.back().command == command) {
+        m_dma.back().end = end;
+        return;
+    }
+    Segment seg = { start, end, command };
+    m_dma.push_back(seg);
+}
+
+/**
+ * Drops the bytes from length on, and the segments over them
+ */
+void CommandBuffer::truncate(size_t length) {
+    if (length >= m_data.size())
+        return;
+    m_data.resize(length);
+    while (!m_dma.empty() && m_dma.back().start >= length)
+        m_dma.pop_back();
+    if (!m_dma.empty() && m_dma.back().end > length)
+        m_dma.back().end = length;
+}
+
+/**
+ * Removes whole commands from the middle of the buffer
+ */
+void CommandBuffer::erase(size_t start, size_t end) {
+    size_t count = end - start;
+    size_t kept = 0;
+
+    m_data.erase(m_data.begin() + start, m_data.begin() + end);
+    for (Segment seg : m_dma) {
+        if (seg.start >= start && seg.end <= end)
+            continue;
+        if (seg.start >= end) {
+            seg.start -= count;
+            seg.end -= count;
+        }
+        m_dma[kept++] = seg;
+    }
+    m_dma.resize(kept);
+}
+
+/**
+ * ESC @: back to power on settings, also clears the display
+ */
+void CommandBuffer::initialize() {
+    put(NTK_ESC);
+    put('@');
+}
+
+void CommandBuffer::clear() {
+    put(NTK_CLR);
+}
+
+void CommandBuffer::home() {
+    put(NTK_HOME);
+}
+
+/**
+ * US $ xL xH yL yH: x in dots, y in rows of 8 dots
+ */
+void CommandBuffer::cursor(uint16_t x, uint16_t y) {
+    put(NTK_US);
+    put('$');
+    put16(x);
+    put16(y);
+}
+
+/**
+ * US ( g 01h n: 1 = 6x8, 2 = 8x16, 3 = 12x24, 4 = 16x32
+ */
+void CommandBuffer::font(uint8_t size) {
+    command('g', 0x01);
+    put(size);
+}
+
+/**
+ * US ( g 40h x y: character magnification
+ */
+void CommandBuffer::magnify(uint8_t x, uint8_t y) {
+    command('g', 0x40);
+    put(x);
+    put(y);
+}
+
+/**
+ * US r n: reverse display of the characters that follow
+ */
+void CommandBuffer::reverse(bool on) {
+    put(NTK_US);
+    put('r');
+    put(on ? 1 : 0);
+}
+
+/**
+ * US X n: brightness, 1 (12.5%) to 8 (100%)
+ */
+void CommandBuffer::brightness(uint8_t level) {
+    put(NTK_US);
+    put('X');
+    put(level);
+}
+
+/**
+ * US ( w 01h a: current window select, 0 is the base window
+ */
+void CommandBuffer::window(uint8_t window) {
+    command('w', 0x01);
+    put(window);
+}
+
+/**
+ * US ( w 02h a b [xP yP xS yS]: user window definition, position and size
+ * in dots horizontally and rows vertically. A zero size cancels the window,
+ * the position and size are then left out.
+ */
+void CommandBuffer::define_window(uint8_t window, uint16_t x, uint16_t y,
+                                  uint16_t width, uint16_t height) {
+    command('w', 0x02);
+    put(window);
+    if (!width || !height) {
+        put(0);
+        return;
+    }
+    put(1);
+    put16(x);
+    put16(y);
+    put16(width);
+    put16(height);
+}
+
+/**
+ * US ( a 10h wL wH cL cH s: display area scroll, shifts the display start
+ * by w bytes of display memory, c times, at speed s
+ */
+void CommandBuffer::scroll(uint16_t shift, uint16_t count, uint8_t speed) {
+    command('a', 0x10);
+    put16(shift);
+    put16(count);
+    put(speed);
+}
+
+/**
+ * US ( a 01h t: wait t x ~0.5s
+ */
+void CommandBuffer::wait(uint8_t time) {
+    command('a', 0x01);
+    put(time);
+}
+
+/**
+ * US ( f 11h xL xH yL yH g d...: real time bit image display at the
+ * cursor position, width in dots and height in rows, column by column.
+ * Returns a pointer to the payload to be filled in by the caller, which
+ * stays valid until the next command is added.
+ */
+uint8_t *CommandBuffer::bit_image(uint16_t width, uint16_t rows) {
+    size_t payload = (size_t)width * rows;
+
+    command('f', 0x11);
+    put16(width);
+    put16(rows);
+    put(0x01);
+
+    Segment seg = { m_data.size(), m_data.size() + payload, NTK_CMD_BIT_IMAGE };
+    if (payload)
+        m_dma.push_back(seg);
+    m_data.resize(seg.end);
+    return m_data.data() + seg.start;
+}
+
+void CommandBuffer::bit_image(uint16_t width, uint16_t rows, const uint8_t *data) {
+    uint8_t *payload = bit_image(width, rows);
+    memcpy(payload, data, (size_t)width * rows);
+}
+
+/**
+ * US ( d 11h m p x1 y1 x2 y2: line, box outline or filled box between two
+ * corners (included), in dots. p = 1 lights the dots, 0 clears them.
+ */
+void CommandBuffer::box(uint8_t mode, bool on, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2) {
+    command('d', 0x11);
+    put(mode);
+    put(on ? 1 : 0);
+    put16(x1);
+    put16(y1);
+    put16(x2);
+    put16(y2);
+}
+
+/**
+ * Column value if all the bytes of [row, row + rows) are blank or lit,
+ * -1 otherwise
+ */
+static int uniform_column(const uint8_t *column, int row, int rows) {
+    uint8_t value = column[row];
+
+    if (value != 0x00 && value != 0xFF)
+        return -1;
+    for (int r = row + 1; r < row + rows; r++) {
+        if (column[r] != value)
+            return -1;
+    }
+    return value;
+}
+
+/**
+ * Writes an area of a frame (display layout, frame_rows bytes per column)
+ * at the same place on screen: cursor set and bit image. With fill, runs
+ * of blank or fully lit columns are drawn with a filled box instead when
+ * that takes fewer bytes, including the header of the bit image that then
+ * has to resume after the run.
+ */
+void CommandBuffer::image_area(const uint8_t *frame, int frame_rows, int x, int row,
+                               int width, int rows, bool fill) {
+    int literal = x;
+    int end = x + width;
+
+    for (int c = x; fill && c < end; ) {
+        int value = uniform_column(frame + c * frame_rows, row, rows);
+        if (value < 0) {
+            c++;
+            continue;
+        }
+
+        int run = c + 1;
+        while (run < end && uniform_column(frame + run * frame_rows, row, rows) == value)
+            run++;
+        size_t cost = NTK_BOX_BYTES + (run < end ? NTK_CURSOR_BYTES + NTK_BIT_IMAGE_BYTES : 0);
+        if ((size_t)(run - c) * rows > cost) {
+            if (c > literal)
+                this->image_area(frame, frame_rows, literal, row, c - literal, rows, false);
+            box(NTK_BOX_FILL, value != 0, c, row * NTK_ROW_DOTS,
+                run - 1, (row + rows) * NTK_ROW_DOTS - 1);
+            literal = run;
+        }
+        c = run;
+    }
+
+    if (literal < end) {
+        cursor(literal, row);
+        uint8_t *payload = bit_image(end - literal, rows);
+        for (int c = literal; c < end; c++) {
+            memcpy(payload + (c - literal) * rows, frame + c * frame_rows + row, rows);
+        }
+    }
+}
+
+/**
+ * ESC % n: shows the downloaded characters instead of the built-in ones
+ * for the codes that have one
+ */
+void CommandBuffer::download_characters(bool on) {
+    put(NTK_ESC);
+    put('%');
+    put(on ? 1 : 0);
+}
+
+/**
+ * ESC & a c1 c2 x d...: downloads the pattern of one character, x columns
+ * of a bytes (a = 1 for the 6x8 font, 2 for 8x16...). Returns a pointer to
+ * the pattern to be filled in by the caller, valid until the next command.
+ */
+uint8_t *CommandBuffer::define_character(uint8_t rows, uint8_t code, uint8_t width) {
+    put(NTK_ESC);
+    put('&');
+    put(rows);
+    put(code);
+    put(code);
+    put(width);
+
+    size_t start = m_data.size();
+    m_data.resize(start + (size_t)width * rows);
+    return m_data.data() + start;
+}
+
+/**
+ * US ( f 01h aL aH aE sL sH sE d...: stores s bytes of bit image data at
+ * address a of the display bit image RAM. Returns a pointer to the payload
+ * to be filled in by the caller, valid until the next command.
+ */
+uint8_t *CommandBuffer::define_image(uint32_t address, uint32_t length) {
+    command('f', 0x01);
+    put16(address & 0xFFFF);
+    put(address >> 16);
+    put16(length & 0xFFFF);
+    put(length >> 16);
+
+    Segment seg = { m_data.size(), m_data.size() + length, NTK_CMD_RAM_IMAGE };
+    if (length)
+        m_dma.push_back(seg);
+    m_data.resize(seg.end);
+    return m_data.data() + seg.start;
+}
+
+/**
+ * STX D ad F aL aH aE sL sH sE d...: writes s bytes straight into the
+ * display memory from address a (column by column, one byte per 8 dot
+ * rows), whatever the cursor and window. B series modules take the
+ * payload without handshake. Returns a pointer to the payload to be filled
+ * in by the caller, valid until the next command.
+ */
+uint8_t *CommandBuffer::dad_write(uint32_t address, uint32_t length) {
+    put(NTK_STX);
+    put('D');
+    put(NTK_DAD_ALL);
+    put('F');
+    put16(address & 0xFFFF);
+    put(address >> 16);
+    put16(length & 0xFFFF);
+    put(length >> 16);
+
+    Segment seg = { m_data.size(), m_data.size() + length, NTK_CMD_DAD_WRITE };
+    if (length)
+        m_dma.push_back(seg);
+    m_data.resize(seg.end);
+    return m_data.data() + seg.start;
+}
+
+/**
+ * US ( f 10h m aL aH aE ySL ySH xPL xPH yPL yPH g: downloaded bit image
+ * display at the cursor position, from the bit image RAM (m = 1) where the
+ * image is stored column by column, rows bytes per column
+ */
+void CommandBuffer::stored_image(uint32_t address, uint16_t rows, uint16_t width, uint16_t height) {
+    command('f', 0x10);
+    put(0x01);
+    put16(address & 0xFFFF);
+    put(address >> 16);
+    put16(rows);
+    put16(width);
+    put16(height);
+    put(0x01);
+}
+
+/**
+ * US : pL pH d...: defines the RAM macro, p bytes of commands. Returns a
+ * pointer to them to be filled in by the caller, valid until the next
+ * command.
+ */
+uint8_t *CommandBuffer::define_macro(uint16_t length) {
+    put(NTK_US);
+    put(':');
+    put16(length);
+
+    size_t start = m_data.size();
+    m_data.resize(start + length);
+    return m_data.data() + start;
+}
+
+/**
+ * US ^ n t1 t2: runs macro n (0 is the RAM macro), then repeats it every
+ * t1 + t2 x ~14ms until the next byte comes in
+ */
+void CommandBuffer::macro(uint8_t number, uint8_t time, uint8_t idle) {
+    put(NTK_US);
+    put('^');
+    put(number);
+    put(time);
+    put(idle);
+}
+
+#define PARSER_IDLE       0
+#define PARSER_SELECTOR   1
+#define PARSER_ADDRESS    2
+#define PARSER_PARAMS     3
+#define PARSER_PAYLOAD    4
+#define PARSER_CHAR_WIDTH 5
+
+#define SPEC_SLOW         0x01  // Takes long to execute
+#define SPEC_IMAGE        0x02  // xL xH yL yH first, x * y payload bytes
+#define SPEC_MACRO        0x04  // pL pH first, p payload bytes
+#define SPEC_BLOCK        0x08  // aL aH aE sL sH sE first, s payload bytes
+#define SPEC_WINDOW       0x10  // 8 more parameters if the second one is set
+#define SPEC_DOWNLOAD     0x20  // a c1 c2 first, then x and a * x bytes per
+                                // character
+
+struct CommandSpec {
+    uint32_t id;                // Selector bytes, see NTK_CMD_BIT_IMAGE
+    uint8_t length;             // Number of selector bytes
+    uint8_t params;
+    uint8_t flags;
+};
+
+// Commands of the GU-3900 and GU-7000 series. The display address byte of
+// the STX D commands is not part of the selector.
+static const CommandSpec command_specs[] = {
+    { 0x1B40, 2, 0, SPEC_SLOW },            // ESC @: initialize
+    { 0x1B25, 2, 1, 0 },                    // ESC % n: download characters on/off
+    { 0x1B26, 2, 3, SPEC_DOWNLOAD },        // ESC & a c1 c2: define characters
+    { 0x1B3F, 2, 2, 0 },                    // ESC ? a c: delete character
+    { 0x1B52, 2, 1, 0 },                    // ESC R n: international font
+    { 0x1B74, 2, 1, 0 },                    // ESC t n: character code type
+    { 0x1F01, 2, 0, 0 },                    // US MD1: overwrite mode
+    { 0x1F02, 2, 0, 0 },                    // US MD2: vertical scroll mode
+    { 0x1F03, 2, 0, 0 },                    // US MD3: horizontal scroll mode
+    { 0x1F24, 2, 4, 0 },                    // US $: cursor
+    { 0x1F43, 2, 1, 0 },                    // US C n: cursor display
+    { 0x1F58, 2, 1, 0 },                    // US X n: brightness
+    { 0x1F72, 2, 1, 0 },                    // US r n: reverse
+    { 0x1F73, 2, 1, 0 },                    // US s n: horizontal scroll speed
+    { 0x1F77, 2, 1, 0 },                    // US w n: write mixture
+    { 0x1F3A, 2, 2, SPEC_MACRO },           // US : pL pH: define macro
+    { 0x1F5E, 2, 3, SPEC_SLOW },            // US ^ n t1 t2: execute macro
+    { 0x1F286101, 4, 1, SPEC_SLOW },        // US ( a 01h t: wait
+    { 0x1F286110, 4, 5, SPEC_SLOW },        // US ( a 10h: scroll
+    { 0x1F286111, 4, 4, SPEC_SLOW },        // US ( a 11h: blink
+    { 0x1F286140, 4, 1, SPEC_SLOW },        // US ( a 40h p: screen saver
+    { 0x1F286410, 4, 5, 0 },                // US ( d 10h: dot
+    { 0x1F286411, 4, 10, SPEC_SLOW },       // US ( d 11h: line, box
+    { NTK_CMD_RAM_IMAGE, 4, 6, SPEC_BLOCK },// US ( f 01h: RAM bit image definition
+    { 0x1F286610, 4, 11, 0 },               // US ( f 10h: downloaded bit image
+    { NTK_CMD_BIT_IMAGE, 4, 5, SPEC_IMAGE },// US ( f 11h: real time bit image
+    { 0x1F286701, 4, 1, 0 },                // US ( g 01h n: font size
+    { 0x1F286703, 4, 1, 0 },                // US ( g 03h n: font width
+    { 0x1F286740, 4, 2, 0 },                // US ( g 40h x y: magnify
+    { 0x1F286741, 4, 1, 0 },                // US ( g 41h b: bold
+    { 0x1F287701, 4, 1, 0 },                // US ( w 01h a: window select
+    { 0x1F287702, 4, 2, SPEC_WINDOW },      // US ( w 02h a b: window definition
+    { 0x1F287710, 4, 1, SPEC_SLOW },        // US ( w 10h a: screen mode
+    { NTK_CMD_DAD_WRITE, 3, 6, SPEC_BLOCK },// STX D ad F: display memory write
+    { 0x024453, 3, 3, SPEC_SLOW },          // STX D ad S: display start address
+};
+
+void CommandParser::reset() {
+    m_state = PARSER_IDLE;
+    m_lost = false;
+    m_command = 0;
+    m_length = 0;
+    m_spec = NULL;
+    m_count = 0;
+    m_expected = 0;
+    m_payload = 0;
+    m_chars = 0;
+    m_char_rows = 0;
+}
+
+/**
+ * Tells what the display does with the next byte of the stream
+ */
+uint8_t CommandParser::feed(uint8_t byte) {
+    switch (m_state) {
+    case PARSER_IDLE:
+        if (m_lost)
+            return NTK_BYTE_SLOW;
+        m_command = byte;
+        if (byte >= 0x20) {
+            m_command = 0;
+            return NTK_BYTE_TEXT;
+        }
+        if (byte == NTK_ESC || byte == NTK_US || byte == NTK_STX) {
+            m_length = 1;
+            m_state = PARSER_SELECTOR;
+            return NTK_BYTE_PARAM;
+        }
+        // Cursor moves are quick, anything else may clear the screen
+        return (byte == NTK_BS || byte == NTK_HT || byte == NTK_LF ||
+                byte == NTK_HOME || byte == NTK_CR) ? NTK_BYTE_END : NTK_BYTE_SLOW;
+
+    case PARSER_SELECTOR:
+        m_command = (m_command << 8) | byte;
+        m_length++;
+        return this->match();
+
+    case PARSER_ADDRESS:
+        m_state = PARSER_SELECTOR;
+        return NTK_BYTE_PARAM;
+
+    case PARSER_PARAMS:
+        m_params[m_count++] = byte;
+        if (m_count < m_expected)
+            return NTK_BYTE_PARAM;
+        return this->params_done();
+
+    case PARSER_PAYLOAD:
+        if (--m_payload)
+            return NTK_BYTE_DATA;
+        if (m_chars) {
+            m_state = PARSER_CHAR_WIDTH;
+            return NTK_BYTE_DATA;
+        }
+        return this->finish();
+
+    case PARSER_CHAR_WIDTH:
+        m_chars--;
+        m_payload = (uint32_t)byte * m_char_rows;
+        if (m_payload) {
+            m_state = PARSER_PAYLOAD;
+            return NTK_BYTE_PARAM;
+        }
+        return m_chars ? NTK_BYTE_PARAM : this->finish();
+    }
+    return NTK_BYTE_SLOW;
+}
+
+/**
+ * Looks up the selector bytes received so far
+ */
+uint8_t CommandParser::match() {
+    bool prefix = false;
+
+    for (const CommandSpec& spec : command_specs) {
+        if (spec.length == m_length && spec.id == m_command) {
+            m_spec = &spec;
+            m_count = 0;
+            m_expected = spec.params;
+            if (!m_expected)
+                return this->finish();
+            m_state = PARSER_PARAMS;
+            return NTK_BYTE_PARAM;
+        }
+        if (spec.length > m_length && (spec.id >> 8 * (spec.length - m_length)) == m_command)
+            prefix = true;
+    }
+
+    if (!prefix) {
+        m_state = PARSER_IDLE;
+        m_lost = true;
+        return NTK_BYTE_SLOW;
+    }
+    if (m_command == ((NTK_STX << 8) | 'D'))
+        m_state = PARSER_ADDRESS;
+    return NTK_BYTE_PARAM;
+}
+
+/**
+ * All the fixed parameters are in, sizes the rest of the command
+ */
+uint8_t CommandParser::params_done() {
+    uint8_t flags = m_spec->flags;
+
+    if ((flags & SPEC_WINDOW) && m_expected == 2 && m_params[1]) {
+        m_expected += 8;
+        return NTK_BYTE_PARAM;
+    }
+
+    if (flags & SPEC_IMAGE) {
+        m_payload = (uint32_t)(m_params[0] | (m_params[1] << 8)) * (m_params[2] | (m_params[3] << 8));
+    } else if (flags & SPEC_MACRO) {
+        m_payload = m_params[0] | (m_params[1] << 8);
+    } else if (flags & SPEC_BLOCK) {
+        m_payload = m_params[3] | (m_params[4] << 8) | (m_params[5] << 16);
+    } else if (flags & SPEC_DOWNLOAD) {
+        m_char_rows = m_params[0];
+        m_chars = m_params[2] >= m_params[1] ? m_params[2] - m_params[1] + 1 : 0;
+        if (m_chars) {
+            m_state = PARSER_CHAR_WIDTH;
+            return NTK_BYTE_PARAM;
+        }
+    }
+
+    if (m_payload) {
+        m_state = PARSER_PAYLOAD;
+        return NTK_BYTE_PARAM;
+    }
+    return this->finish();
+}
+
+uint8_t CommandParser::finish() {
+    m_state = PARSER_IDLE;
+    return (m_spec->flags & SPEC_SLOW) ? NTK_BYTE_SLOW : NTK_BYTE_END;
+}
+
+/**
+ * Feeds a stream, and gives the byte ranges in it that are image or
+ * pattern payload, with their command. Payloads are skipped in one go.
+ */
+void CommandParser::payloads(const uint8_t *data, size_t length,
+                             std::vector<CommandBuffer::Segment>& segments) {
+    segments.clear();
+
+    for (size_t i = 0; i < length; ) {
+        if (m_state != PARSER_PAYLOAD) {
+            this->feed(data[i++]);
+            continue;
+        }
+
+        // The last payload byte goes through feed() to end the command
+        size_t count = m_payload - 1 < length - i ? m_payload - 1 : length - i;
+        m_payload -= count;
+        if (i + count < length) {
+            this->feed(data[i + count]);
+            count++;
+        }
+        if (!segments.empty() && segments.back().end == i && segments.back().command == m_command) {
+            segments.back().end = i + count;
+        } else {
+            CommandBuffer::Segment seg = { i, i + count, m_command };
+            segments.push_back(seg);
+        }
+        i += count;
+    }
+}
+
+/**
+ * Tells whether the next byte starts a command
+ */
+bool CommandParser::idle() const {
+    return m_state == PARSER_IDLE;
+}
+
+#define SETTING_CURSOR 0
+#define SETTING_WINDOW 1
+#define SETTING_MIXTURE 8
+
+// Commands that only change a display setting, which is what their
+// parameters say. The cursor is per window.
+static const struct {
+    uint32_t id;
+    uint8_t params;
+} settings[NTK_SETTINGS] = {
+    { 0x1F24, 4 },                          // US $: cursor
+    { 0x1F287701, 1 },                      // US ( w 01h a: window select
+    { 0x1B25, 1 },                          // ESC % n: download characters
+    { 0x1B52, 1 },                          // ESC R n: international font
+    { 0x1B74, 1 },                          // ESC t n: character code type
+    { 0x1F43, 1 },                          // US C n: cursor display
+    { 0x1F58, 1 },                          // US X n: brightness
+    { 0x1F72, 1 },                          // US r n: reverse
+    { 0x1F77, 1 },                          // US w n: write mixture
+    { 0x1F286701, 1 },                      // US ( g 01h n: font size
+    { 0x1F286703, 1 },                      // US ( g 03h n: font width
+    { 0x1F286740, 2 },                      // US ( g 40h x y: magnify
+    { 0x1F286741, 1 },                      // US ( g 41h b: bold
+};
+
+CommandOptimizer::CommandOptimizer() {
+    this->reset();
+    this->clear_stats();
+}
+
+void CommandOptimizer::reset() {
+    m_parser.reset();
+    this->forget();
+}
+
+void CommandOptimizer::forget() {
+    for (int i = 0; i < NTK_SETTINGS; i++) {
+        m_state[i] = -1;
+    }
+}
+
+void CommandOptimizer::clear_stats() {
+    m_bytes_in = 0;
+    m_bytes_out = 0;
+    m_dropped = 0;
+    m_merged = 0;
+}
+
+/**
+ * Copies a command to the output, its payload (from offset payload, 0 if
+ * none) as a DMA segment
+ */
+void CommandOptimizer::emit(const Emitted& command, const uint8_t *data, size_t payload, CommandBuffer& out) {
+    size_t start = out.length();
+
+    out.raw(data, command.end - command.start);
+    if (payload)
+        out.dma_segment(start + payload, out.length(), command.command);
+
+    // The rules only look that far back
+    m_emitted.push_back(command);
+    if (m_emitted.size() > 3)
+        m_emitted.erase(m_emitted.begin());
+}
+
+void CommandOptimizer::run(const uint8_t *data, size_t length, CommandBuffer& out, bool rewrite) {
+    size_t start = 0;
+    size_t payload = 0;
+
+    out.reset();
+    m_emitted.clear();
+    m_parser.resync();
+    bool partial = !m_parser.idle();
+
+    for (size_t i = 0; i < length; i++) {
+        uint8_t cls = m_parser.feed(data[i]);
+        if (cls == NTK_BYTE_DATA && !payload)
+            payload = i - start;
+        if (cls == NTK_BYTE_PARAM || cls == NTK_BYTE_DATA)
+            continue;
+
+        if (partial || m_parser.lost()) {
+            // Can't tell what it does
+            out.raw(data + start, i + 1 - start);
+            m_emitted.clear();
+            this->forget();
+        } else {
+            this->command(data + start, i + 1 - start, payload, out, rewrite);
+        }
+        partial = false;
+        start = i + 1;
+        payload = 0;
+    }
+    if (start < length) {
+        // Ends in the next stream
+        out.raw(data + start, length - start);
+        m_emitted.clear();
+        this->forget();
+    }
+
+    if (rewrite) {
+        m_bytes_in += length;
+        m_bytes_out += out.length();
+    }
+}
+
+/**
+ * A complete command (or character) of the stream
+ */
+void CommandOptimizer::command(const uint8_t *data, size_t length, size_t payload,
+                               CommandBuffer& out, bool rewrite) {
+    uint32_t id = m_parser.command();
+
+    for (int i = 0; i < NTK_SETTINGS; i++) {
+        if (settings[i].id == id) {
+            this->setting(i, data, length, out, rewrite);
+            return;
+        }
+    }
+    if (id == NTK_CMD_BIT_IMAGE && rewrite && this->bit_image(data, length, out))
+        return;
+
+    Emitted emitted = { id, -1, out.length(), out.length() + length, 0, 0 };
+    if (id == NTK_CMD_BIT_IMAGE) {
+        const uint8_t *params = m_parser.params();
+        if (params[4] == 1) {
+            emitted.width = params[0] | (params[1] << 8);
+            emitted.rows = params[2] | (params[3] << 8);
+        }
+    }
+
+    // Initialize, macros and screen mode may change anything, the rest
+    // may move the cursor
+    if (id == 0x1B40 || id == 0x1F5E || id == 0x1F287710)
+        this->forget();
+    else
+        m_state[SETTING_CURSOR] = -1;
+    this->emit(emitted, data, payload, out);
+}
+
+void CommandOptimizer::setting(int index, const uint8_t *data, size_t length, CommandBuffer& out, bool rewrite) {
+    uint8_t count = settings[index].params;
+    const uint8_t *params = data + length - count;
+    int64_t value = 0;
+
+    for (int i = count - 1; i >= 0; i--) {
+        value = (value << 8) | params[i];
+    }
+
+    if (rewrite && m_state[index] == value) {
+        m_dropped++;
+        return;
+    }
+    if (index == SETTING_WINDOW)
+        m_state[SETTING_CURSOR] = -1;
+    m_state[index] = value;
+
+    if (rewrite && !m_emitted.empty() && m_emitted.back().setting == index) {
+        // The previous one was overridden before anything used it
+        memcpy(out.data() + m_emitted.back().end - count, params, count);
+        m_dropped++;
+        return;
+    }
+    Emitted emitted = { settings[index].id, index, out.length(), out.length() + length, 0, 0 };
+    this->emit(emitted, data, 0, out);
+}
+
+/**
+ * Cursor set, bit image, cursor set and the incoming bit image: when the
+ * two images are side by side with the same height they become one, and
+ * when the second one covers the first the first is dropped. Returns true
+ * when the incoming image was merged.
+ */
+bool CommandOptimizer::bit_image(const uint8_t *data, size_t length, CommandBuffer& out) {
+    const uint8_t *params = m_parser.params();
+    uint16_t width = params[0] | (params[1] << 8);
+    uint16_t rows = params[2] | (params[3] << 8);
+    size_t n = m_emitted.size();
+
+    if (params[4] != 1 || n < 3)
+        return false;
+    Emitted& first = m_emitted[n - 3];
+    Emitted& image = m_emitted[n - 2];
+    Emitted& next = m_emitted[n - 1];
+    if (first.setting != SETTING_CURSOR || image.command != NTK_CMD_BIT_IMAGE ||
+        !image.width || image.rows != rows || next.setting != SETTING_CURSOR)
+        return false;
+
+    const uint8_t *p1 = out.data() + first.start + 2;
+    const uint8_t *p2 = out.data() + next.start + 2;
+    uint16_t x1 = p1[0] | (p1[1] << 8);
+    uint16_t x2 = p2[0] | (p2[1] << 8);
+    if (p1[2] != p2[2] || p1[3] != p2[3])
+        return false;
+
+    if (x2 == x1 + image.width && image.width + width <= 0xFFFF) {
+        out.truncate(next.start);
+        size_t start = out.length();
+        out.raw(data + NTK_BIT_IMAGE_BYTES, length - NTK_BIT_IMAGE_BYTES);
+        out.dma_segment(start, out.length(), NTK_CMD_BIT_IMAGE);
+
+        image.width += width;
+        image.end = out.length();
+        out.data()[image.start + 4] = image.width & 0xFF;
+        out.data()[image.start + 5] = image.width >> 8;
+        m_emitted.pop_back();
+        m_state[SETTING_CURSOR] = -1;
+        m_merged++;
+        return true;
+    }
+
+    // Under OR, AND or XOR write mixture, both images end up on screen
+    if (x2 <= x1 && x2 + width >= x1 + image.width && m_state[SETTING_MIXTURE] == 0) {
+        size_t removed = next.start - first.start;
+        Emitted cursor = next;
+        cursor.start -= removed;
+        cursor.end -= removed;
+
+        out.erase(first.start, next.start);
+        m_emitted.clear();
+        m_emitted.push_back(cursor);
+        m_dropped += 2;
+    }
+    return false;
+}
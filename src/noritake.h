@@ -0,0 +1,214 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Noritake GU-3900 command set. Every command generated by the native code
+// goes through CommandBuffer, so that the protocol lives in a single place.
+
+#define NTK_STX  0x02
+#define NTK_BS   0x08    // Back space
+#define NTK_HT   0x09    // Horizontal tab
+#define NTK_LF   0x0A    // Line feed
+#define NTK_HOME 0x0B    // Home position
+#define NTK_CLR  0x0C    // Display clear
+#define NTK_CR   0x0D    // Carriage return
+#define NTK_ESC  0x1B
+#define NTK_US   0x1F
+
+// Display memory is made of columns of 8 dot high bytes, MSB at the top.
+// Vertical positions and sizes in commands are counted in such rows.
+#define NTK_ROW_DOTS 8
+
+// Size of the commands needed to write a bit image somewhere on screen
+#define NTK_CURSOR_BYTES 6
+#define NTK_BIT_IMAGE_BYTES 9
+
+// Command identifiers: the bytes that select the command, first one in the
+// highest byte
+#define NTK_CMD_BIT_IMAGE 0x1F286611  // US ( f 11h: real time bit image
+#define NTK_CMD_DAD_WRITE 0x024446    // STX D ad F: display memory write
+#define NTK_CMD_RAM_IMAGE 0x1F286601  // US ( f 01h: RAM bit image definition
+
+// Display address of the STX D commands that every display on the bus takes
+#define NTK_DAD_ALL 0xFF
+
+// Box drawing command (US ( d 11h), and its modes
+#define NTK_BOX_BYTES 14
+#define NTK_BOX_LINE 0
+#define NTK_BOX_OUTLINE 1
+#define NTK_BOX_FILL 2
+
+// Command headers for the images and characters stored in the display RAM
+#define NTK_DEFINE_IMAGE_BYTES 10
+#define NTK_STORED_IMAGE_BYTES 15
+#define NTK_DEFINE_CHAR_BYTES 6
+
+// User macro in the display RAM: definition header, call, and largest size
+#define NTK_DEFINE_MACRO_BYTES 4
+#define NTK_MACRO_CALL_BYTES 5
+#define NTK_MACRO_MAX_BYTES 512
+
+// What the display does with a byte, as told by CommandParser::feed()
+#define NTK_BYTE_TEXT    0  // Character to display
+#define NTK_BYTE_PARAM   1  // Command selector or parameter
+#define NTK_BYTE_DATA    2  // Image or character pattern payload
+#define NTK_BYTE_END     3  // Last byte of a command, which now executes
+#define NTK_BYTE_SLOW    4  // Same for commands that take long to execute,
+                            // or that the parser doesn't know
+#define NTK_BYTE_CLASSES 5
+
+struct CommandSpec;
+
+class CommandBuffer {
+    public:
+        // Byte range that can be sent without checking RDY (bitmap payload),
+        // if the display profile allows it for that command
+        struct Segment {
+            size_t start;
+            size_t end;
+            uint32_t command;
+        };
+
+        CommandBuffer();
+
+        void reset();
+        size_t length() const { return m_data.size(); }
+        uint8_t *data() { return m_data.data(); }
+        const std::vector<Segment>& dma_segments() const { return m_dma; }
+
+        void raw(const uint8_t *data, size_t length);
+        void dma_segment(size_t start, size_t end, uint32_t command);
+        void truncate(size_t length);
+        void erase(size_t start, size_t end);
+        void initialize();
+        void clear();
+        void home();
+        void cursor(uint16_t x, uint16_t y);
+        void font(uint8_t size);
+        void magnify(uint8_t x, uint8_t y);
+        void reverse(bool on);
+        void brightness(uint8_t level);
+        void window(uint8_t window);
+        void define_window(uint8_t window, uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+        void scroll(uint16_t shift, uint16_t count, uint8_t speed);
+        void wait(uint8_t time);
+        uint8_t *bit_image(uint16_t width, uint16_t rows);
+        void bit_image(uint16_t width, uint16_t rows, const uint8_t *data);
+        void box(uint8_t mode, bool on, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
+        void image_area(const uint8_t *frame, int frame_rows, int x, int row, int width, int rows, bool fill);
+        void download_characters(bool on);
+        uint8_t *define_character(uint8_t rows, uint8_t code, uint8_t width);
+        uint8_t *define_image(uint32_t address, uint32_t length);
+        uint8_t *dad_write(uint32_t address, uint32_t length);
+        void stored_image(uint32_t address, uint16_t rows, uint16_t width, uint16_t height);
+        uint8_t *define_macro(uint16_t length);
+        void macro(uint8_t number, uint8_t time, uint8_t idle);
+
+    private:
+        void put(uint8_t value) { m_data.push_back(value); }
+        void put16(uint16_t value);
+        void command(uint8_t group, uint8_t function);
+
+        std::vector<uint8_t> m_data;
+        std::vector<Segment> m_dma;
+};
+
+/**
+ * Follows a byte stream sent to the display, to tell where commands start
+ * and end and what each byte is. Keeps its state across calls, so commands
+ * can be split between transfers. Once it meets a command it doesn't know,
+ * it can't find the next one: every byte is then NTK_BYTE_SLOW until
+ * resync().
+ */
+class CommandParser {
+    public:
+        CommandParser() { reset(); }
+
+        void reset();
+        // Starts over at a command boundary if the parser got lost
+        void resync() { if (m_lost) reset(); }
+        uint8_t feed(uint8_t byte);
+        // Identifier of the command the last byte belongs to, 0 for text
+        uint32_t command() const { return m_command; }
+        // Fixed parameters of that command
+        const uint8_t *params() const { return m_params; }
+        bool idle() const;
+        bool lost() const { return m_lost; }
+        void payloads(const uint8_t *data, size_t length, std::vector<CommandBuffer::Segment>& segments);
+
+    private:
+        uint8_t match();
+        uint8_t params_done();
+        uint8_t finish();
+
+        uint8_t m_state;
+        bool m_lost;
+        uint32_t m_command;
+        uint8_t m_length;             // Selector bytes so far
+        const CommandSpec *m_spec;
+        uint8_t m_params[10];
+        uint8_t m_count;              // Parameters so far
+        uint8_t m_expected;           // Parameters of the command
+        uint32_t m_payload;           // Payload bytes left
+        uint16_t m_chars;             // Character patterns left (ESC &)
+        uint8_t m_char_rows;
+};
+
+/**
+ * Peephole pass over the command streams sent to the display. It sees
+ * everything that is sent, so that it knows the display state, and drops
+ * the commands that change nothing: cursor set where the cursor already is,
+ * font or window selected again, settings overridden before anything used
+ * them. A bit image right next to the previous one is merged into it, and a
+ * bit image overwritten by the next one is dropped under the normal write
+ * mixture. A command split between
+ * two streams is left as is, and makes it forget the display state.
+ */
+// Display settings followed by CommandOptimizer, cursor position included
+#define NTK_SETTINGS 13
+
+class CommandOptimizer {
+    public:
+        CommandOptimizer();
+
+        // Display state unknown, e.g. after a reset
+        void reset();
+        // Rewrites a stream into out, payloads get DMA segments. Without
+        // rewrite, the stream is copied as is and only followed.
+        void run(const uint8_t *data, size_t length, CommandBuffer& out, bool rewrite);
+        void clear_stats();
+
+        uint64_t bytes_in() const { return m_bytes_in; }
+        uint64_t bytes_out() const { return m_bytes_out; }
+        uint32_t dropped() const { return m_dropped; }
+        uint32_t merged() const { return m_merged; }
+
+    private:
+        // Command that made it to the output of the current run
+        struct Emitted {
+            uint32_t command;
+            int setting;              // Index in the settings, or -1
+            size_t start;
+            size_t end;
+            uint16_t width;           // Bit image size
+            uint16_t rows;
+        };
+
+        void forget();
+        void command(const uint8_t *data, size_t length, size_t payload,
+                     CommandBuffer& out, bool rewrite);
+        void setting(int index, const uint8_t *data, size_t length, CommandBuffer& out, bool rewrite);
+        bool bit_image(const uint8_t *data, size_t length, CommandBuffer& out);
+        void emit(const Emitted& command, const uint8_t *data, size_t payload, CommandBuffer& out);
+
+        CommandParser m_parser;
+        int64_t m_state[NTK_SETTINGS]; // Setting values, -1 when unknown
+        std::vector<Emitted> m_emitted;
+
+        uint64_t m_bytes_in;
+        uint64_t m_bytes_out;
+        uint32_t m_dropped;
+        uint32_t m_merged;
+};
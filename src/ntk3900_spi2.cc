@@ -2,6 +2,18 @@
 #include <napi.h>
 
 #include "spi_driver.h"
+#include "encoder.h"
+#include "framebuffer.h"
+#include "frame_diff.h"
+#include "packer.h"
+#include "font.h"
+#include "scroller.h"
+#include "asset_cache.h"
+#include "page_flipper.h"
+#include "compositor.h"
+#include "text_screen.h"
+#include "optimizer.h"
+#include "macros.h"
 
 // Entry point for the module
 
@@ -10,6 +22,18 @@ using namespace Napi;
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
 
   SPIDriver::Init(env, exports);
+  Encoder::Init(env, exports);
+  FrameBuffer::Init(env, exports);
+  FrameDiff::Init(env, exports);
+  ImagePacker::Init(env, exports);
+  Font::Init(env, exports);
+  Scroller::Init(env, exports);
+  AssetCache::Init(env, exports);
+  PageFlipper::Init(env, exports);
+  Compositor::Init(env, exports);
+  TextScreen::Init(env, exports);
+  Optimizer::Init(env, exports);
+  Macros::Init(env, exports);
 
   return exports;
 }
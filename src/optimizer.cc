@@ -0,0 +1,68 @@
+#include "optimizer.h"
+#include "spi_driver.h"
+
+Napi::FunctionReference Optimizer::constructor;
+
+Napi::Object Optimizer::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "Optimizer",
+        {
+            InstanceMethod("optimize", &Optimizer::optimize),
+            InstanceMethod("invalidate", &Optimizer::invalidate),
+            InstanceMethod("stats", &Optimizer::stats),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("Optimizer", func);
+
+    return exports;
+}
+
+Optimizer::Optimizer(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<Optimizer>(info) {
+
+}
+
+/**
+ * optimize(buffer): returns the stream without the commands that change
+ * nothing on the display, given what the previous streams did
+ */
+Napi::Value Optimizer::optimize(const Napi::CallbackInfo& info) {
+    if (!info[0].IsBuffer()) {
+        EXCEPTION("Argument 1 must be a Buffer");
+        return info.Env().Undefined();
+    }
+    Napi::Buffer<uint8_t> data = info[0].As<Napi::Buffer<uint8_t>>();
+
+    m_optimizer.run(data.Data(), data.Length(), m_commands, true);
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_commands.data(), m_commands.length());
+}
+
+/**
+ * Forgets the display state, to be called after it was reset
+ */
+Napi::Value Optimizer::invalidate(const Napi::CallbackInfo& info) {
+    m_optimizer.reset();
+    return info.This();
+}
+
+/**
+ * Bytes in and out, commands dropped and bit images merged
+ */
+Napi::Object Optimizer::stats(Napi::Env env, const CommandOptimizer& optimizer) {
+    Napi::Object stats = Napi::Object::New(env);
+
+    stats.Set("bytesIn", Napi::Number::New(env, optimizer.bytes_in()));
+    stats.Set("bytesOut", Napi::Number::New(env, optimizer.bytes_out()));
+    stats.Set("bytesSaved", Napi::Number::New(env, optimizer.bytes_in() - optimizer.bytes_out()));
+    stats.Set("dropped", Napi::Number::New(env, optimizer.dropped()));
+    stats.Set("merged", Napi::Number::New(env, optimizer.merged()));
+    return stats;
+}
+
+Napi::Value Optimizer::stats(const Napi::CallbackInfo& info) {
+    return Optimizer::stats(info.Env(), m_optimizer);
+}
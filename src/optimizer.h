@@ -0,0 +1,28 @@
+#pragma once
+
+#include <napi.h>
+
+#include "noritake.h"
+
+/**
+ * Standalone command stream optimizer, the same pass Spi.optimize(true)
+ * runs on every transfer: optimize(buffer) returns the rewritten stream,
+ * to prepare streams offline or to see what the pass does.
+ */
+class Optimizer : public Napi::ObjectWrap<Optimizer> {
+    public:
+        Optimizer(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value optimize(const Napi::CallbackInfo& info);
+        Napi::Value invalidate(const Napi::CallbackInfo& info);
+        Napi::Value stats(const Napi::CallbackInfo& info);
+
+        static Napi::Object stats(Napi::Env env, const CommandOptimizer& optimizer);
+
+    private:
+        static Napi::FunctionReference constructor;
+
+        CommandOptimizer m_optimizer;
+        CommandBuffer m_commands;
+};
@@ -0,0 +1,498 @@
+#include "packer.h"
+#include "framebuffer.h"
+#include "spi_driver.h"
+
+#include <string.h>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define HAVE_SSE2_KERNEL
+#endif
+
+// On 32 bit ARM, NEON is only available when building with -mfpu=neon, and
+// then still has to be checked at runtime (Pi Zero / Pi 1 don't have it)
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNEL
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#define MAX_DITHER_THREADS 16
+
+// Luma weights (BT.601), summing to 256
+#define LUMA_R 77
+#define LUMA_G 150
+#define LUMA_B 29
+
+Napi::FunctionReference ImagePacker::constructor;
+
+/* Scalar kernels, also used for the tails of the SIMD ones */
+
+static void rgba_to_gray_scalar(const uint8_t *src, uint8_t *dst, size_t count) {
+    for (size_t i = 0; i < count; i++, src += 4) {
+        dst[i] = (LUMA_R * src[0] + LUMA_G * src[1] + LUMA_B * src[2]) >> 8;
+    }
+}
+
+static void pack_band_scalar(const uint8_t *const *lines, int count, uint8_t *out,
+                             size_t stride, size_t width, uint8_t threshold) {
+    for (size_t x = 0; x < width; x++) {
+        uint8_t bits = 0;
+        for (int i = 0; i < count; i++) {
+            if (lines[i][x] >= threshold)
+                bits |= 0x80 >> i;
+        }
+        out[x * stride] = bits;
+    }
+}
+
+#ifdef HAVE_SSE2_KERNEL
+__attribute__((target("sse2")))
+static void rgba_to_gray_sse2(const uint8_t *src, uint8_t *dst, size_t count) {
+    const __m128i weights = _mm_setr_epi16(LUMA_R, LUMA_G, LUMA_B, 0, LUMA_R, LUMA_G, LUMA_B, 0);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16, src += 64) {
+        __m128i luma[4];
+        for (int j = 0; j < 4; j++) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(src + 16 * j));
+            // R*wR + G*wG and B*wB for each of the 4 pixels
+            __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights));
+            __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights));
+            __m128i rg = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i b = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+            luma[j] = _mm_srli_epi32(_mm_add_epi32(rg, b), 8);
+        }
+        __m128i lo = _mm_packs_epi32(luma[0], luma[1]);
+        __m128i hi = _mm_packs_epi32(luma[2], luma[3]);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    rgba_to_gray_scalar(src, dst + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void pack_band_sse2(const uint8_t *const *lines, int count, uint8_t *out,
+                           size_t stride, size_t width, uint8_t threshold) {
+    const __m128i t = _mm_set1_epi8((char)threshold);
+    const __m128i one = _mm_set1_epi8(1);
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i bits = _mm_setzero_si128();
+        for (int i = 0; i < 8; i++) {
+            // Shift left in each byte, next line goes in the low bit
+            bits = _mm_add_epi8(bits, bits);
+            if (i < count) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(lines[i] + x));
+                __m128i on = _mm_cmpeq_epi8(_mm_max_epu8(v, t), v);
+                bits = _mm_or_si128(bits, _mm_and_si128(on, one));
+            }
+        }
+        uint8_t column[16];
+        _mm_storeu_si128((__m128i *)column, bits);
+        for (int j = 0; j < 16; j++) {
+            out[(x + j) * stride] = column[j];
+        }
+    }
+
+    const uint8_t *tail[8];
+    for (int i = 0; i < count; i++) {
+        tail[i] = lines[i] + x;
+    }
+    pack_band_scalar(tail, count, out + x * stride, stride, width - x, threshold);
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+static void rgba_to_gray_neon(const uint8_t *src, uint8_t *dst, size_t count) {
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16, src += 64) {
+        uint8x16x4_t p = vld4q_u8(src);
+        uint16x8_t lo = vmull_u8(vget_low_u8(p.val[0]), vdup_n_u8(LUMA_R));
+        lo = vmlal_u8(lo, vget_low_u8(p.val[1]), vdup_n_u8(LUMA_G));
+        lo = vmlal_u8(lo, vget_low_u8(p.val[2]), vdup_n_u8(LUMA_B));
+        uint16x8_t hi = vmull_u8(vget_high_u8(p.val[0]), vdup_n_u8(LUMA_R));
+        hi = vmlal_u8(hi, vget_high_u8(p.val[1]), vdup_n_u8(LUMA_G));
+        hi = vmlal_u8(hi, vget_high_u8(p.val[2]), vdup_n_u8(LUMA_B));
+        vst1q_u8(dst + i, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+    }
+    rgba_to_gray_scalar(src, dst + i, count - i);
+}
+
+static void pack_band_neon(const uint8_t *const *lines, int count, uint8_t *out,
+                           size_t stride, size_t width, uint8_t threshold) {
+    const uint8x16_t t = vdupq_n_u8(threshold);
+    const uint8x16_t one = vdupq_n_u8(1);
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t bits = vdupq_n_u8(0);
+        for (int i = 0; i < 8; i++) {
+            bits = vshlq_n_u8(bits, 1);
+            if (i < count) {
+                uint8x16_t on = vcgeq_u8(vld1q_u8(lines[i] + x), t);
+                bits = vorrq_u8(bits, vandq_u8(on, one));
+            }
+        }
+        uint8_t column[16];
+        vst1q_u8(column, bits);
+        for (int j = 0; j < 16; j++) {
+            out[(x + j) * stride] = column[j];
+        }
+    }
+
+    const uint8_t *tail[8];
+    for (int i = 0; i < count; i++) {
+        tail[i] = lines[i] + x;
+    }
+    pack_band_scalar(tail, count, out + x * stride, stride, width - x, threshold);
+}
+#endif
+
+static const PackKernel kernels[] = {
+#ifdef HAVE_NEON_KERNEL
+    { "neon", rgba_to_gray_neon, pack_band_neon },
+#endif
+#ifdef HAVE_SSE2_KERNEL
+    { "sse2", rgba_to_gray_sse2, pack_band_sse2 },
+#endif
+    { "scalar", rgba_to_gray_scalar, pack_band_scalar },
+};
+
+static bool kernel_supported(const PackKernel *kernel) {
+#ifdef HAVE_SSE2_KERNEL
+    if (!strcmp(kernel->name, "sse2"))
+        return __builtin_cpu_supports("sse2");
+#endif
+#if defined(HAVE_NEON_KERNEL) && !defined(__aarch64__)
+    if (!strcmp(kernel->name, "neon"))
+        return getauxval(AT_HWCAP) & HWCAP_NEON;
+#endif
+    return true;
+}
+
+/**
+ * Gets the kernel set with the given name, or the best one this CPU
+ * supports when name is NULL. Returns NULL if it's not available.
+ */
+const PackKernel *pack_kernel(const char *name) {
+    for (const PackKernel& kernel : kernels) {
+        if (name && strcmp(kernel.name, name))
+            continue;
+        if (kernel_supported(&kernel))
+            return &kernel;
+    }
+    return NULL;
+}
+
+/**
+ * Gets a pointer to the bytes of a Buffer, TypedArray or ArrayBuffer without
+ * copying them
+ */
+static const uint8_t *source_data(Napi::Value value, size_t& length) {
+    if (value.IsTypedArray()) {
+        Napi::TypedArray array = value.As<Napi::TypedArray>();
+        length = array.ByteLength();
+        return (const uint8_t *)array.ArrayBuffer().Data() + array.ByteOffset();
+    }
+    if (value.IsArrayBuffer()) {
+        Napi::ArrayBuffer array = value.As<Napi::ArrayBuffer>();
+        length = array.ByteLength();
+        return (const uint8_t *)array.Data();
+    }
+    return NULL;
+}
+
+Napi::Object ImagePacker::Init(Napi::Env env, Napi::Object exports) {
+    napi_status status;
+    napi_value value;
+
+    Napi::Function func = DefineClass(
+        env,
+        "ImagePacker",
+        {
+            InstanceMethod("format", &ImagePacker::format),
+            InstanceMethod("threshold", &ImagePacker::threshold),
+            InstanceMethod("invert", &ImagePacker::invert),
+            InstanceMethod("kernel", &ImagePacker::kernel),
+            InstanceMethod("dither", &ImagePacker::dither),
+            InstanceMethod("threads", &ImagePacker::threads),
+            InstanceMethod("pack", &ImagePacker::pack),
+        }
+    );
+
+    NODE_SET_PROPERTY(exports, PIXEL_GRAY)
+    NODE_SET_PROPERTY(exports, PIXEL_RGBA)
+    NODE_SET_PROPERTY(exports, DITHER_NONE)
+    NODE_SET_PROPERTY(exports, DITHER_FLOYD_STEINBERG)
+    NODE_SET_PROPERTY(exports, DITHER_ATKINSON)
+    NODE_SET_PROPERTY(exports, DITHER_BAYER)
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("ImagePacker", func);
+
+    return exports;
+}
+
+/**
+ * new ImagePacker(width, height): source image size in pixels, defaults to
+ * the 256x64 GU-3900 screen. The packed height is rounded up to whole rows
+ * of 8 dots.
+ */
+ImagePacker::ImagePacker(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<ImagePacker>(info),
+    m_width(info[0].IsNumber() ? info[0].As<Napi::Number>().Int32Value() : 256),
+    m_height(info[1].IsNumber() ? info[1].As<Napi::Number>().Int32Value() : 64),
+    m_format(PIXEL_RGBA),
+    m_threshold(128),
+    m_invert(false),
+    m_kernel(pack_kernel()),
+    m_dither(DITHER_NONE),
+    m_threads(1) {
+
+    if (m_width <= 0 || m_height <= 0) {
+        EXCEPTION("Wrong image size");
+        m_width = m_height = 0;
+    }
+    m_rows = (m_height + NTK_ROW_DOTS - 1) / NTK_ROW_DOTS;
+    m_gray.resize((size_t)m_width * NTK_ROW_DOTS);
+}
+
+/**
+ * Source pixel format, PIXEL_RGBA (default) or PIXEL_GRAY
+ */
+Napi::Value ImagePacker::format(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1) {
+        return Napi::Number::New(info.Env(), m_format);
+    }
+    if (!info[0].IsNumber()) {
+        EXCEPTION("Argument 1 must be a pixel format");
+        return info.Env().Undefined();
+    }
+
+    int format = info[0].As<Napi::Number>().Int32Value();
+    if (format != PIXEL_GRAY && format != PIXEL_RGBA) {
+        EXCEPTION("Unknown pixel format");
+        return info.Env().Undefined();
+    }
+    m_format = format;
+
+    return info.This();
+}
+
+/**
+ * Luma at or above which a dot is lit, 128 by default
+ */
+Napi::Value ImagePacker::threshold(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1) {
+        return Napi::Number::New(info.Env(), m_threshold);
+    }
+    if (!info[0].IsNumber()) {
+        EXCEPTION("Argument 1 must be a number");
+        return info.Env().Undefined();
+    }
+
+    int threshold = info[0].As<Napi::Number>().Int32Value();
+    m_threshold = threshold < 0 ? 0 : threshold > 255 ? 255 : threshold;
+
+    return info.This();
+}
+
+/**
+ * Lights the dark pixels instead, for dark on light drawings
+ */
+Napi::Value ImagePacker::invert(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1) {
+        return Napi::Boolean::New(info.Env(), m_invert);
+    }
+    if (!info[0].IsBoolean()) {
+        EXCEPTION("Argument 1 must be a boolean");
+        return info.Env().Undefined();
+    }
+    m_invert = info[0].As<Napi::Boolean>().Value();
+
+    return info.This();
+}
+
+/**
+ * Kernel set in use: "neon", "sse2" or "scalar". Defaults to the best one
+ * the CPU supports, can be forced to compare them.
+ */
+Napi::Value ImagePacker::kernel(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1) {
+        return Napi::String::New(info.Env(), m_kernel->name);
+    }
+    if (!info[0].IsString()) {
+        EXCEPTION("Argument 1 must be a string");
+        return info.Env().Undefined();
+    }
+
+    const PackKernel *kernel = pack_kernel(info[0].As<Napi::String>().Utf8Value().c_str());
+    if (!kernel) {
+        EXCEPTION("Kernel not available on this CPU");
+        return info.Env().Undefined();
+    }
+    m_kernel = kernel;
+
+    return info.This();
+}
+
+/**
+ * Dithering mode, DITHER_NONE (default: plain threshold),
+ * DITHER_FLOYD_STEINBERG, DITHER_ATKINSON or DITHER_BAYER. The threshold
+ * is the quantization point for error diffusion and a bias for Bayer.
+ */
+Napi::Value ImagePacker::dither(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1) {
+        return Napi::Number::New(info.Env(), m_dither);
+    }
+    if (!info[0].IsNumber()) {
+        EXCEPTION("Argument 1 must be a dithering mode");
+        return info.Env().Undefined();
+    }
+
+    int mode = info[0].As<Napi::Number>().Int32Value();
+    if (mode < DITHER_NONE || mode > DITHER_BAYER) {
+        EXCEPTION("Unknown dithering mode");
+        return info.Env().Undefined();
+    }
+    m_dither = mode;
+
+    return info.This();
+}
+
+/**
+ * Number of threads used for dithering, each of them taking a horizontal
+ * band of the image. 0 means one per CPU. Defaults to 1.
+ */
+Napi::Value ImagePacker::threads(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1) {
+        return Napi::Number::New(info.Env(), m_threads);
+    }
+    if (!info[0].IsNumber()) {
+        EXCEPTION("Argument 1 must be a number");
+        return info.Env().Undefined();
+    }
+
+    int threads = info[0].As<Napi::Number>().Int32Value();
+    if (threads <= 0)
+        threads = std::thread::hardware_concurrency();
+    m_threads = threads < 1 ? 1 : threads > MAX_DITHER_THREADS ? MAX_DITHER_THREADS : threads;
+
+    return info.This();
+}
+
+/**
+ * Splits the image in bands of whole display rows, one per thread, the
+ * calling thread taking the first one
+ */
+void ImagePacker::dither_image(const uint8_t *src, size_t bpp, uint8_t *out) {
+    int count = m_threads < m_rows ? m_threads : m_rows;
+    int rows = (m_rows + count - 1) / count;
+
+    m_bands.resize(count);
+    for (int i = 0; i < count; i++) {
+        DitherBand& band = m_bands[i];
+        band.src = src;
+        band.bpp = bpp;
+        band.width = m_width;
+        band.y0 = i * rows * NTK_ROW_DOTS;
+        band.y1 = (i + 1) * rows * NTK_ROW_DOTS;
+        band.y1 = band.y1 > m_height ? m_height : band.y1;
+        band.out = out;
+        band.stride = m_rows;
+        band.mode = m_dither;
+        band.threshold = m_threshold;
+        band.invert = m_invert;
+        band.kernel = m_kernel;
+    }
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < count; i++) {
+        if (m_bands[i].y0 < m_bands[i].y1)
+            workers.emplace_back(dither_band, std::ref(m_bands[i]));
+    }
+    dither_band(m_bands[0]);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * pack(image, out): thresholds or dithers image (Buffer, TypedArray such as
+ * ImageData.data, or ArrayBuffer) into out, which is either a Buffer of at
+ * least width * rows bytes or a FrameBuffer of the same size. Allocates a
+ * new Buffer when out is not given. Returns out.
+ */
+Napi::Value ImagePacker::pack(const Napi::CallbackInfo& info) {
+    size_t length = 0;
+    const uint8_t *src = source_data(info[0], length);
+    size_t bpp = m_format == PIXEL_RGBA ? 4 : 1;
+    size_t size = (size_t)m_width * m_rows;
+
+    if (!src || length < (size_t)m_width * m_height * bpp) {
+        EXCEPTION("Argument 1 must be an image of the packer size");
+        return info.Env().Undefined();
+    }
+
+    Napi::Value result = info[1];
+    FrameBuffer *fb = FrameBuffer::FromValue(info[1]);
+    uint8_t *out;
+    if (fb) {
+        if (fb->columns() != m_width || fb->rows() != m_rows) {
+            EXCEPTION("FrameBuffer size does not match");
+            return info.Env().Undefined();
+        }
+        out = fb->data();
+    } else if (info[1].IsBuffer()) {
+        Napi::Buffer<uint8_t> buffer = info[1].As<Napi::Buffer<uint8_t>>();
+        if (buffer.Length() < size) {
+            EXCEPTION("Output buffer too small");
+            return info.Env().Undefined();
+        }
+        out = buffer.Data();
+    } else {
+        Napi::Buffer<uint8_t> buffer = Napi::Buffer<uint8_t>::New(info.Env(), size);
+        out = buffer.Data();
+        result = buffer;
+    }
+
+    for (int row = 0; row < m_rows && m_dither == DITHER_NONE; row++) {
+        const uint8_t *lines[NTK_ROW_DOTS];
+        int count = m_height - row * NTK_ROW_DOTS;
+        count = count > NTK_ROW_DOTS ? NTK_ROW_DOTS : count;
+
+        for (int i = 0; i < count; i++) {
+            const uint8_t *line = src + (size_t)(row * NTK_ROW_DOTS + i) * m_width * bpp;
+            if (m_format == PIXEL_RGBA) {
+                m_kernel->rgba_to_gray(line, m_gray.data() + i * m_width, m_width);
+                line = m_gray.data() + i * m_width;
+            }
+            lines[i] = line;
+        }
+        m_kernel->pack_band(lines, count, out + row, m_rows, m_width, m_threshold);
+
+        if (m_invert) {
+            // Don't light the padding dots below the image
+            uint8_t mask = 0xff << (NTK_ROW_DOTS - count);
+            for (int x = 0; x < m_width; x++) {
+                out[x * m_rows + row] ^= mask;
+            }
+        }
+    }
+
+    if (m_dither != DITHER_NONE)
+        dither_image(src, bpp, out);
+
+    if (fb)
+        fb->mark_dirty(0, 0, m_width, m_rows * NTK_ROW_DOTS);
+
+    return result;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <napi.h>
+#include <vector>
+
+#include "noritake.h"
+#include "dither.h"
+
+// Source pixel formats
+#define PIXEL_GRAY 0    // 1 byte per pixel
+#define PIXEL_RGBA 1    // 4 bytes per pixel, as in canvas ImageData
+
+/**
+ * Image conversion kernels, one set per instruction set. Rows are packed in
+ * bands of 8 into the display memory layout: one byte per column, MSB at the
+ * top, consecutive columns 'stride' bytes apart.
+ */
+struct PackKernel {
+    const char *name;
+    void (*rgba_to_gray)(const uint8_t *src, uint8_t *dst, size_t count);
+    void (*pack_band)(const uint8_t *const *lines, int count, uint8_t *out,
+                      size_t stride, size_t width, uint8_t threshold);
+};
+
+const PackKernel *pack_kernel(const char *name = NULL);
+
+/**
+ * Thresholds grayscale or RGBA images straight into a transfer ready Buffer
+ * (or a FrameBuffer), reading the source memory in place.
+ */
+class ImagePacker : public Napi::ObjectWrap<ImagePacker> {
+    public:
+        ImagePacker(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value format(const Napi::CallbackInfo& info);
+        Napi::Value threshold(const Napi::CallbackInfo& info);
+        Napi::Value invert(const Napi::CallbackInfo& info);
+        Napi::Value kernel(const Napi::CallbackInfo& info);
+        Napi::Value dither(const Napi::CallbackInfo& info);
+        Napi::Value threads(const Napi::CallbackInfo& info);
+        Napi::Value pack(const Napi::CallbackInfo& info);
+
+    private:
+        static Napi::FunctionReference constructor;
+        void dither_image(const uint8_t *src, size_t bpp, uint8_t *out);
+
+        int m_width;
+        int m_height;
+        int m_rows;
+        int m_format;
+        uint8_t m_threshold;
+        bool m_invert;
+        const PackKernel *m_kernel;
+        std::vector<uint8_t> m_gray;    // 8 converted lines for RGBA sources
+        int m_dither;
+        int m_threads;
+        std::vector<DitherBand> m_bands;
+};
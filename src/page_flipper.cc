@@ -0,0 +1,398 @@
+#include "page_flipper.h"
+#include "framebuffer.h"
+#include "spi_driver.h"
+
+#include <string.h>
+
+Napi::FunctionReference PageFlipper::constructor;
+
+#define INT_ARG(N, DEFAULT) (info[N].IsNumber() ? info[N].As<Napi::Number>().Int32Value() : (DEFAULT))
+
+Napi::Object PageFlipper::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "PageFlipper",
+        {
+            InstanceMethod("memoryWidth", &PageFlipper::memoryWidth),
+            InstanceMethod("page", &PageFlipper::page),
+            InstanceMethod("invalidate", &PageFlipper::invalidate),
+            InstanceMethod("encode", &PageFlipper::encode),
+            InstanceMethod("flip", &PageFlipper::flip),
+            InstanceMethod("start", &PageFlipper::start),
+            InstanceMethod("submit", &PageFlipper::submit),
+            InstanceMethod("stop", &PageFlipper::stop),
+            InstanceMethod("running", &PageFlipper::running),
+            InstanceMethod("error", &PageFlipper::error),
+            InstanceMethod("stats", &PageFlipper::stats),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("PageFlipper", func);
+
+    return exports;
+}
+
+/**
+ * new PageFlipper(width, height): screen size in dots, defaults to 256x64.
+ * The display memory is 512 columns wide by default, i.e. two pages, see
+ * memoryWidth().
+ */
+PageFlipper::PageFlipper(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<PageFlipper>(info),
+    m_width(INT_ARG(0, 256)),
+    m_rows(INT_ARG(1, 64) / NTK_ROW_DOTS),
+    m_pages(2),
+    m_page(0),
+    m_has_pending(false),
+    m_stop(true),
+    m_frames(0),
+    m_dropped(0),
+    m_spi(NULL) {
+
+    if (m_width <= 0 || m_rows <= 0 || m_width * m_pages > 512 ||
+        m_width * m_rows > 0xFFFF) {
+        EXCEPTION("Wrong screen size");
+        m_width = 1;
+        m_rows = 1;
+    }
+    m_frame_bytes = (size_t)m_width * m_rows;
+    m_shadow.resize(m_frame_bytes * m_pages);
+    m_valid.assign(m_pages, false);
+}
+
+PageFlipper::~PageFlipper() {
+    this->halt();
+}
+
+/**
+ * Gets a frame argument, either a Buffer in display layout or a FrameBuffer
+ * of the screen size. Returns NULL on size mismatch.
+ */
+const uint8_t *PageFlipper::frame(const Napi::Value& value) {
+    FrameBuffer *fb = FrameBuffer::FromValue(value);
+
+    if (fb) {
+        if (fb->columns() != m_width || fb->rows() != m_rows)
+            return NULL;
+        return fb->data();
+    }
+    if (value.IsBuffer()) {
+        Napi::Buffer<uint8_t> buf = value.As<Napi::Buffer<uint8_t>>();
+        if (buf.Length() == m_frame_bytes)
+            return buf.Data();
+    }
+    return NULL;
+}
+
+/**
+ * Display memory width in columns, a multiple of the screen width. Each
+ * screen wide part of it is a page, frames go to the pages in turn.
+ */
+Napi::Value PageFlipper::memoryWidth(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        int in_value = info[0].As<Napi::Number>().Int32Value();
+        this->reap();
+        if (m_thread.joinable()) {
+            EXCEPTION("Cannot be called while running");
+        } else if (in_value % m_width || in_value < 2 * m_width || in_value > 0xFFFF) {
+            EXCEPTION("Memory must be at least two screens wide");
+        } else {
+            m_pages = in_value / m_width;
+            m_page = 0;
+            m_shadow.assign(m_frame_bytes * m_pages, 0);
+            m_valid.assign(m_pages, false);
+        }
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), m_width * m_pages);
+    }
+}
+
+/**
+ * Page on screen, its first column in display memory is page() * width
+ */
+Napi::Value PageFlipper::page(const Napi::CallbackInfo& info) {
+    this->reap();
+    if (m_thread.joinable()) {
+        EXCEPTION("Cannot be called while running");
+        return info.Env().Undefined();
+    }
+    return Napi::Number::New(info.Env(), m_page);
+}
+
+/**
+ * Forgets the display memory contents, so that the next frames are written
+ * in full. To be called after the display was reset, which also brings
+ * page 0 back on screen.
+ */
+Napi::Value PageFlipper::invalidate(const Napi::CallbackInfo& info) {
+    this->reap();
+    if (m_thread.joinable()) {
+        EXCEPTION("Cannot be called while running");
+        return info.This();
+    }
+    m_page = 0;
+    m_valid.assign(m_pages, false);
+    return info.This();
+}
+
+/**
+ * Encodes a frame: the columns that differ from what the next page holds
+ * are written there (spans closer than a write header are merged), then
+ * the display start moves to that page. Returns false when the frame is
+ * already on screen. Nothing changes until shown() is called, once the
+ * commands were sent.
+ */
+bool PageFlipper::encode_frame(CommandBuffer& commands, const uint8_t *frame) {
+    int next = (m_page + 1) % m_pages;
+    uint8_t *shadow = &m_shadow[next * m_frame_bytes];
+    bool known = m_valid[next];
+    int merge_gap = (NTK_CURSOR_BYTES + NTK_BIT_IMAGE_BYTES) / m_rows;
+
+    commands.reset();
+    if (m_valid[m_page] && !memcmp(&m_shadow[m_page * m_frame_bytes], frame, m_frame_bytes))
+        return false;
+
+    int start = -1;
+    int end = -1;
+    for (int c = 0; c <= m_width; c++) {
+        bool changed = c < m_width &&
+            (!known || memcmp(shadow + c * m_rows, frame + c * m_rows, m_rows));
+        if (changed) {
+            if (start >= 0 && c - end > merge_gap) {
+                commands.cursor(next * m_width + start, 0);
+                commands.bit_image(end - start, m_rows, frame + start * m_rows);
+                start = -1;
+            }
+            if (start < 0)
+                start = c;
+            end = c + 1;
+        }
+    }
+    if (start >= 0) {
+        commands.cursor(next * m_width + start, 0);
+        commands.bit_image(end - start, m_rows, frame + start * m_rows);
+    }
+    commands.scroll(m_width * m_rows, 1, 0);
+    return true;
+}
+
+/**
+ * Takes note that the commands of encode_frame() for the frame made it to
+ * the display
+ */
+void PageFlipper::shown(const uint8_t *frame) {
+    int next = (m_page + 1) % m_pages;
+
+    memcpy(&m_shadow[next * m_frame_bytes], frame, m_frame_bytes);
+    m_valid[next] = true;
+    m_page = next;
+}
+
+/**
+ * encode(frame): returns the bytes flipping to the frame as a Buffer, to
+ * drive the display from JS instead of flip() or start()
+ */
+Napi::Value PageFlipper::encode(const Napi::CallbackInfo& info) {
+    const uint8_t *data = frame(info[0]);
+    if (!data) {
+        EXCEPTION("Frame must be a Buffer or a FrameBuffer of the screen size");
+        return info.Env().Undefined();
+    }
+    this->reap();
+    if (m_thread.joinable()) {
+        EXCEPTION("Cannot be called while running");
+        return info.Env().Undefined();
+    }
+
+    // The caller sends them
+    if (this->encode_frame(m_commands, data))
+        this->shown(data);
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_commands.data(), m_commands.length());
+}
+
+/**
+ * flip(spi, frame): writes the frame into the next page and shows it,
+ * from the JS thread
+ */
+Napi::Value PageFlipper::flip(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    const uint8_t *data = frame(info[1]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.This();
+    }
+    if (!data) {
+        EXCEPTION("Frame must be a Buffer or a FrameBuffer of the screen size");
+        return info.This();
+    }
+    this->reap();
+    if (m_thread.joinable()) {
+        EXCEPTION("Cannot be called while running");
+        return info.This();
+    }
+
+    if (!this->encode_frame(m_commands, data))
+        return info.This();
+    const char *error = spi->transmit_commands(m_commands);
+    if (error) {
+        // Don't know what made it to the display memory
+        m_valid.assign(m_pages, false);
+        Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+        return info.This();
+    }
+    this->shown(data);
+    return info.This();
+}
+
+/**
+ * start(spi): from now on frames given to submit() are sent by a native
+ * I/O thread, until stop(). Transfers from JS, on this device or another
+ * one, are serialized with it.
+ */
+Napi::Value PageFlipper::start(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.Env().Undefined();
+    }
+    this->reap();
+    if (m_thread.joinable()) {
+        EXCEPTION("Already running");
+        return info.Env().Undefined();
+    }
+
+    // Keep the device alive as long as the thread uses it
+    m_spi = spi;
+    m_spi_ref = Napi::Persistent(info[0].As<Napi::Object>());
+    m_stop = false;
+    m_has_pending = false;
+    m_error.clear();
+    m_thread = std::thread(&PageFlipper::run, this);
+
+    return info.This();
+}
+
+/**
+ * submit(frame): hands a frame over to the I/O thread (it is copied). If
+ * the previous one was not sent yet, it is replaced and counted as
+ * dropped.
+ */
+Napi::Value PageFlipper::submit(const Napi::CallbackInfo& info) {
+    const uint8_t *data = frame(info[0]);
+    if (!data) {
+        EXCEPTION("Frame must be a Buffer or a FrameBuffer of the screen size");
+        return info.This();
+    }
+    this->reap();
+    if (!m_thread.joinable()) {
+        EXCEPTION("Not running, see start()");
+        return info.This();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_has_pending)
+            m_dropped++;
+        m_pending.assign(data, data + m_frame_bytes);
+        m_has_pending = true;
+    }
+    m_wake.notify_all();
+    return info.This();
+}
+
+Napi::Value PageFlipper::stop(const Napi::CallbackInfo& info) {
+    this->halt();
+    m_spi_ref.Reset();
+    m_spi = NULL;
+    return info.This();
+}
+
+/**
+ * Tells whether the I/O thread is running. It stops by itself on errors,
+ * see error().
+ */
+Napi::Value PageFlipper::running(const Napi::CallbackInfo& info) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return Napi::Boolean::New(info.Env(), m_thread.joinable() && !m_stop && m_error.empty());
+}
+
+/**
+ * Error that stopped the I/O thread, or undefined
+ */
+Napi::Value PageFlipper::error(const Napi::CallbackInfo& info) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_error.empty())
+        return info.Env().Undefined();
+    return Napi::String::New(info.Env(), m_error);
+}
+
+/**
+ * Frames shown by the I/O thread, and frames replaced before it got to them
+ */
+Napi::Value PageFlipper::stats(const Napi::CallbackInfo& info) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    Napi::Object stats = Napi::Object::New(info.Env());
+    stats.Set("frames", Napi::Number::New(info.Env(), m_frames));
+    stats.Set("dropped", Napi::Number::New(info.Env(), m_dropped));
+    return stats;
+}
+
+/**
+ * I/O thread: sends the latest submitted frame, the lock is released while
+ * encoding and transmitting so that JS can submit the next one meanwhile
+ */
+void PageFlipper::run() {
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (!m_stop) {
+        m_wake.wait(lock, [this] { return m_stop || m_has_pending; });
+        if (m_stop)
+            break;
+        m_work.swap(m_pending);
+        m_has_pending = false;
+
+        lock.unlock();
+        const char *error = NULL;
+        bool changed = this->encode_frame(m_commands, m_work.data());
+        if (changed)
+            error = m_spi->transmit_commands(m_commands);
+        lock.lock();
+        if (error) {
+            // Don't know what made it to the display memory
+            m_valid.assign(m_pages, false);
+            m_error = error;
+            m_stop = true;
+            break;
+        }
+        if (changed)
+            this->shown(m_work.data());
+        m_frames++;
+    }
+}
+
+/**
+ * Joins the I/O thread if it stopped by itself on an error, so that the
+ * flipper can be used and started again
+ */
+void PageFlipper::reap() {
+    bool stopped;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        stopped = m_stop;
+    }
+    if (stopped && m_thread.joinable())
+        m_thread.join();
+}
+
+void PageFlipper::halt() {
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
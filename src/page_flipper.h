@@ -0,0 +1,72 @@
+#pragma once
+
+#include <napi.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "noritake.h"
+
+class SPIDriver;
+
+/**
+ * Double buffering in the display memory: each frame is written into a
+ * hidden page of the display memory, then a single scroll command moves
+ * the display start over it, so frames never show half written. Frames can
+ * be sent from a native I/O thread while JS renders the next one.
+ */
+class PageFlipper : public Napi::ObjectWrap<PageFlipper> {
+    public:
+        PageFlipper(const Napi::CallbackInfo& info);
+        ~PageFlipper();
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value memoryWidth(const Napi::CallbackInfo& info);
+        Napi::Value page(const Napi::CallbackInfo& info);
+        Napi::Value invalidate(const Napi::CallbackInfo& info);
+        Napi::Value encode(const Napi::CallbackInfo& info);
+        Napi::Value flip(const Napi::CallbackInfo& info);
+        Napi::Value start(const Napi::CallbackInfo& info);
+        Napi::Value submit(const Napi::CallbackInfo& info);
+        Napi::Value stop(const Napi::CallbackInfo& info);
+        Napi::Value running(const Napi::CallbackInfo& info);
+        Napi::Value error(const Napi::CallbackInfo& info);
+        Napi::Value stats(const Napi::CallbackInfo& info);
+
+    private:
+        static Napi::FunctionReference constructor;
+        const uint8_t *frame(const Napi::Value& value);
+        bool encode_frame(CommandBuffer& commands, const uint8_t *frame);
+        void shown(const uint8_t *frame);
+        void run();
+        void reap();
+        void halt();
+
+        int m_width;
+        int m_rows;
+        int m_pages;                  // Screen sized pages in display memory
+        size_t m_frame_bytes;
+
+        // Display memory contents, only used by the I/O thread while running
+        int m_page;                   // Page on screen
+        std::vector<uint8_t> m_shadow;
+        std::vector<bool> m_valid;    // Page content known
+        CommandBuffer m_commands;
+
+        // Shared with the I/O thread, under m_lock
+        std::mutex m_lock;
+        std::condition_variable m_wake;
+        std::vector<uint8_t> m_pending; // Latest submitted frame
+        bool m_has_pending;
+        bool m_stop;
+        std::string m_error;
+        uint32_t m_frames;
+        uint32_t m_dropped;
+
+        SPIDriver *m_spi;
+        Napi::ObjectReference m_spi_ref;
+        std::thread m_thread;
+        std::vector<uint8_t> m_work;  // Frame being sent by the I/O thread
+};
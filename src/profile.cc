@@ -0,0 +1,36 @@
+#include "profile.h"
+#include "noritake.h"
+
+// The displays store real time bit image data straight into display
+// memory, fast enough to keep up without any handshake
+static const uint32_t gu3900_dma[] = { NTK_CMD_BIT_IMAGE, 0 };
+static const uint32_t gu7000_dma[] = { NTK_CMD_BIT_IMAGE, 0 };
+
+static const DisplayProfile profiles[] = {
+    // RDY can take up to 500ns to go down after WR
+    { PROFILE_GU3900, "GU-3900", false, 1000, { 0 }, gu3900_dma },
+    // Same as GU-3900 until B series timings are measured
+    { PROFILE_GU3900B, "GU-3900B", false, 1000, { 0 }, gu3900_dma },
+    // The spec says BUSY can take up to 20us to go up, which is kept for
+    // the commands that take long. The other bytes get the 10us that
+    // always worked in practice: the transfer loops move on as soon as the
+    // BUSY pulse is over, so these timeouts only cost time after bytes
+    // that don't raise BUSY at all. busyTiming() can lower them once
+    // measured with busyLatency().
+    { PROFILE_GU7000, "GU-7000", true, 20000,
+      { 10000, 10000, 10000, 10000, 20000 }, gu7000_dma },
+};
+
+const DisplayProfile *display_profile(bool bseries, bool invert_rdy) {
+    if (invert_rdy)
+        return &profiles[PROFILE_GU7000];
+    return &profiles[bseries ? PROFILE_GU3900B : PROFILE_GU3900];
+}
+
+bool profile_dma_safe(const DisplayProfile *profile, uint32_t command) {
+    for (const uint32_t *c = profile->dma_commands; *c; c++) {
+        if (*c == command)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "noritake.h"
+
+#define PROFILE_GU3900  0
+#define PROFILE_GU3900B 1
+#define PROFILE_GU7000  2
+
+/**
+ * Protocol and timing differences between the supported display families.
+ * The profile is picked when the device is opened (see bSeries and
+ * invertRdy), and the transfer loops are specialized for it.
+ */
+struct DisplayProfile {
+    uint8_t id;
+    const char *name;
+    bool busy;                      // BUSY line (active high) instead of RDY
+    uint32_t settle_ns;             // WR rising edge to RDY/BUSY valid
+    uint32_t busy_ns[NTK_BYTE_CLASSES]; // BUSY displays: longest time for
+                                    // BUSY to go up, per NTK_BYTE_* class
+    const uint32_t *dma_commands;   // Commands whose payload doesn't need
+                                    // RDY checks, 0 terminated
+};
+
+const DisplayProfile *display_profile(bool bseries, bool invert_rdy);
+bool profile_dma_safe(const DisplayProfile *profile, uint32_t command);
@@ -0,0 +1,334 @@
+#include "scroller.h"
+#include "spi_driver.h"
+
+#include <chrono>
+
+Napi::FunctionReference Scroller::constructor;
+
+#define INT_ARG(N, DEFAULT) (info[N].IsNumber() ? info[N].As<Napi::Number>().Int32Value() : (DEFAULT))
+
+Napi::Object Scroller::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "Scroller",
+        {
+            InstanceMethod("memoryWidth", &Scroller::memoryWidth),
+            InstanceMethod("step", &Scroller::step),
+            InstanceMethod("interval", &Scroller::interval),
+            InstanceMethod("speed", &Scroller::speed),
+            InstanceMethod("push", &Scroller::push),
+            InstanceMethod("pending", &Scroller::pending),
+            InstanceMethod("position", &Scroller::position),
+            InstanceMethod("encodeStep", &Scroller::encodeStep),
+            InstanceMethod("start", &Scroller::start),
+            InstanceMethod("stop", &Scroller::stop),
+            InstanceMethod("running", &Scroller::running),
+            InstanceMethod("error", &Scroller::error),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("Scroller", func);
+
+    return exports;
+}
+
+/**
+ * new Scroller(width, height): screen size in dots, defaults to 256x64.
+ * The display memory is 512 columns wide by default, see memoryWidth().
+ */
+Scroller::Scroller(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<Scroller>(info),
+    m_width(INT_ARG(0, 256)),
+    m_rows(INT_ARG(1, 64) / NTK_ROW_DOTS),
+    m_memory_width(512),
+    m_step(1),
+    m_interval(20),
+    m_speed(0),
+    m_head(0),
+    m_position(0),
+    m_stop(true),
+    m_spi(NULL) {
+
+    if (m_width <= 0 || m_rows <= 0 || m_width >= m_memory_width) {
+        EXCEPTION("Wrong screen size");
+        m_width = 1;
+        m_rows = 1;
+    }
+}
+
+Scroller::~Scroller() {
+    this->halt();
+}
+
+/**
+ * Display memory width in columns. Columns past the screen width are
+ * where new content is written before being scrolled in.
+ */
+Napi::Value Scroller::memoryWidth(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        int in_value = info[0].As<Napi::Number>().Int32Value();
+        this->reap();
+        if (m_thread.joinable()) {
+            EXCEPTION("Cannot be called while running");
+        } else if (in_value <= m_width || in_value > 0xFFFF) {
+            EXCEPTION("Memory must be wider than the screen");
+        } else {
+            m_memory_width = in_value;
+            m_position %= m_memory_width;
+        }
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), m_memory_width);
+    }
+}
+
+/**
+ * Maximum number of columns scrolled in per step, 1 by default
+ */
+Napi::Value Scroller::step(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        int in_value = info[0].As<Napi::Number>().Int32Value();
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_step = in_value < 1 ? 1 : in_value > m_width ? m_width : in_value;
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), m_step);
+    }
+}
+
+/**
+ * Time between steps in ms, 20 by default
+ */
+Napi::Value Scroller::interval(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        uint32_t in_value = info[0].As<Napi::Number>().Uint32Value();
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_interval = in_value ? in_value : 1;
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), m_interval);
+    }
+}
+
+/**
+ * Speed parameter of the scroll command: the display waits s x 14ms
+ * between two shifted columns of the same step. 0 by default.
+ */
+Napi::Value Scroller::speed(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        uint32_t in_value = info[0].As<Napi::Number>().Uint32Value();
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_speed = in_value > 255 ? 255 : in_value;
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), m_speed);
+    }
+}
+
+/**
+ * push(columns): queues columns (Buffer in display layout, height / 8
+ * bytes per column, e.g. from Font.render()) to scroll in. Can be called
+ * while running.
+ */
+Napi::Value Scroller::push(const Napi::CallbackInfo& info) {
+    if (!info[0].IsBuffer()) {
+        EXCEPTION("Argument 1 must be a Buffer");
+        return info.Env().Undefined();
+    }
+    Napi::Buffer<uint8_t> data = info[0].As<Napi::Buffer<uint8_t>>();
+    if (data.Length() % m_rows) {
+        EXCEPTION("Buffer must hold whole columns");
+        return info.Env().Undefined();
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_queue.insert(m_queue.end(), data.Data(), data.Data() + data.Length());
+    return info.This();
+}
+
+/**
+ * Number of queued columns not scrolled in yet
+ */
+Napi::Value Scroller::pending(const Napi::CallbackInfo& info) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return Napi::Number::New(info.Env(), (m_queue.size() - m_head) / m_rows);
+}
+
+/**
+ * Display memory column currently at the left edge of the screen
+ */
+Napi::Value Scroller::position(const Napi::CallbackInfo& info) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return Napi::Number::New(info.Env(), m_position);
+}
+
+/**
+ * Encodes the next step: the new columns are written right past the
+ * screen edge in display memory (two writes when that wraps around), then
+ * the screen is shifted one column per new column. Returns the number of
+ * columns, 0 when the queue is empty. They stay queued until advance().
+ */
+size_t Scroller::encode_step(CommandBuffer& commands) {
+    size_t available = (m_queue.size() - m_head) / m_rows;
+    int count = available < (size_t)m_step ? available : m_step;
+
+    commands.reset();
+    if (!count)
+        return 0;
+
+    int x = (m_position + m_width) % m_memory_width;
+    int first = count < m_memory_width - x ? count : m_memory_width - x;
+    commands.cursor(x, 0);
+    commands.bit_image(first, m_rows, &m_queue[m_head]);
+    if (count > first) {
+        commands.cursor(0, 0);
+        commands.bit_image(count - first, m_rows, &m_queue[m_head + first * m_rows]);
+    }
+    commands.scroll(m_rows, count, m_speed);
+    return count;
+}
+
+/**
+ * Consumes the columns of a step that made it to the display
+ */
+void Scroller::advance(size_t count) {
+    m_head += count * m_rows;
+    m_position = (m_position + count) % m_memory_width;
+    if (m_head * 2 > m_queue.size()) {
+        m_queue.erase(m_queue.begin(), m_queue.begin() + m_head);
+        m_head = 0;
+    }
+}
+
+/**
+ * encodeStep(): returns the bytes of the next step as a Buffer, to drive
+ * the scroll from JS instead of start()
+ */
+Napi::Value Scroller::encodeStep(const Napi::CallbackInfo& info) {
+    CommandBuffer commands;
+
+    this->reap();
+    if (m_thread.joinable()) {
+        EXCEPTION("Cannot be called while running");
+        return info.Env().Undefined();
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    this->advance(this->encode_step(commands));
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), commands.data(), commands.length());
+}
+
+/**
+ * start(spi): steps every interval() ms from a native thread, until
+ * stop(). Transfers from JS, on this device or another one, are
+ * serialized with it.
+ */
+Napi::Value Scroller::start(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.Env().Undefined();
+    }
+    this->reap();
+    if (m_thread.joinable()) {
+        EXCEPTION("Already running");
+        return info.Env().Undefined();
+    }
+
+    // Keep the device alive as long as the thread uses it
+    m_spi = spi;
+    m_spi_ref = Napi::Persistent(info[0].As<Napi::Object>());
+    m_stop = false;
+    m_error.clear();
+    m_thread = std::thread(&Scroller::run, this);
+
+    return info.This();
+}
+
+Napi::Value Scroller::stop(const Napi::CallbackInfo& info) {
+    this->halt();
+    m_spi_ref.Reset();
+    m_spi = NULL;
+    return info.This();
+}
+
+/**
+ * Tells whether the I/O thread is stepping. It stops by itself on errors,
+ * see error().
+ */
+Napi::Value Scroller::running(const Napi::CallbackInfo& info) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return Napi::Boolean::New(info.Env(), m_thread.joinable() && !m_stop && m_error.empty());
+}
+
+/**
+ * Error that stopped the I/O thread, or undefined
+ */
+Napi::Value Scroller::error(const Napi::CallbackInfo& info) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_error.empty())
+        return info.Env().Undefined();
+    return Napi::String::New(info.Env(), m_error);
+}
+
+/**
+ * I/O thread: steps on a fixed schedule, the lock is released while
+ * transmitting so that JS can keep pushing columns
+ */
+void Scroller::run() {
+    auto next = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (!m_stop) {
+        next += std::chrono::milliseconds(m_interval);
+        m_wake.wait_until(lock, next, [this] { return m_stop; });
+        if (m_stop)
+            break;
+        size_t count = this->encode_step(m_commands);
+        if (!count)
+            continue;
+
+        lock.unlock();
+        const char *error = m_spi->transmit_commands(m_commands);
+        lock.lock();
+        if (error) {
+            // The columns stay queued for the next start()
+            m_error = error;
+            m_stop = true;
+            break;
+        }
+        // JS only appends to the queue meanwhile
+        this->advance(count);
+
+        // Don't try to catch up after a slow step
+        auto now = std::chrono::steady_clock::now();
+        if (next < now)
+            next = now;
+    }
+}
+
+/**
+ * Joins the I/O thread if it stopped by itself after an error, so that
+ * the scroller can be set up and started again
+ */
+void Scroller::reap() {
+    bool stopped;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        stopped = m_stop;
+    }
+    if (stopped && m_thread.joinable())
+        m_thread.join();
+}
+
+void Scroller::halt() {
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
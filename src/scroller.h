@@ -0,0 +1,66 @@
+#pragma once
+
+#include <napi.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "noritake.h"
+
+class SPIDriver;
+
+/**
+ * Horizontal ticker driven by the display scroll command: each step writes
+ * only the newly exposed columns into the hidden part of the display memory,
+ * then shifts the screen over them. Steps are paced by a native I/O thread.
+ */
+class Scroller : public Napi::ObjectWrap<Scroller> {
+    public:
+        Scroller(const Napi::CallbackInfo& info);
+        ~Scroller();
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value memoryWidth(const Napi::CallbackInfo& info);
+        Napi::Value step(const Napi::CallbackInfo& info);
+        Napi::Value interval(const Napi::CallbackInfo& info);
+        Napi::Value speed(const Napi::CallbackInfo& info);
+        Napi::Value push(const Napi::CallbackInfo& info);
+        Napi::Value pending(const Napi::CallbackInfo& info);
+        Napi::Value position(const Napi::CallbackInfo& info);
+        Napi::Value encodeStep(const Napi::CallbackInfo& info);
+        Napi::Value start(const Napi::CallbackInfo& info);
+        Napi::Value stop(const Napi::CallbackInfo& info);
+        Napi::Value running(const Napi::CallbackInfo& info);
+        Napi::Value error(const Napi::CallbackInfo& info);
+
+    private:
+        static Napi::FunctionReference constructor;
+        size_t encode_step(CommandBuffer& commands);
+        void advance(size_t count);
+        void run();
+        void reap();
+        void halt();
+
+        int m_width;
+        int m_rows;
+        int m_memory_width;
+        int m_step;
+        uint32_t m_interval;          // ms between steps
+        uint8_t m_speed;              // Scroll command speed parameter
+
+        // Shared with the I/O thread, under m_lock
+        std::mutex m_lock;
+        std::condition_variable m_wake;
+        std::vector<uint8_t> m_queue; // Columns waiting to scroll in
+        size_t m_head;
+        int m_position;               // Memory column at the screen left edge
+        bool m_stop;
+        std::string m_error;
+
+        SPIDriver *m_spi;
+        Napi::ObjectReference m_spi_ref;
+        std::thread m_thread;
+        CommandBuffer m_commands;     // Only used by the I/O thread
+};
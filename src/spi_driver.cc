@@ -1,4 +1,5 @@
 #include "spi_driver.h"
+#include "optimizer.h"
 #ifdef __linux__
   #include <sys/ioctl.h>
   #include <linux/spi/spidev.h>
@@ -9,6 +10,7 @@
 
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -34,8 +36,43 @@ void delayMicrosecondsHard (unsigned int howLong)
      gettimeofday (&tNow, NULL) ;
  }
 
+/**
+ * Same with ns resolution, for the short RDY/BUSY settle times
+ */
+void delayNanosecondsHard (uint32_t howLong)
+{
+    uint64_t end = now_ns() + howLong;
+
+    while (now_ns() < end) {}
+}
+
+// Credit based flow control: the Noritake receive buffer is 256 bytes
+// (see rdyPin), we keep some slack below that since the occupancy is
+// only an estimate.
+#define CREDIT_BUFFER_SIZE 256
+#define CREDIT_HIGH_WATER (CREDIT_BUFFER_SIZE - 32)
+// Commands that can take milliseconds to execute (screen clear,
+// initialize...) are costed very conservatively.
+#define CREDIT_CONTROL_COST 1000000
+#define CREDIT_MAX_DRAIN_TIME 1000000
+// Share of the extra drain time given back after each transfer that went
+// without a mismatch
+#define CREDIT_DECAY_SHIFT 3
+
+// Spins until READY is true, and accounts for the wait in the transfer
+// stats. The clock is only read when the display is not ready right away.
+#define WAIT_READY(READY) do {                                                 \
+    if (!(READY)) {                                                            \
+        uint64_t wait_start = now_ns();                                        \
+        uint32_t wait_spins = 0;                                               \
+        while (!(READY)) { wait_spins++; }                                     \
+        this->rdy_waited(wait_start, wait_spins);                              \
+    }                                                                          \
+} while (0)
+
 
 Napi::FunctionReference SPIDriver::constructor;
+std::mutex SPIDriver::s_bus;
 
 Napi::Object SPIDriver::Init(Napi::Env env, Napi::Object exports) {
     napi_status status;
@@ -62,6 +99,22 @@ Napi::Object SPIDriver::Init(Napi::Env env, Napi::Object exports) {
             InstanceMethod("loopback", &SPIDriver::loopback),
             InstanceMethod("bitOrder", &SPIDriver::bitOrder),
             InstanceMethod("halfDuplex", &SPIDriver::halfDuplex),
+            InstanceMethod("flowControl", &SPIDriver::flowControl),
+            InstanceMethod("drainTime", &SPIDriver::drainTime),
+            InstanceMethod("rdyWait", &SPIDriver::rdyWait),
+            InstanceMethod("dataPins", &SPIDriver::dataPins),
+            InstanceMethod("latchPin", &SPIDriver::latchPin),
+            InstanceMethod("profile", &SPIDriver::profile),
+            InstanceMethod("busyTiming", &SPIDriver::busyTiming),
+            InstanceMethod("busyLatency", &SPIDriver::busyLatency),
+            InstanceMethod("optimize", &SPIDriver::optimize),
+            InstanceMethod("optimizerStats", &SPIDriver::optimizerStats),
+            InstanceMethod("autoDma", &SPIDriver::autoDma),
+            InstanceMethod("stats", &SPIDriver::stats),
+            InstanceMethod("resetStats", &SPIDriver::resetStats),
+            InstanceMethod("latency", &SPIDriver::latency),
+            InstanceMethod("trace", &SPIDriver::trace),
+            InstanceMethod("chromeTrace", &SPIDriver::chromeTrace),
         }
     );
 
@@ -75,9 +128,22 @@ Napi::Object SPIDriver::Init(Napi::Env env, Napi::Object exports) {
     // This module supports either spidev - good but slow, or very very slow for
     // short transfers, and low level bcm2835 library, which is very fast and
     // a bit more dangerous since it bypasses the Linux bcm-2835 driver and talks
-    // to the chip directly.
+    // to the chip directly. The parallel driver also uses the bcm2835 library,
+    // but drives the display data lines straight from the GPIOs, without any
+    // shift register.
     NODE_SET_PROPERTY(exports, DRIVER_SPIDEV)
     NODE_SET_PROPERTY(exports, DRIVER_BCM2835)
+    NODE_SET_PROPERTY(exports, DRIVER_PARALLEL)
+
+    // RDY flow control: either check RDY after every byte, or only
+    // when our estimate of the display receive buffer says it may be full
+    NODE_SET_PROPERTY(exports, FLOW_STRICT)
+    NODE_SET_PROPERTY(exports, FLOW_CREDIT)
+
+    // How to wait for RDY: sample the line level, or (bcm2835 only) let
+    // the GPIO edge detector latch the end of the BUSY pulse for us
+    NODE_SET_PROPERTY(exports, RDY_WAIT_POLL)
+    NODE_SET_PROPERTY(exports, RDY_WAIT_EVENT)
 
 #define SPI_CS_LOW 0  // This doesn't exist normally
     NODE_SET_PROPERTY(exports, SPI_NO_CS)
@@ -96,6 +162,23 @@ Napi::Object SPIDriver::Init(Napi::Env env, Napi::Object exports) {
     return exports;
 }
 
+/**
+ * Gets the native driver from either the Spi wrapper of lib/binding.js or
+ * the native object itself. Returns NULL if value is neither.
+ */
+SPIDriver *SPIDriver::FromValue(Napi::Value value) {
+    if (!value.IsObject())
+        return NULL;
+
+    Napi::Object obj = value.As<Napi::Object>();
+    if (obj.Has("_spi"))
+        obj = obj.Get("_spi").As<Napi::Object>();
+    if (!obj.IsObject() || !obj.InstanceOf(constructor.Value()))
+        return NULL;
+
+    return SPIDriver::Unwrap(obj);
+}
+
 SPIDriver::SPIDriver(const Napi::CallbackInfo& info)
     : Napi::ObjectWrap<SPIDriver>(info),
     m_fd(-1),
@@ -107,7 +190,32 @@ SPIDriver::SPIDriver(const Napi::CallbackInfo& info)
     m_rdy_pin(0),
     m_driver(DRIVER_SPIDEV),
     m_bseries(false),
-    m_invert_rdy(false)  // RDY is RDY, not BUSY
+    m_invert_rdy(false),  // RDY is RDY, not BUSY
+    m_flow_control(FLOW_STRICT),
+    m_drain_time(10000),  // 10us per byte, conservative
+    m_drain_base(10000),
+    m_credit_bytes(0),
+    m_credit_backlog(0),
+    m_credit_stamp(0),
+    m_credit_strict(false),
+    m_rdy_wait(RDY_WAIT_POLL),
+    m_data_pins(),
+    m_data_mask(0),
+    m_data_lut(),
+    m_latch_pin(0),
+    m_profile(display_profile(false, false)),
+    m_busy_override(),
+    m_busy_ns(),
+    m_busy_latency(),
+    m_optimize(false),
+    m_auto_dma(true),
+    m_wait_ns(0),
+    m_wait_max_ns(0),
+    m_wait_spins(0),
+    m_delay_ns(0),
+    m_dma(false),
+    m_pending(0),
+    m_tracing(false)
     {
 
 }
@@ -127,8 +235,18 @@ Napi::Value SPIDriver::open(const Napi::CallbackInfo& info) {
     std::string dev = info[0].As<Napi::String>().Utf8Value();
     const char * device = dev.c_str();
 
+    this->m_profile = display_profile(this->m_bseries, this->m_invert_rdy);
+    this->m_parser.reset();
+    this->m_optimizer.reset();
+    this->m_segmenter.reset();
+    this->update_busy_timing();
+    memset(this->m_busy_latency, 0, sizeof(this->m_busy_latency));
+    this->reset_stats();
+
     if (this->m_driver == DRIVER_SPIDEV) {
         open_spidev(info, device);
+    } else if (this->m_driver == DRIVER_PARALLEL) {
+        open_parallel(info);
     } else {
         open_bcm2835(info, device);
     }
@@ -138,7 +256,17 @@ Napi::Value SPIDriver::open(const Napi::CallbackInfo& info) {
 }
 
 Napi::Value SPIDriver::close(const Napi::CallbackInfo& info) {
-    ::close(this->m_fd);
+    std::lock_guard<std::mutex> lock(s_bus);
+
+    if (this->m_fd != -1 && this->m_driver != DRIVER_SPIDEV &&
+        this->m_rdy_wait == RDY_WAIT_EVENT && this->m_rdy_pin) {
+        bcm2835_gpio_clr_ren(this->m_rdy_pin);
+        bcm2835_gpio_clr_fen(this->m_rdy_pin);
+    }
+    // m_fd is only a real file descriptor for spidev, the other drivers
+    // use it to remember the CS line
+    if (this->m_driver == DRIVER_SPIDEV)
+        ::close(this->m_fd);
     this->m_fd = -1;
 
     return info.This();
@@ -199,15 +327,435 @@ void SPIDriver::do_transfer(const Napi::CallbackInfo& info, bool dma) {
          EXCEPTION("Read and write buffers MUST be the same length");
     }
 
+    this->send(info, write_buffer, read_buffer, MAX(write_length, read_length), dma);
+}
+
+/**
+ * Sends length bytes to the device with the configured driver. Also the
+ * entry point for the native objects (Encoder...) that build their own
+ * buffers.
+ */
+void SPIDriver::send(const Napi::CallbackInfo& info, unsigned char *write_buffer,
+                     unsigned char *read_buffer, size_t length, bool dma) {
+    const char *error = this->transmit(write_buffer, read_buffer, length, dma);
+    if (error) {
+        Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+    }
+}
+
+/**
+ * Sends a native command buffer: bitmap payloads marked as DMA safe by the
+ * CommandBuffer go out without RDY checks, everything else is checked.
+ */
+void SPIDriver::send_commands(const Napi::CallbackInfo& info, CommandBuffer& commands) {
+    const char *error = this->transmit_commands(commands);
+    if (error) {
+        Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+    }
+}
+
+/**
+ * Thread safe version of send(), that returns an error message instead of
+ * throwing. The bus lock keeps the JS thread and native I/O threads (see
+ * Scroller) from interleaving their bytes.
+ */
+const char *SPIDriver::transmit(unsigned char *write_buffer, unsigned char *read_buffer,
+                                size_t length, bool dma) {
+    uint64_t submitted = now_ns();
+    uint32_t depth = this->bus_submitted();
+    std::lock_guard<std::mutex> lock(s_bus);
+    this->bus_acquired(submitted, depth, dma);
+    // DMA payloads and reads are only followed, they go out as given
+    bool checked = write_buffer && !dma && !read_buffer && this->can_rewrite();
+    const char *error;
+
+    if (this->m_optimize && write_buffer) {
+        this->m_optimizer.run(write_buffer, length, this->m_optimized, checked);
+        if (checked) {
+            write_buffer = this->m_optimized.data();
+            length = this->m_optimized.length();
+            if (!length) {
+                this->bus_released(submitted, depth, dma);
+                return NULL;
+            }
+        }
+    }
+    if (this->m_auto_dma && write_buffer) {
+        // Like m_parser, start over if an unknown command made it lose track
+        this->m_segmenter.resync();
+        this->m_segmenter.payloads(write_buffer, length, this->m_segments);
+    }
+
+    if (this->m_auto_dma && checked)
+        error = this->transmit_segments(write_buffer, length, this->m_segments);
+    else
+        error = this->transmit_unlocked(write_buffer, read_buffer, length, dma);
+    if (error) {
+        this->m_optimizer.reset();
+        this->m_segmenter.reset();
+    }
+    this->bus_released(submitted, depth, dma);
+    return error;
+}
+
+/**
+ * Thread safe version of send_commands(). The whole buffer goes out under
+ * the bus lock, so that commands from other threads can't get in between.
+ */
+const char *SPIDriver::transmit_commands(CommandBuffer& commands) {
+    uint64_t submitted = now_ns();
+    uint32_t depth = this->bus_submitted();
+    std::lock_guard<std::mutex> lock(s_bus);
+    this->bus_acquired(submitted, depth, false);
+    CommandBuffer *out = &commands;
+
+    if (this->m_optimize) {
+        bool rewrite = this->can_rewrite();
+        this->m_optimizer.run(commands.data(), commands.length(), this->m_optimized, rewrite);
+        if (rewrite)
+            out = &this->m_optimized;
+    }
+
+    const char *error = this->transmit_segments(out->data(), out->length(), out->dma_segments());
+    // Native buffers end on a command boundary
+    this->m_segmenter.reset();
+    if (error)
+        this->m_optimizer.reset();
+    this->bus_released(submitted, depth, false);
+    return error;
+}
+
+/**
+ * Counts a call waiting for the bus, and returns how many there are
+ * including it. Only the trace shows the count, so returns 0 without
+ * counting when not tracing.
+ */
+uint32_t SPIDriver::bus_submitted() {
+    if (!this->m_tracing.load(std::memory_order_relaxed))
+        return 0;
+    return this->m_pending.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+/**
+ * Accounts for the time a call submitted when depth calls were pending
+ * waited for the bus lock. Called with the lock held.
+ */
+void SPIDriver::bus_acquired(uint64_t submitted, uint32_t depth, bool dma) {
+    uint64_t now = now_ns();
+
+    this->m_queue_latency[dma].record(now - submitted);
+    if (depth && this->m_trace) {
+        this->m_trace->record(TRACE_QUEUE, submitted, submitted, depth, dma);
+        // Only show the waits behind other calls
+        if (depth > 1)
+            this->m_trace->record(TRACE_BUS_WAIT, submitted, now, depth, dma);
+    }
+}
+
+/**
+ * End of a call that got the bus lock, still held. depth is what
+ * bus_submitted() returned, 0 if the call wasn't counted.
+ */
+void SPIDriver::bus_released(uint64_t submitted, uint32_t depth, bool dma) {
+    uint64_t now = now_ns();
+
+    this->m_total_latency[dma].record(now - submitted);
+    if (depth) {
+        depth = this->m_pending.fetch_sub(1, std::memory_order_relaxed) - 1;
+        if (this->m_trace)
+            this->m_trace->record(TRACE_QUEUE, now, now, depth, dma);
+    }
+}
+
+/**
+ * Optimized or split streams may have odd lengths, which 16-bit mode can't
+ * send
+ */
+bool SPIDriver::can_rewrite() const {
+    return this->m_bits_per_word != 16 || this->m_driver == DRIVER_PARALLEL;
+}
+
+/**
+ * Sends a stream, its payload segments without RDY checks when the profile
+ * allows it for their command. Called with the bus lock held.
+ */
+const char *SPIDriver::transmit_segments(uint8_t *data, size_t length,
+                                         const std::vector<CommandBuffer::Segment>& segments) {
+    const char *error = NULL;
+    size_t pos = 0;
+
+    for (const CommandBuffer::Segment& seg : segments) {
+        // Payloads the display can't take without handshake are merged
+        // into the checked part
+        if (!profile_dma_safe(this->m_profile, seg.command))
+            continue;
+        if (seg.start > pos && !error)
+            error = this->transmit_unlocked(data + pos, NULL, seg.start - pos, false);
+        if (!error)
+            error = this->transmit_unlocked(data + seg.start, NULL, seg.end - seg.start, true);
+        pos = seg.end;
+    }
+    if (length > pos && !error)
+        error = this->transmit_unlocked(data + pos, NULL, length - pos, false);
+    return error;
+}
+
+const char *SPIDriver::transmit_unlocked(unsigned char *write_buffer, unsigned char *read_buffer,
+                                         size_t length, bool dma) {
+    int ret = 0;
+
+    if (this->m_fd == -1)
+        return "Device not opened";
+
+    // In 16-bit mode every WR strobe commits a pair of bytes, one per
+    // cascaded 74HC595, so we cannot send a lone trailing byte
+    if (this->m_bits_per_word == 16 && this->m_driver != DRIVER_PARALLEL &&
+        (length & 1)) {
+        return "Buffer length must be even in 16-bit mode";
+    }
+
+    // A command the parser didn't know made it lose track of the stream,
+    // transfers usually start on a command boundary
+    this->m_parser.resync();
+    this->m_dma = dma;
+    uint64_t start = this->m_trace ? now_ns() : 0;
+
+    // The per byte loops are specialized for the display profile, so that
+    // RDY displays don't pay for the BUSY checks and the other way round
     if (this->m_driver == DRIVER_SPIDEV) {
-        this->spidev_transfer(info, write_buffer, read_buffer,
-                                    MAX(write_length, read_length),
+        if (this->m_profile->busy)
+            ret = this->spidev_transfer<true>(write_buffer, read_buffer, length,
                                     this->m_max_speed, this->m_delay, this->m_bits_per_word, dma);
+        else
+            ret = this->spidev_transfer<false>(write_buffer, read_buffer, length,
+                                    this->m_max_speed, this->m_delay, this->m_bits_per_word, dma);
+    } else if (this->m_driver == DRIVER_PARALLEL) {
+        if (write_buffer && this->m_profile->busy)
+            this->parallel_transfer<true>(write_buffer, length, dma);
+        else if (write_buffer)
+            this->parallel_transfer<false>(write_buffer, length, dma);
     } else {
-        this->bcm2835_transfer(info, write_buffer, read_buffer,
-                                    MAX(write_length, read_length),
+        if (this->m_profile->busy)
+            ret = this->bcm2835_transfer<true>(write_buffer, read_buffer, length,
+                                    this->m_max_speed, this->m_delay, this->m_bits_per_word, dma);
+        else
+            ret = this->bcm2835_transfer<false>(write_buffer, read_buffer, length,
                                     this->m_max_speed, this->m_delay, this->m_bits_per_word, dma);
     }
+    this->count_transfer(length, dma, ret != -1);
+    if (this->m_trace)
+        this->m_trace->record(TRACE_TRANSFER, start, now_ns(), length, dma);
+
+    return ret == -1 ? "Unable to send SPI message" : NULL;
+}
+
+/**
+ * Credit based flow control: account for one strobe worth of data in the
+ * estimated display receive buffer, and tell whether RDY has to be checked
+ * before going on.
+ */
+bool SPIDriver::credit_check(const unsigned char *data, size_t count) {
+    uint32_t cost = this->m_drain_time;
+
+    // Text and payloads (where 0x00 is common) are just stored, only the
+    // commands that execute slowly get the high cost
+    for (size_t i = 0; i < count; i++) {
+        if (this->m_parser.feed(data[i]) == NTK_BYTE_SLOW)
+            cost = CREDIT_CONTROL_COST;
+    }
+    this->m_credit_bytes++;
+    this->m_credit_backlog += cost;
+
+    if (this->m_credit_strict)
+        return true;
+    if (this->m_credit_bytes < CREDIT_HIGH_WATER)
+        return false;
+
+    // Only look at the clock when we get close to the high water mark
+    this->credit_drain();
+    return this->m_credit_bytes >= CREDIT_HIGH_WATER;
+}
+
+/**
+ * Start of a transfer with credit flow control. If the last one went
+ * without a mismatch, part of the drain time added by credit_mismatch() is
+ * given back, so that a single burst doesn't slow down the whole session.
+ */
+void SPIDriver::credit_start() {
+    if (!this->m_credit_strict && this->m_drain_time > this->m_drain_base) {
+        this->m_drain_time -= MAX((this->m_drain_time - this->m_drain_base) >> CREDIT_DECAY_SHIFT, 1u);
+    }
+    this->m_credit_strict = false;
+    this->credit_drain();
+}
+
+/**
+ * Updates the buffer occupancy estimate with what the display consumed
+ * since the last update
+ */
+void SPIDriver::credit_drain() {
+    uint64_t now = now_ns();
+    uint64_t elapsed = now - this->m_credit_stamp;
+
+    this->m_credit_stamp = now;
+    if (elapsed >= this->m_credit_backlog) {
+        this->m_credit_bytes = 0;
+        this->m_credit_backlog = 0;
+    } else {
+        this->m_credit_bytes = this->m_credit_bytes *
+            (this->m_credit_backlog - elapsed) / this->m_credit_backlog;
+        this->m_credit_backlog -= elapsed;
+    }
+}
+
+/**
+ * RDY was still BUSY after the settle time: the buffer is full while we
+ * thought it was not. Poll every byte until the end of this transfer, and
+ * be more pessimistic about the drain time from now on.
+ */
+void SPIDriver::credit_mismatch() {
+    if (!this->m_credit_strict) {
+        this->m_credit_strict = true;
+        this->m_drain_time = MAX(this->m_drain_time, 1000) * 2;
+        if (this->m_drain_time > CREDIT_MAX_DRAIN_TIME)
+            this->m_drain_time = CREDIT_MAX_DRAIN_TIME;
+    }
+    this->m_credit_bytes = CREDIT_BUFFER_SIZE;
+    this->m_credit_backlog = (uint64_t)CREDIT_BUFFER_SIZE * this->m_drain_time;
+    this->m_credit_stamp = now_ns();
+}
+
+/**
+ * Waits for the end of a BUSY pulse using the GPIO event detect status
+ * (the edge is latched by the hardware, so short pulses can't be missed
+ * and we don't need a settle delay before looking). If no edge got latched
+ * after the settle time (in ns) and the line says ready, the display
+ * simply never went BUSY.
+ */
+void SPIDriver::bcm2835_wait_event(uint32_t settle) {
+    uint64_t deadline = 0;
+    uint64_t start;
+    uint32_t spins = 0;
+
+    if (bcm2835_gpio_eds(this->m_rdy_pin))
+        return;
+    start = now_ns();
+    while (!bcm2835_gpio_eds(this->m_rdy_pin)) {
+        if ((++spins & 15) == 0) {
+            uint64_t now = now_ns();
+            if (!deadline) {
+                deadline = now + settle;
+            } else if (now > deadline &&
+                       (bcm2835_gpio_lev(this->m_rdy_pin) != 0) != this->m_profile->busy) {
+                break;
+            }
+        }
+    }
+    this->rdy_waited(start, spins);
+}
+
+/**
+ * BUSY rise timeouts in use: the profile ones, unless set by busyTiming()
+ */
+void SPIDriver::update_busy_timing() {
+    for (int i = 0; i < NTK_BYTE_CLASSES; i++) {
+        this->m_busy_ns[i] = this->m_busy_override[i] ?
+            this->m_busy_override[i] : this->m_profile->busy_ns[i];
+    }
+}
+
+/**
+ * Follows one strobe worth of data through the command parser, and tells
+ * which of its bytes can keep the display from raising BUSY the longest
+ */
+uint8_t SPIDriver::busy_class(const unsigned char *data, size_t count) {
+    uint8_t cls = this->m_parser.feed(data[0]);
+
+    for (size_t i = 1; i < count; i++) {
+        uint8_t next = this->m_parser.feed(data[i]);
+        if (this->m_busy_ns[next] > this->m_busy_ns[cls])
+            cls = next;
+    }
+    return cls;
+}
+
+/**
+ * Records how long BUSY took to go up, if it did before the timeout
+ */
+void SPIDriver::busy_seen(uint8_t cls, uint64_t start, uint64_t now) {
+    uint64_t latency = now - start;
+
+    if (latency < this->m_busy_ns[cls] && latency > this->m_busy_latency[cls])
+        this->m_busy_latency[cls] = latency;
+}
+
+/**
+ * Accounts for one wait on the RDY/BUSY line that began at start
+ */
+void SPIDriver::rdy_waited(uint64_t start, uint32_t spins) {
+    uint64_t elapsed = now_ns() - start;
+
+    this->m_wait_ns += elapsed;
+    if (elapsed > this->m_wait_max_ns)
+        this->m_wait_max_ns = elapsed;
+    this->m_wait_spins += spins;
+    this->m_rdy_latency[this->m_dma].record(elapsed);
+    if (this->m_trace)
+        this->m_trace->record(TRACE_RDY_WAIT, start, start + elapsed, spins, this->m_dma);
+}
+
+/**
+ * Adds a finished transfer and its waits to the stats. The bytes of a
+ * failed transfer don't count, the time spent waiting does. resetStats()
+ * doesn't take the bus lock, so the maximum is only replaced if it didn't
+ * change meanwhile.
+ */
+void SPIDriver::count_transfer(size_t length, bool dma, bool sent) {
+    TransferStats& stats = this->m_stats;
+
+    if (sent) {
+        stats.bytes.fetch_add(length, std::memory_order_relaxed);
+        stats.transfers.fetch_add(1, std::memory_order_relaxed);
+        (dma ? stats.dma_bytes : stats.checked_bytes).fetch_add(length, std::memory_order_relaxed);
+    }
+    if (this->m_wait_spins || this->m_wait_ns) {
+        stats.rdy_wait_ns.fetch_add(this->m_wait_ns, std::memory_order_relaxed);
+        stats.rdy_spins.fetch_add(this->m_wait_spins, std::memory_order_relaxed);
+        uint64_t max = stats.rdy_wait_max_ns.load(std::memory_order_relaxed);
+        while (this->m_wait_max_ns > max &&
+               !stats.rdy_wait_max_ns.compare_exchange_weak(max, this->m_wait_max_ns,
+                                                             std::memory_order_relaxed)) {}
+    }
+    if (this->m_delay_ns)
+        stats.delay_ns.fetch_add(this->m_delay_ns, std::memory_order_relaxed);
+
+    this->m_wait_ns = 0;
+    this->m_wait_max_ns = 0;
+    this->m_wait_spins = 0;
+    this->m_delay_ns = 0;
+}
+
+/**
+ * Clears the counters and the latency distributions
+ */
+void SPIDriver::reset_stats() {
+    this->m_stats.reset();
+    for (int dma = 0; dma < 2; dma++) {
+        this->m_queue_latency[dma].reset();
+        this->m_rdy_latency[dma].reset();
+        this->m_total_latency[dma].reset();
+    }
+}
+
+void TransferStats::reset() {
+    bytes.store(0, std::memory_order_relaxed);
+    transfers.store(0, std::memory_order_relaxed);
+    dma_bytes.store(0, std::memory_order_relaxed);
+    checked_bytes.store(0, std::memory_order_relaxed);
+    rdy_wait_ns.store(0, std::memory_order_relaxed);
+    rdy_wait_max_ns.store(0, std::memory_order_relaxed);
+    rdy_spins.store(0, std::memory_order_relaxed);
+    delay_ns.store(0, std::memory_order_relaxed);
 }
 
 /**
@@ -254,6 +802,11 @@ void SPIDriver::open_spidev(const Napi::CallbackInfo& info, const char * device)
     INP_GPIO(this->m_wr_pin);
     OUT_GPIO(this->m_wr_pin);
 
+    if (this->m_latch_pin) {
+        INP_GPIO(this->m_latch_pin);
+        OUT_GPIO(this->m_latch_pin);
+    }
+
     INP_GPIO(this->m_rdy_pin);
     // Enable pulldown on Ready pin:
     GPIO_PULL = 1;
@@ -314,24 +867,85 @@ void SPIDriver::open_bcm2835(const Napi::CallbackInfo& info, const char * device
         this->m_fd = 1;
     }
 
-    // Now setup the GPIOs that are specific to the Noritake screens
+    if (this->m_latch_pin)
+        bcm2835_gpio_fsel(this->m_latch_pin, BCM2835_GPIO_FSEL_OUTP);
 
+    this->setup_bcm2835_gpios();
+}
+
+/**
+ * Sets up the GPIOs that are specific to the Noritake screens (WR and RDY)
+ * on the bcm2835 based drivers
+ */
+void SPIDriver::setup_bcm2835_gpios() {
     if (this->m_wr_pin)
         bcm2835_gpio_fsel(this->m_wr_pin, BCM2835_GPIO_FSEL_OUTP);
 
     if (this->m_rdy_pin) {
         bcm2835_gpio_fsel(this->m_rdy_pin, BCM2835_GPIO_FSEL_INPT);
         bcm2835_gpio_set_pud(this->m_rdy_pin, BCM2835_GPIO_PUD_UP);
+
+        // Arm the edge detector on the transition back to ready
+        if (this->m_rdy_wait == RDY_WAIT_EVENT) {
+            if (this->m_profile->busy) {
+                bcm2835_gpio_fen(this->m_rdy_pin);
+            } else {
+                bcm2835_gpio_ren(this->m_rdy_pin);
+            }
+            bcm2835_gpio_set_eds(this->m_rdy_pin);
+        }
     }
 
 
 }
 
 /**
- * The core of SPI transfers - spidev version
+ * Opens the display directly on the GPIOs (Noritake parallel interface,
+ * no shift register): eight data lines, WR and RDY. The device name is
+ * not used.
+ */
+void SPIDriver::open_parallel(const Napi::CallbackInfo& info) {
+    uint32_t used = 0;
+
+    for (int i = 0; i < 8; i++) {
+        used |= 1u << this->m_data_pins[i];
+    }
+    if (!this->m_wr_pin || !this->m_rdy_pin || this->m_wr_pin > 31 ||
+        this->m_rdy_pin > 31 || __builtin_popcount(used) != 8 ||
+        (used & ((1u << this->m_wr_pin) | (1u << this->m_rdy_pin)))) {
+        EXCEPTION("Parallel driver needs wrPin, rdyPin and eight distinct dataPins");
+        return;
+    }
+
+    if (!bcm2835_init()) {
+        EXCEPTION("bcm2835_init failed. Are you running as root?");
+        return;
+    }
+
+    // Precompute the GPIO set mask for every byte value, so that writing
+    // a byte is a single lookup and a single masked register write
+    this->m_data_mask = used;
+    for (int v = 0; v < 256; v++) {
+        this->m_data_lut[v] = 0;
+        for (int i = 0; i < 8; i++) {
+            if (v & (1 << i))
+                this->m_data_lut[v] |= 1u << this->m_data_pins[i];
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        bcm2835_gpio_fsel(this->m_data_pins[i], BCM2835_GPIO_FSEL_OUTP);
+    }
+    this->setup_bcm2835_gpios();
+    this->m_fd = 0;
+}
+
+/**
+ * The core of SPI transfers - spidev version, specialized for RDY or BUSY
+ * displays
  */
-void SPIDriver::spidev_transfer(
-                const Napi::CallbackInfo& info,
+template <bool BUSY>
+int SPIDriver::spidev_transfer(
                 unsigned char *tx_buf,
                 unsigned char *rx_buf,
                 size_t length,
@@ -341,57 +955,211 @@ void SPIDriver::spidev_transfer(
                 bool dma ) {
 
     int ret =0;
+    size_t step = (bits == 16) ? 2 : 1;
     GPIO_SET = 1 << this->m_wr_pin;
 
     // Don't write anything if the peripheral is not ready
-    if (this->m_invert_rdy) {
-        while(GET_GPIO(this->m_rdy_pin)){};
+    if (BUSY) {
+        WAIT_READY(!GET_GPIO(this->m_rdy_pin));
     } else {
-        while(!GET_GPIO(this->m_rdy_pin)){};
+        WAIT_READY(GET_GPIO(this->m_rdy_pin));
     }
 
-    // Now send byte by byte for the whole buffer
-    while (length--) {
-        // struct timeval tNow,tEnd ;
-        // gettimeofday (&tNow, NULL);
-        if (this->m_wr_pin) {
-            GPIO_CLR = 1 << this->m_wr_pin;
+    if (this->m_flow_control == FLOW_CREDIT)
+        this->credit_start();
+
+    if (this->m_latch_pin) {
+        // Pipelined mode, see latchPin. The write() syscall alone takes
+        // longer than the RDY settle time, so no need to wait on top of it.
+        GPIO_CLR = 1 << this->m_latch_pin;
+        // Nothing to shift ahead for an empty transfer
+        if (length)
+            ret = this->spidev_shift(tx_buf, step);
+        while (length) {
+            if (this->m_wr_pin) {
+                GPIO_CLR = 1 << this->m_wr_pin;
+            }
+            GPIO_SET = 1 << this->m_latch_pin;
+            GPIO_CLR = 1 << this->m_latch_pin;
+            if (this->m_wr_pin) {
+                GPIO_SET = 1 << this->m_wr_pin;
+            }
+            tx_buf += step;
+            length -= step;
+
+            // Shift the next byte while the display stores this one
+            if (length && this->spidev_shift(tx_buf, step) == -1)
+                ret = -1;
+
+            this->spidev_wait_rdy<BUSY>(tx_buf - step, step, dma, true);
         }
-        ret = write(this->m_fd, tx_buf++, 1);
-        // gettimeofday (&tEnd, NULL);
-        // printf("Took %lu\n", tEnd.tv_usec-tNow.tv_usec);
-
-        if (this->m_wr_pin) {
-            GPIO_SET = 1 << this->m_wr_pin;
+    } else {
+        // Now send byte by byte for the whole buffer (or two bytes
+        // per strobe in 16-bit mode)
+        while (length) {
+            // struct timeval tNow,tEnd ;
+            // gettimeofday (&tNow, NULL);
+            if (this->m_wr_pin) {
+                GPIO_CLR = 1 << this->m_wr_pin;
+            }
+            ret = this->spidev_shift(tx_buf, step);
+            tx_buf += step;
+            length -= step;
+            // gettimeofday (&tEnd, NULL);
+            // printf("Took %lu\n", tEnd.tv_usec-tNow.tv_usec);
+
+            if (this->m_wr_pin) {
+                GPIO_SET = 1 << this->m_wr_pin;
+            }
+
+            this->spidev_wait_rdy<BUSY>(tx_buf - step, step, dma, false);
         }
+    }
+
+  return ret;
+}
 
-        if (this->m_invert_rdy) {
-            //For Series 7000 displays, the busy pin (spec says 20us max!)
-            // can take a while to go up, so we have to add this delay. 10us
-            // works well in practice.
-            delayMicrosecondsHard(10); 
-            while(GET_GPIO(this->m_rdy_pin)){};
-        } else if (!dma) {
-            // The RDY line can take up to 500ns to do down,
-            // so we need to wait before reading it:
-            delayMicrosecondsHard(1); 
-            while(!GET_GPIO(this->m_rdy_pin)){};
+/**
+ * Shifts one strobe worth of data (one byte, or two in 16-bit mode)
+ * through spidev
+ */
+int SPIDriver::spidev_shift(const unsigned char *data, size_t count) {
+    if (count == 2) {
+        // spidev sends 16-bit words in native byte order, swap so
+        // that data[0] is still the first byte on the wire
+        uint16_t word = (data[0] << 8) | data[1];
+        return write(this->m_fd, &word, 2);
+    }
+    return write(this->m_fd, data, 1);
+}
+
+/**
+ * Waits for the display after a WR strobe - spidev version. settled tells
+ * that enough time went by since the strobe for RDY to have gone down.
+ */
+template <bool BUSY>
+void SPIDriver::spidev_wait_rdy(const unsigned char *data, size_t count, bool dma, bool settled) {
+    if (BUSY) {
+        // BUSY can take a while to go up, how long depends on what the
+        // display does with the byte, see the profile. No pulse after that
+        // means the byte didn't make the display busy.
+        uint8_t cls = this->busy_class(data, count);
+        uint64_t start = now_ns();
+        uint64_t deadline = start + this->m_busy_ns[cls];
+        uint64_t now = start;
+        uint32_t spins = 0;
+
+        while (!GET_GPIO(this->m_rdy_pin) && (now = now_ns()) < deadline) { spins++; };
+        this->busy_seen(cls, start, now);
+        while(GET_GPIO(this->m_rdy_pin)){ spins++; };
+        this->rdy_waited(start, spins);
+    } else if (this->m_flow_control == FLOW_CREDIT) {
+        // Bitmap data still fills the receive buffer, so account
+        // for it even in DMA mode
+        if (this->credit_check(data, count) && !dma) {
+            if (!settled) {
+                delayNanosecondsHard(this->m_profile->settle_ns);
+                this->m_delay_ns += this->m_profile->settle_ns;
+            }
+            if (!GET_GPIO(this->m_rdy_pin)) {
+                this->credit_mismatch();
+                WAIT_READY(GET_GPIO(this->m_rdy_pin));
+            }
         }
-    
-        //data.tx_buf++;
+    } else if (!dma) {
+        // The RDY line takes a while to go down, so we need to wait
+        // before reading it:
+        if (!settled) {
+            delayNanosecondsHard(this->m_profile->settle_ns);
+            this->m_delay_ns += this->m_profile->settle_ns;
+        }
+        WAIT_READY(GET_GPIO(this->m_rdy_pin));
+    }
+}
+
+/**
+ * Gets the bcm2835 GPIOs ready for a new transfer: WR high, and the display
+ * ready to accept data.
+ */
+template <bool BUSY>
+void SPIDriver::bcm2835_wait_idle() {
+    if (this->m_wr_pin)
+        bcm2835_gpio_write(this->m_wr_pin,HIGH);
+
+    // Don't write anything if the peripheral is not ready
+    if (BUSY) {
+        WAIT_READY(!bcm2835_gpio_lev(this->m_rdy_pin));
+    } else {
+        WAIT_READY(bcm2835_gpio_lev(this->m_rdy_pin));
     }
 
-  if (ret == -1) {
-    EXCEPTION("Unable to send SPI message");
-  }
+    if (this->m_flow_control == FLOW_CREDIT)
+        this->credit_start();
+}
 
+/**
+ * Waits for the display after a WR strobe on the GPIOs driven by the
+ * bcm2835 library (shared by the bcm2835 and parallel drivers). data and
+ * count describe what was just written, for the flow control model, and
+ * settled tells that enough time went by since the strobe for RDY to have
+ * gone down.
+ */
+template <bool BUSY>
+void SPIDriver::bcm2835_wait_rdy(const unsigned char *data, size_t count, bool dma, bool settled) {
+    uint32_t settle = this->m_profile->settle_ns;
+
+    if (BUSY) {
+        // BUSY can take a while to go up, how long depends on what the
+        // display does with the byte, see the profile. No pulse after that
+        // means the byte didn't make the display busy.
+        uint8_t cls = this->busy_class(data, count);
+        if (this->m_rdy_wait == RDY_WAIT_EVENT) {
+            this->bcm2835_wait_event(this->m_busy_ns[cls]);
+        } else {
+            uint64_t start = now_ns();
+            uint64_t deadline = start + this->m_busy_ns[cls];
+            uint64_t now = start;
+            uint32_t spins = 0;
+
+            while (!bcm2835_gpio_lev(this->m_rdy_pin) && (now = now_ns()) < deadline) { spins++; };
+            this->busy_seen(cls, start, now);
+            while(bcm2835_gpio_lev(this->m_rdy_pin)) { spins++; };
+            this->rdy_waited(start, spins);
+        }
+    } else if (this->m_flow_control == FLOW_CREDIT) {
+        // Bitmap data still fills the receive buffer, so account
+        // for it even in DMA mode
+        if (this->credit_check(data, count) && !dma) {
+            if (!settled) {
+                delayNanosecondsHard(settle);
+                this->m_delay_ns += settle;
+            }
+            if (!bcm2835_gpio_lev(this->m_rdy_pin)) {
+                this->credit_mismatch();
+                WAIT_READY(bcm2835_gpio_lev(this->m_rdy_pin));
+            }
+        }
+    } else if (! dma ) {
+        if (this->m_rdy_wait == RDY_WAIT_EVENT) {
+            this->bcm2835_wait_event(settle);
+        } else {
+            // The RDY line takes a while to go down, so we need to wait
+            // before reading it:
+            if (!settled) {
+                delayNanosecondsHard(settle);
+                this->m_delay_ns += settle;
+            }
+            WAIT_READY(bcm2835_gpio_lev(this->m_rdy_pin));
+        }
+    }
 }
 
 /**
- * The core of SPI transfers - BCM2835 version
+ * The core of SPI transfers - BCM2835 version, specialized for RDY or BUSY
+ * displays
  */
-void SPIDriver::bcm2835_transfer(
-                const Napi::CallbackInfo& info,
+template <bool BUSY>
+int SPIDriver::bcm2835_transfer(
                 unsigned char *tx_buf,
                 unsigned char *rx_buf,
                 size_t length,
@@ -401,59 +1169,121 @@ void SPIDriver::bcm2835_transfer(
                 bool dma ) {
 
     int ret =0;
+    size_t step = (bits == 16) ? 2 : 1;
 
     // Since we can have multiple instances of SPI, we have to reset
     // the peripheral before each transfer since they can all have different
     // speed values and CS line selection
+    uint64_t setup = this->m_trace ? now_ns() : 0;
     bcm2835_spi_set_speed_hz(speed);
-    if (this->m_fd) {
+    if (this->m_latch_pin) {
+        bcm2835_spi_chipSelect(BCM2835_SPI_CS_NONE);
+    } else if (this->m_fd) {
         bcm2835_spi_chipSelect(BCM2835_SPI_CS1);
     } else {
         bcm2835_spi_chipSelect(BCM2835_SPI_CS0);
     }
-
-    if (this->m_wr_pin)
-        bcm2835_gpio_write(this->m_wr_pin,HIGH);
-
-    // Don't write anything if the peripheral is not ready
-    if (this->m_invert_rdy) {
-        while(bcm2835_gpio_lev(this->m_rdy_pin)) {};
-    } else {
-        while(! bcm2835_gpio_lev(this->m_rdy_pin)) {};
+    if (this->m_trace)
+        this->m_trace->record(TRACE_BUS_SETUP, setup, now_ns(), speed, dma);
+
+    this->bcm2835_wait_idle<BUSY>();
+
+    if (this->m_latch_pin) {
+        // Pipelined mode, see latchPin. Shifting 8 bits takes at least
+        // the 500ns RDY fall time up to 16MHz, in which case we don't need
+        // the settle delay on top of it.
+        bool settled = speed <= 16000000;
+
+        bcm2835_gpio_clr(this->m_latch_pin);
+        // Nothing to shift ahead for an empty transfer
+        if (length)
+            this->bcm2835_shift(tx_buf, step);
+        while (length) {
+            if (this->m_rdy_wait == RDY_WAIT_EVENT) {
+                bcm2835_gpio_set_eds(this->m_rdy_pin);
+            }
+            if (this->m_wr_pin) {
+                bcm2835_gpio_clr(this->m_wr_pin);
+            }
+            bcm2835_gpio_set(this->m_latch_pin);
+            bcm2835_gpio_clr(this->m_latch_pin);
+            if (this->m_wr_pin) {
+                bcm2835_gpio_set(this->m_wr_pin);
+            }
+            tx_buf += step;
+            length -= step;
+
+            // Shift the next byte while the display stores this one
+            if (length)
+                this->bcm2835_shift(tx_buf, step);
+
+            this->bcm2835_wait_rdy<BUSY>(tx_buf - step, step, dma, settled);
+        }
+        return ret;
     }
 
     // Now send byte by byte for the whole buffer and check
     // the busy/ready signal at each byte if necessary, and also
-    // toggle the !WRITE signal if necessary
-    while (length--) {
+    // toggle the !WRITE signal if necessary. In 16-bit mode both
+    // bytes are shifted within a single CS cycle so that the two
+    // cascaded 74HC595 latch together, then share one WR strobe.
+    while (length) {
+        if (this->m_rdy_wait == RDY_WAIT_EVENT) {
+            bcm2835_gpio_set_eds(this->m_rdy_pin);
+        }
         if (this->m_wr_pin) {
             bcm2835_gpio_clr(this->m_wr_pin);
         }
-        ret = bcm2835_spi_transfer(*tx_buf);
-        tx_buf++;
+        ret = this->bcm2835_shift(tx_buf, step);
+        tx_buf += step;
+        length -= step;
 
         if (this->m_wr_pin) {
             bcm2835_gpio_set(this->m_wr_pin);
         }
 
-        if (this->m_invert_rdy) {
-            //For Series 7000 displays, the busy pin (spec says 20us max!)
-            // can take a while to go up, so we have to add this delay. 10us
-            // works well in practice.
-            delayMicrosecondsHard(10); 
-            while(bcm2835_gpio_lev(this->m_rdy_pin)) {};
-        } else if (! dma ) {
-            // The RDY line can take up to 500ns to do down,
-            // so we need to wait before reading it:
-            delayMicrosecondsHard(1); 
-            while(!bcm2835_gpio_lev(this->m_rdy_pin)) {};
-        }
+        this->bcm2835_wait_rdy<BUSY>(tx_buf - step, step, dma, false);
     }
 
-  if (ret == -1) {
-    EXCEPTION("Unable to send SPI message");
-  }
+  return ret;
+}
 
+/**
+ * Shifts one strobe worth of data (one byte, or two in 16-bit mode)
+ * through the bcm2835 SPI peripheral
+ */
+int SPIDriver::bcm2835_shift(const unsigned char *data, size_t count) {
+    if (count == 2) {
+        bcm2835_spi_write((data[0] << 8) | data[1]);
+        return 0;
+    }
+    return bcm2835_spi_transfer(*data);
+}
+
+/**
+ * The core of transfers - direct parallel GPIO version. The byte is put on
+ * the eight data lines with a single masked set/clear while WR is low, the
+ * display latches it on the WR rising edge.
+ */
+template <bool BUSY>
+void SPIDriver::parallel_transfer(
+                unsigned char *tx_buf,
+                size_t length,
+                bool dma ) {
+
+    this->bcm2835_wait_idle<BUSY>();
+
+    while (length--) {
+        if (this->m_rdy_wait == RDY_WAIT_EVENT) {
+            bcm2835_gpio_set_eds(this->m_rdy_pin);
+        }
+        bcm2835_gpio_clr(this->m_wr_pin);
+        bcm2835_gpio_write_mask(this->m_data_lut[*tx_buf], this->m_data_mask);
+        bcm2835_gpio_set(this->m_wr_pin);
+
+        this->bcm2835_wait_rdy<BUSY>(tx_buf, 1, dma, false);
+        tx_buf++;
+    }
 }
 
 Napi::Value SPIDriver::mode(const Napi::CallbackInfo& info) {
@@ -501,7 +1331,12 @@ Napi::Value SPIDriver::chipSelect(const Napi::CallbackInfo& info) {
     }
 }
 
-
+/**
+ * Bits per word. Setting 16 enables the wide mode for two cascaded
+ * 74HC595s: each WR strobe then commits two consecutive bytes of the
+ * buffer (the first one ends up in the far register), which lets a
+ * single strobe drive two displays, or one byte plus control lines.
+ */
 Napi::Value SPIDriver::bitsPerWord(const Napi::CallbackInfo& info) {
     if (info.Length() > 0 && info[0].IsNumber()) {
         uint32_t in_value = info[0].As<Napi::Number>().Uint32Value();
@@ -581,7 +1416,9 @@ Napi::Value SPIDriver::invertRdy(const Napi::CallbackInfo& info) {
 }
 
 /**
- * Specific to Noritake VFD screen support
+ * Specific to Noritake VFD screen support: selects the GU-3900B protocol
+ * and timing profile instead of the GU-3900 one when the device is opened
+ * (see profile())
  */
 Napi::Value SPIDriver::bSeries(const Napi::CallbackInfo& info) {
     if (info.Length() > 0 && info[0].IsBoolean()) {
@@ -666,6 +1503,8 @@ Napi::Value SPIDriver::driver(const Napi::CallbackInfo& info) {
         ASSERT_NOT_OPEN;
         if (in_value == DRIVER_SPIDEV) {
             this->m_driver = DRIVER_SPIDEV;
+        } else if (in_value == DRIVER_PARALLEL) {
+            this->m_driver = DRIVER_PARALLEL;
         } else {
             this->m_driver = DRIVER_BCM2835;
         }
@@ -674,3 +1513,386 @@ Napi::Value SPIDriver::driver(const Napi::CallbackInfo& info) {
         return Napi::Number::New(info.Env(), this->m_driver);
     }
 }
+
+/**
+ * flowControl picks how often RDY is checked. FLOW_STRICT checks it after
+ * every byte. FLOW_CREDIT tracks an estimate of the display receive buffer
+ * occupancy (see rdyPin) and only checks RDY when the buffer may be close
+ * to full, so that most bytes go out back to back.
+ */
+Napi::Value SPIDriver::flowControl(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        uint32_t in_value = info[0].As<Napi::Number>().Uint32Value();
+        ASSERT_NOT_OPEN;
+        if (in_value == FLOW_CREDIT) {
+            this->m_flow_control = FLOW_CREDIT;
+        } else {
+            this->m_flow_control = FLOW_STRICT;
+        }
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), this->m_flow_control);
+    }
+}
+
+/**
+ * Estimated time in ns the display needs to consume one character or
+ * bitmap byte from its receive buffer, used by FLOW_CREDIT. Slow commands
+ * (clear, scroll, initialize...) are always costed much higher. The
+ * estimate is doubled every time the display turns out to be slower than
+ * expected, and goes back toward the set value while it keeps up.
+ */
+Napi::Value SPIDriver::drainTime(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        uint32_t in_value = info[0].As<Napi::Number>().Uint32Value();
+        ASSERT_NOT_OPEN;
+        this->m_drain_time = in_value;
+        this->m_drain_base = in_value;
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), this->m_drain_time);
+    }
+}
+
+/**
+ * rdyWait picks how we wait for RDY on the bcm2835 driver. RDY_WAIT_POLL
+ * sleeps for the settle time then samples the line. RDY_WAIT_EVENT arms
+ * the GPIO edge detector at open time and waits for the latched end of
+ * the BUSY pulse instead. The credit flow control checkpoints always
+ * sample the line since they need to tell a full buffer from the normal
+ * per-byte BUSY pulse. Ignored by the spidev driver.
+ */
+Napi::Value SPIDriver::rdyWait(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        uint32_t in_value = info[0].As<Napi::Number>().Uint32Value();
+        ASSERT_NOT_OPEN;
+        if (in_value == RDY_WAIT_EVENT) {
+            this->m_rdy_wait = RDY_WAIT_EVENT;
+        } else {
+            this->m_rdy_wait = RDY_WAIT_POLL;
+        }
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), this->m_rdy_wait);
+    }
+}
+
+/**
+ * GPIOs used for D0..D7 by the parallel driver, as an array of eight pin
+ * numbers. They have to be in the first GPIO bank (0-31) so that a byte can
+ * be written with a single masked register access.
+ */
+Napi::Value SPIDriver::dataPins(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsArray()) {
+        Napi::Array in_value = info[0].As<Napi::Array>();
+        ASSERT_NOT_OPEN;
+        if (in_value.Length() != 8) {
+            EXCEPTION("Argument 1 must be an array of 8 GPIO numbers");
+            return info.This();
+        }
+        for (uint32_t i = 0; i < 8; i++) {
+            Napi::Value pin = in_value.Get(i);
+            if (!pin.IsNumber() || pin.As<Napi::Number>().Uint32Value() > 31) {
+                EXCEPTION("Data pins must be GPIOs between 0 and 31");
+                return info.This();
+            }
+        }
+        for (uint32_t i = 0; i < 8; i++) {
+            this->m_data_pins[i] = in_value.Get(i).As<Napi::Number>().Uint32Value();
+        }
+        return info.This();
+    } else {
+        Napi::Array pins = Napi::Array::New(info.Env(), 8);
+        for (uint32_t i = 0; i < 8; i++) {
+            pins.Set(i, Napi::Number::New(info.Env(), this->m_data_pins[i]));
+        }
+        return pins;
+    }
+}
+
+/**
+ * Pipelined mode for the shift register drivers: when set, latchPin drives
+ * the 74HC595 storage register clock (RCLK) instead of the SPI CS line.
+ * Since the 74HC595 has separate shift and storage registers, the next
+ * byte is then shifted in while the display is still BUSY with the
+ * current one, and only latched to the outputs once RDY is back. This
+ * hides most of the SPI clocking time behind the display busy time.
+ */
+Napi::Value SPIDriver::latchPin(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        uint32_t in_value = info[0].As<Napi::Number>().Uint32Value();
+        ASSERT_NOT_OPEN;
+        this->m_latch_pin = in_value;
+        return info.This();
+    } else {
+        return Napi::Number::New(info.Env(), this->m_latch_pin);
+    }
+}
+
+/**
+ * Name of the display profile in use, selected at open time from bSeries
+ * and invertRdy (7000 series). Before open, the one that would be used.
+ */
+Napi::Value SPIDriver::profile(const Napi::CallbackInfo& info) {
+    const DisplayProfile *profile = this->m_profile;
+
+    if (this->m_fd == -1)
+        profile = display_profile(this->m_bseries, this->m_invert_rdy);
+    return Napi::String::New(info.Env(), profile->name);
+}
+
+static const char *busy_classes[NTK_BYTE_CLASSES] = { "text", "param", "data", "end", "slow" };
+
+/**
+ * BUSY displays: how long to wait for BUSY to go up after each byte, in
+ * ns, per kind of byte: text (characters), param (command selectors and
+ * parameters), data (image payloads), end (last byte of a command) and
+ * slow (last byte of a command that takes long, like clear or scroll).
+ * Defaults come from the profile, busyTiming({ data: 1500 }) overrides
+ * some of them, 0 goes back to the profile value. Too short values lose
+ * bytes, see busyLatency() to tune them. Can be changed while open.
+ */
+Napi::Value SPIDriver::busyTiming(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsObject()) {
+        Napi::Object in_value = info[0].As<Napi::Object>();
+        std::lock_guard<std::mutex> lock(s_bus);
+        for (int i = 0; i < NTK_BYTE_CLASSES; i++) {
+            Napi::Value ns = in_value.Get(busy_classes[i]);
+            if (ns.IsNumber())
+                this->m_busy_override[i] = ns.As<Napi::Number>().Uint32Value();
+        }
+        this->update_busy_timing();
+        return info.This();
+    } else {
+        const DisplayProfile *profile = this->m_profile;
+        if (this->m_fd == -1)
+            profile = display_profile(this->m_bseries, this->m_invert_rdy);
+
+        Napi::Object timing = Napi::Object::New(info.Env());
+        for (int i = 0; i < NTK_BYTE_CLASSES; i++) {
+            uint32_t ns = this->m_busy_override[i] ?
+                this->m_busy_override[i] : profile->busy_ns[i];
+            timing.Set(busy_classes[i], Napi::Number::New(info.Env(), ns));
+        }
+        return timing;
+    }
+}
+
+/**
+ * Longest time BUSY took to go up since open, in ns, per kind of byte (see
+ * busyTiming()). 0 when it never went up in time. Only measured when
+ * polling the line (RDY_WAIT_POLL).
+ */
+Napi::Value SPIDriver::busyLatency(const Napi::CallbackInfo& info) {
+    std::lock_guard<std::mutex> lock(s_bus);
+    Napi::Object latency = Napi::Object::New(info.Env());
+
+    for (int i = 0; i < NTK_BYTE_CLASSES; i++) {
+        latency.Set(busy_classes[i], Napi::Number::New(info.Env(), this->m_busy_latency[i]));
+    }
+    return latency;
+}
+
+/**
+ * optimize(true): runs every transfer through a peephole pass that drops
+ * the commands changing nothing on the display (cursor set where it
+ * already is, font or window selected again...) and merges side by side
+ * bit images. DMA transfers and transfers with a read buffer are only
+ * followed. Turning it on forgets the display state and the counters, to
+ * be done again if the display was reset behind the driver's back.
+ */
+Napi::Value SPIDriver::optimize(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsBoolean()) {
+        std::lock_guard<std::mutex> lock(s_bus);
+        this->m_optimize = info[0].As<Napi::Boolean>().Value();
+        this->m_optimizer.reset();
+        this->m_optimizer.clear_stats();
+        return info.This();
+    } else {
+        return Napi::Boolean::New(info.Env(), this->m_optimize);
+    }
+}
+
+/**
+ * Bytes given to and sent by the optimizer, commands it dropped and bit
+ * images it merged, see optimize()
+ */
+Napi::Value SPIDriver::optimizerStats(const Napi::CallbackInfo& info) {
+    std::lock_guard<std::mutex> lock(s_bus);
+    return Optimizer::stats(info.Env(), this->m_optimizer);
+}
+
+/**
+ * autoDma(false): transfer() sends every byte with RDY checks. By default
+ * the stream is parsed, and the bit image payloads the display profile can
+ * take without handshake go out in DMA mode, as if they had been split by
+ * hand between transfer() and dmaTransfer(). Commands may span transfers.
+ */
+Napi::Value SPIDriver::autoDma(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsBoolean()) {
+        std::lock_guard<std::mutex> lock(s_bus);
+        this->m_auto_dma = info[0].As<Napi::Boolean>().Value();
+        this->m_segmenter.reset();
+        return info.This();
+    } else {
+        return Napi::Boolean::New(info.Env(), this->m_auto_dma);
+    }
+}
+
+/**
+ * Bus usage since open or resetStats(): bytes sent (with or without RDY
+ * checks), transfers on the bus (a transfer() split around DMA payloads
+ * counts several), time waiting for RDY/BUSY in total and at most once,
+ * line polls while waiting and time in settle delays, in ns. Does not
+ * wait for a transfer in progress.
+ */
+Napi::Value SPIDriver::stats(const Napi::CallbackInfo& info) {
+    const TransferStats& stats = this->m_stats;
+    Napi::Object result = Napi::Object::New(info.Env());
+
+#define STAT(NAME, FIELD) result.Set(NAME, Napi::Number::New(info.Env(), \
+            (double)stats.FIELD.load(std::memory_order_relaxed)))
+    STAT("bytes", bytes);
+    STAT("transfers", transfers);
+    STAT("dmaBytes", dma_bytes);
+    STAT("checkedBytes", checked_bytes);
+    STAT("rdyWaitNs", rdy_wait_ns);
+    STAT("rdyWaitMaxNs", rdy_wait_max_ns);
+    STAT("rdySpins", rdy_spins);
+    STAT("delayNs", delay_ns);
+#undef STAT
+    return result;
+}
+
+/**
+ * Sets all the stats() counters back to 0, and empties the latency()
+ * distributions
+ */
+Napi::Value SPIDriver::resetStats(const Napi::CallbackInfo& info) {
+    this->reset_stats();
+    return info.This();
+}
+
+/**
+ * Summary of a latency distribution: count, min, max and mean, and the
+ * asked percentiles keyed by percent
+ */
+static Napi::Object latency_summary(Napi::Env env, const LatencyHistogram& histogram,
+                                    const std::vector<double>& percents) {
+    Napi::Object summary = Napi::Object::New(env);
+    Napi::Object percentiles = Napi::Object::New(env);
+    uint64_t count = histogram.count();
+
+    summary.Set("count", Napi::Number::New(env, (double)count));
+    summary.Set("min", Napi::Number::New(env, count ? (double)histogram.min() : 0));
+    summary.Set("max", Napi::Number::New(env, (double)histogram.max()));
+    summary.Set("mean", Napi::Number::New(env, histogram.mean()));
+    for (double percent : percents) {
+        // Keyed as JS would print the number, not as an array index
+        Napi::Value key = Napi::Number::New(env, percent);
+        percentiles.Set(key, Napi::Number::New(env, (double)histogram.percentile(percent)));
+    }
+    summary.Set("percentiles", percentiles);
+    return summary;
+}
+
+/**
+ * latency([percents]): latency distributions since open or resetStats(),
+ * in ns, for checked and DMA transfers: queue (waiting for the bus lock
+ * behind other threads), rdyWait (each wait for RDY/BUSY that the display
+ * did not answer right away) and total (submission to last byte). The
+ * percentiles default to 50, 90, 99 and 99.9, and are about 3% precise.
+ */
+Napi::Value SPIDriver::latency(const Napi::CallbackInfo& info) {
+    std::vector<double> percents = { 50, 90, 99, 99.9 };
+
+    if (info.Length() > 0 && info[0].IsArray()) {
+        Napi::Array array = info[0].As<Napi::Array>();
+        percents.clear();
+        for (uint32_t i = 0; i < array.Length(); i++) {
+            Napi::Value percent = array.Get(i);
+            if (!percent.IsNumber()) {
+                EXCEPTION("Percentiles must be numbers");
+                return info.Env().Undefined();
+            }
+            percents.push_back(percent.As<Napi::Number>().DoubleValue());
+        }
+    }
+
+    const struct {
+        const char *name;
+        const LatencyHistogram *histograms;
+    } metrics[] = {
+        { "queue", this->m_queue_latency },
+        { "rdyWait", this->m_rdy_latency },
+        { "total", this->m_total_latency },
+    };
+    Napi::Object result = Napi::Object::New(info.Env());
+
+    for (const auto& metric : metrics) {
+        Napi::Object kinds = Napi::Object::New(info.Env());
+        kinds.Set("checked", latency_summary(info.Env(), metric.histograms[0], percents));
+        kinds.Set("dma", latency_summary(info.Env(), metric.histograms[1], percents));
+        result.Set(metric.name, kinds);
+    }
+    return result;
+}
+
+/**
+ * trace(bytes): records the last transfers, RDY waits, bus waits and setups
+ * and the bus queue depth in a ring of that many bytes (true: 256KB, 64MB
+ * at most), for chromeTrace(). trace(0) or trace(false) stops and frees it,
+ * tracing then costs a pointer check per transfer and per RDY wait.
+ * Returns the ring size in bytes, 0 when not tracing.
+ */
+Napi::Value SPIDriver::trace(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && (info[0].IsBoolean() || info[0].IsNumber())) {
+        size_t bytes;
+        if (info[0].IsBoolean())
+            bytes = info[0].As<Napi::Boolean>().Value() ? TRACE_DEFAULT_BYTES : 0;
+        else
+            bytes = info[0].As<Napi::Number>().Uint32Value();
+        if (bytes && bytes < sizeof(TraceEvent)) {
+            EXCEPTION("Trace buffer too small");
+            return info.This();
+        }
+        if (bytes > TRACE_MAX_BYTES) {
+            EXCEPTION("Trace buffer must be 64MB at most");
+            return info.This();
+        }
+
+        // Allocated and freed outside the bus lock, only swapped under it
+        std::unique_ptr<TraceBuffer> trace;
+        if (bytes)
+            trace.reset(new TraceBuffer(bytes / sizeof(TraceEvent)));
+        {
+            std::lock_guard<std::mutex> lock(s_bus);
+            this->m_trace.swap(trace);
+            this->m_tracing.store(bytes != 0, std::memory_order_relaxed);
+        }
+        return info.This();
+    } else {
+        std::lock_guard<std::mutex> lock(s_bus);
+        size_t bytes = this->m_trace ? this->m_trace->capacity() * sizeof(TraceEvent) : 0;
+        return Napi::Number::New(info.Env(), bytes);
+    }
+}
+
+/**
+ * Traced events as a Chrome trace event format JSON string, to be saved
+ * in a file and opened in Perfetto or chrome://tracing. Times come from
+ * CLOCK_MONOTONIC, in us. The ring is copied under the bus lock and
+ * formatted after, to not hold up transfers from other threads.
+ */
+Napi::Value SPIDriver::chromeTrace(const Napi::CallbackInfo& info) {
+    TraceBuffer events(0);
+    std::string json;
+
+    {
+        std::lock_guard<std::mutex> lock(s_bus);
+        if (this->m_trace)
+            events = *this->m_trace;
+    }
+    events.chrome_json(json);
+    return Napi::String::New(info.Env(), json);
+}
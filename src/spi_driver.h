@@ -1,9 +1,26 @@
 #pragma once
 
 #include <napi.h>
+#include <time.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "noritake.h"
+#include "profile.h"
+#include "histogram.h"
+#include "trace.h"
 
 #define DRIVER_SPIDEV 0
 #define DRIVER_BCM2835 1
+#define DRIVER_PARALLEL 2
+
+#define FLOW_STRICT 0
+#define FLOW_CREDIT 1
+
+#define RDY_WAIT_POLL 0
+#define RDY_WAIT_EVENT 1
 
 #define BCM2708_PERI_BASE        0x3F000000
 #define GPIO_BASE                (BCM2708_PERI_BASE + 0x200000) /* GPIO controller */
@@ -23,6 +40,24 @@
 #define GPIO_PULL *(gpio+37) // Pull up/pull down
 #define GPIO_PULLCLK0 *(gpio+38) // Pull up/pull down clock
 
+/**
+ * Bus usage counters. Transfers add to them once at their end with relaxed
+ * atomics, so that they can be read without taking the bus lock.
+ */
+struct TransferStats {
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> transfers;
+    std::atomic<uint64_t> dma_bytes;      // Sent without RDY checks
+    std::atomic<uint64_t> checked_bytes;
+    std::atomic<uint64_t> rdy_wait_ns;    // Spent waiting for RDY/BUSY
+    std::atomic<uint64_t> rdy_wait_max_ns;
+    std::atomic<uint64_t> rdy_spins;      // Polls of the line while waiting
+    std::atomic<uint64_t> delay_ns;       // Spent in settle delays
+
+    TransferStats() { reset(); }
+    void reset();
+};
+
 class SPIDriver : public Napi::ObjectWrap<SPIDriver> {
     public:
         SPIDriver(const Napi::CallbackInfo& info);
@@ -46,14 +81,68 @@ class SPIDriver : public Napi::ObjectWrap<SPIDriver> {
         Napi::Value bitOrder(const Napi::CallbackInfo& info);
         Napi::Value halfDuplex(const Napi::CallbackInfo& info);
         Napi::Value driver(const Napi::CallbackInfo& info);
+        Napi::Value flowControl(const Napi::CallbackInfo& info);
+        Napi::Value drainTime(const Napi::CallbackInfo& info);
+        Napi::Value rdyWait(const Napi::CallbackInfo& info);
+        Napi::Value dataPins(const Napi::CallbackInfo& info);
+        Napi::Value latchPin(const Napi::CallbackInfo& info);
+        Napi::Value profile(const Napi::CallbackInfo& info);
+        Napi::Value busyTiming(const Napi::CallbackInfo& info);
+        Napi::Value busyLatency(const Napi::CallbackInfo& info);
+        Napi::Value optimize(const Napi::CallbackInfo& info);
+        Napi::Value optimizerStats(const Napi::CallbackInfo& info);
+        Napi::Value autoDma(const Napi::CallbackInfo& info);
+        Napi::Value stats(const Napi::CallbackInfo& info);
+        Napi::Value resetStats(const Napi::CallbackInfo& info);
+        Napi::Value latency(const Napi::CallbackInfo& info);
+        Napi::Value trace(const Napi::CallbackInfo& info);
+        Napi::Value chromeTrace(const Napi::CallbackInfo& info);
+
+        void send(const Napi::CallbackInfo& info, unsigned char *write, unsigned char *read, size_t length, bool dma);
+        void send_commands(const Napi::CallbackInfo& info, CommandBuffer& commands);
+        // Same without JS exceptions, for native threads: NULL or an error
+        const char *transmit(unsigned char *write, unsigned char *read, size_t length, bool dma);
+        const char *transmit_commands(CommandBuffer& commands);
+        static SPIDriver *FromValue(Napi::Value value);
+        uint32_t speed() const { return m_max_speed; }
 
     private:
         static Napi::FunctionReference constructor;
+        // Held for each transfer and by close(). Shared by all the devices:
+        // the bcm2835 SPI0 and GPIO registers are set up again by every
+        // transfer, whatever the device.
+        static std::mutex s_bus;
         void open_spidev(const Napi::CallbackInfo& info, const char * device);
         void open_bcm2835(const Napi::CallbackInfo& info, const char * device);
-        void spidev_transfer(const Napi::CallbackInfo& info, unsigned char *write, unsigned char *read, size_t length, uint32_t speed, uint16_t delay, uint8_t bits, bool dma);
-        void bcm2835_transfer(const Napi::CallbackInfo& info, unsigned char *write, unsigned char *read, size_t length, uint32_t speed, uint16_t delay, uint8_t bits, bool dma);
+        void open_parallel(const Napi::CallbackInfo& info);
+        void setup_bcm2835_gpios();
+        const char *transmit_unlocked(unsigned char *write, unsigned char *read, size_t length, bool dma);
+        const char *transmit_segments(uint8_t *data, size_t length,
+                                      const std::vector<CommandBuffer::Segment>& segments);
+        bool can_rewrite() const;
+        template <bool BUSY> int spidev_transfer(unsigned char *write, unsigned char *read, size_t length, uint32_t speed, uint16_t delay, uint8_t bits, bool dma);
+        template <bool BUSY> int bcm2835_transfer(unsigned char *write, unsigned char *read, size_t length, uint32_t speed, uint16_t delay, uint8_t bits, bool dma);
+        template <bool BUSY> void parallel_transfer(unsigned char *write, size_t length, bool dma);
+        int spidev_shift(const unsigned char *data, size_t count);
+        int bcm2835_shift(const unsigned char *data, size_t count);
+        template <bool BUSY> void spidev_wait_rdy(const unsigned char *data, size_t count, bool dma, bool settled);
         void do_transfer(const Napi::CallbackInfo& info, bool dma);
+        template <bool BUSY> void bcm2835_wait_idle();
+        template <bool BUSY> void bcm2835_wait_rdy(const unsigned char *data, size_t count, bool dma, bool settled);
+        bool credit_check(const unsigned char *data, size_t count);
+        void credit_start();
+        void credit_drain();
+        void credit_mismatch();
+        void bcm2835_wait_event(uint32_t settle);
+        void update_busy_timing();
+        uint8_t busy_class(const unsigned char *data, size_t count);
+        void busy_seen(uint8_t cls, uint64_t start, uint64_t now);
+        void rdy_waited(uint64_t start, uint32_t spins);
+        void count_transfer(size_t length, bool dma, bool sent);
+        void reset_stats();
+        uint32_t bus_submitted();
+        void bus_acquired(uint64_t submitted, uint32_t depth, bool dma);
+        void bus_released(uint64_t submitted, uint32_t depth, bool dma);
 
         int m_fd;
         uint32_t m_mode;
@@ -65,6 +154,45 @@ class SPIDriver : public Napi::ObjectWrap<SPIDriver> {
         uint8_t m_driver;
         bool m_bseries;
         bool m_invert_rdy;
+        uint8_t m_flow_control;
+        uint32_t m_drain_time;        // Estimated ns to consume one data byte
+        uint32_t m_drain_base;        // Same as set by drainTime()
+        uint32_t m_credit_bytes;      // Estimated receive buffer occupancy
+        uint64_t m_credit_backlog;    // Estimated ns to drain the receive buffer
+        uint64_t m_credit_stamp;      // Time of the last model update
+        bool m_credit_strict;         // Model was wrong, poll every byte
+        uint8_t m_rdy_wait;
+        uint8_t m_data_pins[8];       // D0..D7 for the parallel driver
+        uint32_t m_data_mask;
+        uint32_t m_data_lut[256];     // GPIO set bits for each byte value
+        uint32_t m_latch_pin;         // 74HC595 RCLK, enables pipelining
+        const DisplayProfile *m_profile;
+        CommandParser m_parser;       // Follows the stream on BUSY displays
+        uint32_t m_busy_override[NTK_BYTE_CLASSES]; // 0: profile value
+        uint32_t m_busy_ns[NTK_BYTE_CLASSES];       // BUSY rise timeouts
+        uint32_t m_busy_latency[NTK_BYTE_CLASSES];  // Slowest rise seen
+        bool m_optimize;
+        CommandOptimizer m_optimizer; // Sees everything sent when m_optimize
+        CommandBuffer m_optimized;
+        bool m_auto_dma;
+        CommandParser m_segmenter;    // Finds payloads in plain transfers
+        std::vector<CommandBuffer::Segment> m_segments;
+        TransferStats m_stats;
+        // Waits of the current transfer, added to m_stats at its end
+        uint64_t m_wait_ns;
+        uint64_t m_wait_max_ns;
+        uint64_t m_wait_spins;
+        uint64_t m_delay_ns;
+        // Latency distributions, [0] for checked and [1] for DMA transfers
+        LatencyHistogram m_queue_latency[2];  // Submission to bus lock
+        LatencyHistogram m_rdy_latency[2];    // Each RDY/BUSY wait
+        LatencyHistogram m_total_latency[2];  // Submission to last byte
+        bool m_dma;                           // Kind of the transfer going on
+        std::atomic<uint32_t> m_pending;      // Calls waiting for or holding
+                                              // the bus, counted while tracing
+        std::atomic<bool> m_tracing;          // m_trace is set, read without
+                                              // the bus lock
+        std::unique_ptr<TraceBuffer> m_trace; // NULL when not tracing
 
 };
 
@@ -86,3 +214,9 @@ class SPIDriver : public Napi::ObjectWrap<SPIDriver> {
   }
 
 #define MAX(a,b) (a>b ? a:b)
+
+static inline uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,277 @@
+#include "text_screen.h"
+#include "font.h"
+#include "spi_driver.h"
+
+#include <algorithm>
+
+Napi::FunctionReference TextScreen::constructor;
+
+#define INT_ARG(N, DEFAULT) (info[N].IsNumber() ? info[N].As<Napi::Number>().Int32Value() : (DEFAULT))
+
+// US r n: reverse display switch
+#define REVERSE_BYTES 3
+
+// Character cell of the built-in fonts, width in dots and height in rows
+static const uint8_t cell_width[] = { 6, 8, 12, 16 };
+static const uint8_t cell_rows[] = { 1, 2, 3, 4 };
+
+Napi::Object TextScreen::Init(Napi::Env env, Napi::Object exports) {
+    Napi::Function func = DefineClass(
+        env,
+        "TextScreen",
+        {
+            InstanceMethod("columns", &TextScreen::columns),
+            InstanceMethod("lines", &TextScreen::lines),
+            InstanceMethod("write", &TextScreen::write),
+            InstanceMethod("clear", &TextScreen::clear),
+            InstanceMethod("line", &TextScreen::line),
+            InstanceMethod("dirty", &TextScreen::dirty),
+            InstanceMethod("invalidate", &TextScreen::invalidate),
+            InstanceMethod("encode", &TextScreen::encode),
+            InstanceMethod("flush", &TextScreen::flush),
+        }
+    );
+
+    constructor = Napi::Persistent(func);
+    constructor.SuppressDestruct();
+    exports.Set("TextScreen", func);
+
+    return exports;
+}
+
+/**
+ * new TextScreen(columns, lines, font): font is the display font size (1 =
+ * 6x8, 2 = 8x16, 3 = 12x24, 4 = 16x32), the default is 42x8 cells of 6x8
+ * to fill a 256x64 display
+ */
+TextScreen::TextScreen(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<TextScreen>(info),
+    m_columns(INT_ARG(0, 42)),
+    m_lines(INT_ARG(1, 8)),
+    m_font(INT_ARG(2, 1)),
+    m_known(false),
+    m_reverse(false),
+    m_cursor(-1),
+    m_runs(0) {
+
+    if (m_font < 1 || m_font > (int)sizeof(cell_width)) {
+        EXCEPTION("Font must be 1 to 4");
+        m_font = 1;
+    }
+    if (m_columns <= 0 || m_lines <= 0 || m_columns * cell_width[m_font - 1] > 0xFFFF ||
+        m_lines * cell_rows[m_font - 1] > 0xFFFF) {
+        EXCEPTION("Wrong screen size");
+        m_columns = 1;
+        m_lines = 1;
+    }
+
+    Cell blank = { ' ', false };
+    m_cells.assign((size_t)m_columns * m_lines, blank);
+    m_shown = m_cells;
+}
+
+Napi::Value TextScreen::columns(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), m_columns);
+}
+
+Napi::Value TextScreen::lines(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), m_lines);
+}
+
+/**
+ * write(column, line, text, reverse): puts a string (UTF-8 decoded) or a
+ * Buffer (one byte per character) in the cells from column on, cut at the
+ * end of the line. Characters outside 0x20 to 0xFF become '?'. Nothing is
+ * sent before flush().
+ */
+Napi::Value TextScreen::write(const Napi::CallbackInfo& info) {
+    if (!info[0].IsNumber() || !info[1].IsNumber()) {
+        EXCEPTION("Wrong arguments");
+        return info.This();
+    }
+    int column = INT_ARG(0, 0);
+    int line = INT_ARG(1, 0);
+    if (column < 0 || line < 0 || column >= m_columns || line >= m_lines) {
+        EXCEPTION("Position must be on screen");
+        return info.This();
+    }
+    if (!Font::text_codes(info[2], m_codes)) {
+        EXCEPTION("Argument 3 must be a string or a Buffer");
+        return info.This();
+    }
+    bool reverse = info[3].IsBoolean() && info[3].As<Napi::Boolean>().Value();
+
+    Cell *cell = &m_cells[(size_t)line * m_columns + column];
+    for (size_t i = 0; i < m_codes.size() && column + (int)i < m_columns; i++) {
+        uint32_t code = m_codes[i];
+        cell[i].code = code >= 0x20 && code <= 0xFF ? code : '?';
+        cell[i].reverse = reverse;
+    }
+    return info.This();
+}
+
+/**
+ * Blanks all the cells
+ */
+Napi::Value TextScreen::clear(const Napi::CallbackInfo& info) {
+    Cell blank = { ' ', false };
+    std::fill(m_cells.begin(), m_cells.end(), blank);
+    return info.This();
+}
+
+/**
+ * line(n): character codes of a line as a Buffer
+ */
+Napi::Value TextScreen::line(const Napi::CallbackInfo& info) {
+    int line = INT_ARG(0, -1);
+    if (line < 0 || line >= m_lines) {
+        EXCEPTION("Line must be on screen");
+        return info.Env().Undefined();
+    }
+
+    Napi::Buffer<uint8_t> codes = Napi::Buffer<uint8_t>::New(info.Env(), m_columns);
+    for (int c = 0; c < m_columns; c++) {
+        codes.Data()[c] = m_cells[(size_t)line * m_columns + c].code;
+    }
+    return codes;
+}
+
+/**
+ * Tells whether something is waiting for a flush
+ */
+Napi::Value TextScreen::dirty(const Napi::CallbackInfo& info) {
+    bool dirty = !m_known;
+
+    for (size_t i = 0; !dirty && i < m_cells.size(); i++) {
+        dirty = this->changed(i);
+    }
+    return Napi::Boolean::New(info.Env(), dirty);
+}
+
+/**
+ * Forgets what the display shows: the next flush clears it, selects the
+ * font and writes all the cells that are not blank. To be called after
+ * something else wrote to the display.
+ */
+Napi::Value TextScreen::invalidate(const Napi::CallbackInfo& info) {
+    m_known = false;
+    return info.This();
+}
+
+/**
+ * Bytes needed to resend the cells [from, to) of a line, unchanged or not,
+ * instead of moving the cursor over them. Reverse switches count when the
+ * cells in between add some.
+ */
+size_t TextScreen::resend_cost(int from, int to) const {
+    size_t cost = to - from;
+    bool reverse = m_cells[from - 1].reverse;
+
+    for (int i = from; i <= to; i++) {
+        if (m_cells[i].reverse != reverse)
+            cost += REVERSE_BYTES;
+        reverse = m_cells[i].reverse;
+    }
+    if (m_cells[to].reverse != m_cells[from - 1].reverse)
+        cost -= REVERSE_BYTES;
+    return cost;
+}
+
+/**
+ * Turns the changed cells into commands: runs of changed cells on a line
+ * are joined when resending the cells in between is cheaper than a cursor
+ * move, and the cursor is only moved when it is not already at the start
+ * of the run
+ */
+void TextScreen::encode_changes(CommandBuffer& commands) {
+    int width = cell_width[m_font - 1];
+    int rows = cell_rows[m_font - 1];
+
+    commands.reset();
+    m_runs = 0;
+    if (!m_known) {
+        Cell blank = { ' ', false };
+        std::fill(m_shown.begin(), m_shown.end(), blank);
+        commands.clear();
+        commands.font(m_font);
+        commands.reverse(false);
+        m_reverse = false;
+        m_cursor = -1;
+        m_known = true;
+    }
+
+    for (int line = 0; line < m_lines; line++) {
+        int first = line * m_columns;
+        int last = first + m_columns;
+
+        for (int start = first; start < last; ) {
+            if (!this->changed(start)) {
+                start++;
+                continue;
+            }
+
+            int end = start + 1;
+            while (end < last) {
+                int next = end;
+                while (next < last && !this->changed(next))
+                    next++;
+                if (next == last || (next > end && this->resend_cost(end, next) > NTK_CURSOR_BYTES))
+                    break;
+                end = next + 1;
+            }
+
+            if (m_cursor != start)
+                commands.cursor((start - first) * width, line * rows);
+            for (int i = start; i < end; i++) {
+                if (m_cells[i].reverse != m_reverse) {
+                    m_reverse = m_cells[i].reverse;
+                    commands.reverse(m_reverse);
+                }
+                commands.raw(&m_cells[i].code, 1);
+                m_shown[i] = m_cells[i];
+            }
+            // Where the cursor goes after the end of a line depends on
+            // the display settings
+            m_cursor = end < last ? end : -1;
+            m_runs++;
+            start = end;
+        }
+    }
+}
+
+/**
+ * encode(): returns the commands of the next flush as a Buffer, and
+ * considers them sent
+ */
+Napi::Value TextScreen::encode(const Napi::CallbackInfo& info) {
+    this->encode_changes(m_commands);
+    return Napi::Buffer<uint8_t>::Copy(info.Env(), m_commands.data(), m_commands.length());
+}
+
+/**
+ * flush(spi): sends the changed cells in one go, under the bus lock.
+ * Returns the number of runs written and bytes sent.
+ */
+Napi::Value TextScreen::flush(const Napi::CallbackInfo& info) {
+    SPIDriver *spi = SPIDriver::FromValue(info[0]);
+    if (!spi) {
+        EXCEPTION("Argument 1 must be a Spi device");
+        return info.Env().Undefined();
+    }
+
+    this->encode_changes(m_commands);
+    if (m_commands.length()) {
+        const char *error = spi->transmit_commands(m_commands);
+        if (error) {
+            // Don't know what made it to the display
+            m_known = false;
+            Napi::TypeError::New(info.Env(), error).ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
+    }
+
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("runs", Napi::Number::New(info.Env(), m_runs));
+    result.Set("bytes", Napi::Number::New(info.Env(), m_commands.length()));
+    return result;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <napi.h>
+#include <vector>
+
+#include "noritake.h"
+
+/**
+ * Screen of character cells shown with the display built-in fonts. Cells
+ * are written from JS, and each flush only sends the characters that
+ * differ from what the display shows, behind a cursor move when needed.
+ */
+class TextScreen : public Napi::ObjectWrap<TextScreen> {
+    public:
+        TextScreen(const Napi::CallbackInfo& info);
+        static Napi::Object Init(Napi::Env env, Napi::Object exports);
+
+        Napi::Value columns(const Napi::CallbackInfo& info);
+        Napi::Value lines(const Napi::CallbackInfo& info);
+        Napi::Value write(const Napi::CallbackInfo& info);
+        Napi::Value clear(const Napi::CallbackInfo& info);
+        Napi::Value line(const Napi::CallbackInfo& info);
+        Napi::Value dirty(const Napi::CallbackInfo& info);
+        Napi::Value invalidate(const Napi::CallbackInfo& info);
+        Napi::Value encode(const Napi::CallbackInfo& info);
+        Napi::Value flush(const Napi::CallbackInfo& info);
+
+    private:
+        struct Cell {
+            uint8_t code;
+            bool reverse;
+
+            bool operator!=(const Cell& other) const {
+                return code != other.code || reverse != other.reverse;
+            }
+        };
+
+        static Napi::FunctionReference constructor;
+        bool changed(int index) const { return m_cells[index] != m_shown[index]; }
+        size_t resend_cost(int from, int to) const;
+        void encode_changes(CommandBuffer& commands);
+
+        int m_columns;
+        int m_lines;
+        int m_font;                   // Display font, 1 = 6x8 to 4 = 16x32
+        std::vector<Cell> m_cells;    // Line by line
+        std::vector<Cell> m_shown;    // What the display shows
+
+        // Display state, as left by the last flush
+        bool m_known;
+        bool m_reverse;
+        int m_cursor;                 // Cell the cursor is on, -1 if unknown
+
+        uint32_t m_runs;              // Writes of the last flush
+        std::vector<uint32_t> m_codes;
+        CommandBuffer m_commands;
+};
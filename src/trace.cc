@@ -0,0 +1,98 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <functional>
+#include <thread>
+#ifdef __linux__
+  #include <sys/syscall.h>
+#endif
+
+static const char *trace_names[] = {
+    "transfer", "rdy wait", "bus wait", "bus setup", "queue"
+};
+
+static const char *trace_args[] = {
+    "bytes", "polls", "depth", "speed", "depth"
+};
+
+/**
+ * Id of the calling thread, the kernel one on Linux so that it matches
+ * system traces
+ */
+static uint32_t trace_thread() {
+    // Looked up once per thread, a syscall per event would show in the trace
+#ifdef __linux__
+    static thread_local uint32_t thread = (uint32_t)syscall(SYS_gettid);
+#else
+    static thread_local uint32_t thread =
+        (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+    return thread;
+}
+
+TraceBuffer::TraceBuffer(size_t capacity)
+    : m_events(capacity ? capacity : 1),
+    m_recorded(0) {
+}
+
+void TraceBuffer::record(uint8_t type, uint64_t start, uint64_t end, uint32_t arg, bool dma) {
+    TraceEvent& event = m_events[m_recorded % m_events.size()];
+
+    event.start = start;
+    event.end = end;
+    event.arg = arg;
+    event.thread = trace_thread();
+    event.type = type;
+    event.dma = dma;
+    m_recorded++;
+}
+
+size_t TraceBuffer::size() const {
+    return m_recorded < m_events.size() ? (size_t)m_recorded : m_events.size();
+}
+
+/**
+ * Events overwritten by newer ones
+ */
+uint64_t TraceBuffer::dropped() const {
+    return m_recorded - this->size();
+}
+
+void TraceBuffer::chrome_json(std::string& out) const {
+    int pid = (int)getpid();
+    size_t count = this->size();
+    char line[256];
+
+    out += "{\"traceEvents\":[";
+    for (size_t i = 0; i < count; i++) {
+        const TraceEvent& event = m_events[(m_recorded - count + i) % m_events.size()];
+        const char *separator = i ? ",\n" : "\n";
+        // Timestamps are in us, keep the ns as decimals
+        unsigned long long ts = event.start / 1000;
+        unsigned ts_ns = event.start % 1000;
+
+        if (event.type == TRACE_QUEUE) {
+            snprintf(line, sizeof(line),
+                     "%s{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu.%03u,\"pid\":%d,"
+                     "\"args\":{\"%s\":%u}}",
+                     separator, trace_names[event.type], ts, ts_ns, pid,
+                     trace_args[event.type], event.arg);
+        } else {
+            uint64_t duration = event.end - event.start;
+            snprintf(line, sizeof(line),
+                     "%s{\"name\":\"%s\",\"cat\":\"spi\",\"ph\":\"X\",\"ts\":%llu.%03u,"
+                     "\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%u,"
+                     "\"args\":{\"%s\":%u,\"dma\":%s}}",
+                     separator, trace_names[event.type], ts, ts_ns,
+                     (unsigned long long)(duration / 1000), (unsigned)(duration % 1000),
+                     pid, event.thread, trace_args[event.type], event.arg,
+                     event.dma ? "true" : "false");
+        }
+        out += line;
+    }
+    snprintf(line, sizeof(line),
+             "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu}}",
+             (unsigned long long)this->dropped());
+    out += line;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Trace event types, see TraceEvent for what arg holds
+#define TRACE_TRANSFER  0    // One transfer on the bus, arg: bytes
+#define TRACE_RDY_WAIT  1    // Waiting for RDY/BUSY, arg: line polls
+#define TRACE_BUS_WAIT  2    // Waiting for the bus lock, arg: queue depth
+#define TRACE_BUS_SETUP 3    // bcm2835 speed and CS selection, arg: Hz
+#define TRACE_QUEUE     4    // Calls waiting for or holding the bus, arg:
+                             // their count (a counter, no duration)
+
+// Ring size of trace(true), 8192 events
+#define TRACE_DEFAULT_BYTES (256 * 1024)
+// Largest ring trace(bytes) takes
+#define TRACE_MAX_BYTES (64 * 1024 * 1024)
+
+struct TraceEvent {
+    uint64_t start;          // CLOCK_MONOTONIC ns
+    uint64_t end;
+    uint32_t arg;
+    uint32_t thread;
+    uint8_t type;
+    bool dma;
+};
+
+/**
+ * Ring of the last trace events of a device, in a fixed amount of memory.
+ * Events are written by the bus lock holder only, and complete: begin and
+ * end go together, so that wrapping never leaves half of a pair behind.
+ */
+class TraceBuffer {
+    public:
+        TraceBuffer(size_t capacity);
+
+        void record(uint8_t type, uint64_t start, uint64_t end, uint32_t arg, bool dma);
+        size_t capacity() const { return m_events.size(); }
+        size_t size() const;
+        uint64_t dropped() const;
+        // Appends a JSON document with the events, oldest first, in the
+        // Chrome trace event format (chrome://tracing, Perfetto)
+        void chrome_json(std::string& out) const;
+
+    private:
+        std::vector<TraceEvent> m_events;
+        uint64_t m_recorded;     // Since creation, m_events holds the last
+                                 // ones
+};
@@ -27,6 +27,24 @@ function testConstants() {
     console.log("DRIVER.SPIDEV:", spi.DRIVER.SPIDEV);
     assert.notStrictEqual(spi.DRIVER.BCM2835, undefined, "DRIVER.BMC2835 missing");
     console.log("DRIVER.BCM2835:", spi.DRIVER.BCM2835);
+    assert.notStrictEqual(spi.DRIVER.PARALLEL, undefined, "DRIVER.PARALLEL missing");
+    console.log("DRIVER.PARALLEL:", spi.DRIVER.PARALLEL);
+
+    assert.notStrictEqual(spi.FLOW.STRICT, undefined, "FLOW.STRICT missing");
+    console.log("FLOW.STRICT:", spi.FLOW.STRICT);
+    assert.notStrictEqual(spi.FLOW.CREDIT, undefined, "FLOW.CREDIT missing");
+    console.log("FLOW.CREDIT:", spi.FLOW.CREDIT);
+
+    assert.notStrictEqual(spi.RDY_WAIT.POLL, undefined, "RDY_WAIT.POLL missing");
+    console.log("RDY_WAIT.POLL:", spi.RDY_WAIT.POLL);
+    assert.notStrictEqual(spi.RDY_WAIT.EVENT, undefined, "RDY_WAIT.EVENT missing");
+    console.log("RDY_WAIT.EVENT:", spi.RDY_WAIT.EVENT);
+
+    assert.notStrictEqual(spi.PIXEL.GRAY, undefined, "PIXEL.GRAY missing");
+    assert.notStrictEqual(spi.PIXEL.RGBA, undefined, "PIXEL.RGBA missing");
+    assert.notStrictEqual(spi.DITHER.FLOYD_STEINBERG, undefined, "DITHER.FLOYD_STEINBERG missing");
+    assert.notStrictEqual(spi.DITHER.ATKINSON, undefined, "DITHER.ATKINSON missing");
+    assert.notStrictEqual(spi.DITHER.BAYER, undefined, "DITHER.BAYER missing");
 
 }
 
@@ -77,6 +95,23 @@ function testCreate()
     val = instance.rdyPin();
     assert.strictEqual(val, 4, "Could not switch rdyPin to 4 as expected");
 
+    console.log("Testing Spi.latchPin()");
+    val = instance.latchPin();
+    assert.strictEqual(val, 0, "Default latchPin is not 0 as expected");
+    instance.latchPin(24);
+    val = instance.latchPin();
+    assert.strictEqual(val, 24, "Could not switch latchPin to 24 as expected");
+
+    console.log("Testing Spi.dataPins()");
+    val = instance.dataPins();
+    assert.deepStrictEqual(val, [0, 0, 0, 0, 0, 0, 0, 0], "Default data pins are not all 0 as expected");
+    instance.dataPins([2, 3, 4, 5, 6, 7, 8, 9]);
+    val = instance.dataPins();
+    assert.deepStrictEqual(val, [2, 3, 4, 5, 6, 7, 8, 9], "Could not set data pins as expected");
+
+    console.log("Testing Spi.profile()");
+    assert.strictEqual(instance.profile(), "GU-3900", "Default profile is not GU-3900 as expected");
+
     console.log("Testing Spi.invertRdy()");
     val = instance.invertRdy();
     assert.strictEqual(val, false, "Default invertRdy is not false as expected");
@@ -90,6 +125,60 @@ function testCreate()
     instance.bSeries(true);
     val = instance.bSeries();
     assert.strictEqual(val, true, "Could not switch bSeries to true as expected");
+    assert.strictEqual(instance.profile(), "GU-7000", "invertRdy should select the GU-7000 profile");
+    instance.invertRdy(false);
+    assert.strictEqual(instance.profile(), "GU-3900B", "bSeries should select the GU-3900B profile");
+    instance.invertRdy(true);
+
+    console.log("Testing Spi.busyTiming()");
+    val = instance.busyTiming();
+    assert.deepStrictEqual(val, { text: 10000, param: 10000, data: 10000, end: 10000, slow: 20000 },
+                           "Default GU-7000 BUSY timing is not as expected");
+    instance.busyTiming({ data: 1500, slow: 25000 });
+    val = instance.busyTiming();
+    assert.strictEqual(val.data, 1500, "Could not set the data BUSY timing to 1500 as expected");
+    assert.strictEqual(val.slow, 25000, "Could not set the slow BUSY timing to 25000 as expected");
+    assert.strictEqual(val.end, 10000, "busyTiming() should keep the values not given");
+    instance.busyTiming({ data: 0 });
+    assert.strictEqual(instance.busyTiming().data, 10000, "0 should restore the profile BUSY timing");
+    assert.deepStrictEqual(instance.busyLatency(), { text: 0, param: 0, data: 0, end: 0, slow: 0 },
+                           "No BUSY latency should be recorded before open");
+
+    console.log("Testing Spi.optimize()");
+    assert.strictEqual(instance.optimize(), false, "Optimizer should be off by default");
+    assert.strictEqual(instance.optimize(true).optimize(), true, "Could not turn the optimizer on");
+    assert.deepStrictEqual(instance.optimizerStats(), { bytesIn: 0, bytesOut: 0, bytesSaved: 0, dropped: 0, merged: 0 },
+                           "Optimizer counters should start at 0");
+    instance.optimize(false);
+
+    console.log("Testing Spi.autoDma()");
+    assert.strictEqual(instance.autoDma(), true, "Payloads should go out in DMA mode by default");
+    assert.strictEqual(instance.autoDma(false).autoDma(), false, "Could not turn automatic DMA off");
+    instance.autoDma(true);
+
+    console.log("Testing Spi.stats()");
+    const zero = { bytes: 0, transfers: 0, dmaBytes: 0, checkedBytes: 0, rdyWaitNs: 0,
+                   rdyWaitMaxNs: 0, rdySpins: 0, delayNs: 0 };
+    assert.deepStrictEqual(instance.stats(), zero, "Stats should start at zero");
+    assert.deepStrictEqual(instance.resetStats().stats(), zero, "Could not reset the stats");
+
+    console.log("Testing Spi.latency()");
+    const latency = instance.latency([50, 99.9]);
+    assert.deepStrictEqual(Object.keys(latency), [ 'queue', 'rdyWait', 'total' ], "Wrong latency metrics");
+    assert.deepStrictEqual(latency.total.dma, { count: 0, min: 0, max: 0, mean: 0, percentiles: { 50: 0, 99.9: 0 } },
+                           "Latency should start empty");
+    assert.strictEqual(instance.latency().queue.checked.percentiles[99], 0, "Wrong default percentiles");
+    assert.throws(() => instance.latency(['p99']), /Percentiles/, "Should reject percentiles that are not numbers");
+
+    console.log("Testing Spi.trace()");
+    assert.strictEqual(instance.trace(), 0, "Tracing should be off by default");
+    assert.strictEqual(instance.trace(true).trace(), 256 * 1024, "Wrong default trace size");
+    assert.strictEqual(instance.trace(1000).trace(), 992, "Trace size should be whole events");
+    assert.deepStrictEqual(JSON.parse(instance.chromeTrace()).traceEvents, [], "Trace should start empty");
+    assert.strictEqual(instance.trace(false).trace(), 0, "Could not stop tracing");
+    assert.throws(() => instance.trace(8), /too small/, "Should reject a trace buffer smaller than an event");
+    assert.throws(() => instance.trace(0xFFFFFFFF), /64MB/, "Should reject a trace buffer larger than 64MB");
+    assert.strictEqual(instance.trace(), 0, "Rejected trace size should leave tracing off");
 
     console.log("Testing Spi.spiDelay()");
     val = instance.delay();
@@ -126,7 +215,535 @@ function testCreate()
     val = instance.halfDuplex();
     assert.strictEqual(val, true, "Could not switch halfDuplex to true as expected");
 
+    console.log("Testing Spi.flowControl()");
+    val = instance.flowControl();
+    assert.strictEqual(val, spi.FLOW.STRICT, "Default flow control is not STRICT as expected");
+    instance.flowControl(spi.FLOW.CREDIT);
+    val = instance.flowControl();
+    assert.strictEqual(val, spi.FLOW.CREDIT, "Could not switch flow control to CREDIT as expected");
+
+    console.log("Testing Spi.drainTime()");
+    val = instance.drainTime();
+    assert.strictEqual(val, 10000, "Default drain time is not 10000 as expected");
+    instance.drainTime(2000);
+    val = instance.drainTime();
+    assert.strictEqual(val, 2000, "Could not switch drain time to 2000 as expected");
 
+    console.log("Testing Spi.rdyWait()");
+    val = instance.rdyWait();
+    assert.strictEqual(val, spi.RDY_WAIT.POLL, "Default RDY wait is not POLL as expected");
+    instance.rdyWait(spi.RDY_WAIT.EVENT);
+    val = instance.rdyWait();
+    assert.strictEqual(val, spi.RDY_WAIT.EVENT, "Could not switch RDY wait to EVENT as expected");
+
+}
+
+function testEncoder()
+{
+    const enc = new spi.Encoder();
+
+    console.log("Testing Encoder.cursor()");
+    enc.cursor(258, 1);
+    assert.deepStrictEqual([...enc.buffer()], [0x1f, 0x24, 2, 1, 1, 0], "Wrong cursor set command");
+    enc.reset();
+    assert.strictEqual(enc.length(), 0, "Encoder reset did not empty the buffer");
+
+    console.log("Testing Encoder.bitImage()");
+    enc.bitImage(2, 1, Buffer.from([0xaa, 0x55]));
+    assert.deepStrictEqual([...enc.buffer()], [0x1f, 0x28, 0x66, 0x11, 2, 0, 1, 0, 1, 0xaa, 0x55], "Wrong bit image command");
+    enc.reset();
+    assert.throws(() => enc.bitImage(65537, 1, Buffer.alloc(65537)), /less than 65536/, "Too wide image did not throw");
+    assert.strictEqual(enc.length(), 0, "Too wide image should not be encoded");
+
+    console.log("Testing Encoder.memoryWrite()");
+    enc.memoryWrite(0x10203, Buffer.from([0, 0xff]));
+    assert.deepStrictEqual([...enc.buffer()], [0x02, 0x44, 0xff, 0x46, 3, 2, 1, 2, 0, 0, 0, 0xff], "Wrong display memory write command");
+    enc.reset();
+
+    console.log("Testing Encoder.text()");
+    enc.font(1).text("A\u00e9\u20ac");
+    assert.deepStrictEqual([...enc.buffer()], [0x1f, 0x28, 0x67, 0x01, 1, 0x41, 0xe9, 0x3f], "Wrong text encoding");
+
+    assert.throws(() => enc.flush(null), undefined, "Flushing to nothing did not throw");
+    assert.throws(() => enc.flush(new spi.Spi("/dev/spi0.0")), /not opened/, "Flushing to a closed device did not throw");
+    assert.strictEqual(enc.length(), 8, "Commands should be kept after a failed flush");
+}
+
+function testFrameBuffer()
+{
+    const fb = new spi.FrameBuffer(256, 64);
+    assert.strictEqual(fb.width(), 256, "Wrong framebuffer width");
+    assert.strictEqual(fb.height(), 64, "Wrong framebuffer height");
+    assert.deepStrictEqual(fb.dirty(), [], "New framebuffer should not be dirty");
+
+    console.log("Testing FrameBuffer.setPixel()");
+    fb.setPixel(3, 9);
+    assert.strictEqual(fb.getPixel(3, 9), true, "Pixel not set");
+    assert.strictEqual(fb.buffer()[3 * 8 + 1], 0x40, "Pixel not stored in display layout");
+    fb.setPixel(4, 10);
+    assert.deepStrictEqual(fb.dirty(), [{ x: 3, y: 8, width: 2, height: 8 }], "Close pixels should be merged");
+    fb.setPixel(200, 60);
+    assert.strictEqual(fb.dirty().length, 2, "Far away pixels should not be merged");
+
+    console.log("Testing FrameBuffer.blit()");
+    fb.clear();
+    fb.blit(Buffer.from([0xff, 0x81]), 10, 4, 2, 8);
+    assert.strictEqual(fb.getPixel(10, 4), true, "Blit not shifted");
+    assert.strictEqual(fb.getPixel(10, 3), false, "Blit not shifted");
+    assert.strictEqual(fb.getPixel(11, 11), true, "Blit not shifted");
+    assert.strictEqual(fb.getPixel(11, 10), false, "Blit not shifted");
+
+    fb.invalidate();
+    assert.deepStrictEqual(fb.dirty(), [{ x: 0, y: 0, width: 256, height: 64 }], "Invalidate should mark everything dirty");
+    assert.throws(() => fb.flush(new spi.Spi("/dev/spi0.0")), /not opened/, "Flushing to a closed device did not throw");
+    assert.strictEqual(fb.dirty().length, 1, "Areas should stay dirty after a failed flush");
+    assert.strictEqual(fb.fillAreas(), true, "Filled areas should be on by default");
+    assert.strictEqual(fb.fillAreas(false).fillAreas(), false, "Wrong fillAreas");
+}
+
+function testFrameDiff()
+{
+    const diff = new spi.FrameDiff(256, 64);
+    const prev = Buffer.alloc(256 * 8);
+    const next = Buffer.alloc(256 * 8);
+    diff.costModel({ speed: 1000000, byteOverhead: 500, rdyOverhead: 1500, transferOverhead: 5000 });
+    assert.strictEqual(diff.costModel().rdyOverhead, 1500, "Cost model not set");
+
+    console.log("Testing FrameDiff.plan()");
+    assert.strictEqual(diff.plan(prev, next).strategy, "none", "Identical frames should not be sent");
+
+    next[10 * 8 + 2] = 0xff;
+    next[12 * 8 + 3] = 0xff;
+    let plan = diff.plan(prev, next);
+    assert.strictEqual(plan.strategy, "merged", "Close changes should be merged");
+    assert.deepStrictEqual(plan.writes, [{ x: 10, y: 16, width: 3, height: 16 }], "Wrong merged write");
+
+    next[200 * 8 + 7] = 0x01;
+    plan = diff.plan(prev, next);
+    assert.strictEqual(plan.strategy, "spans", "Far away changes should not be merged");
+    assert.strictEqual(plan.writes.length, 2, "Wrong number of writes");
+    assert.strictEqual(plan.bytes, 2 * 15 + 3 * 2 + 1, "Wrong byte count");
+
+    next.fill(0x55);
+    assert.strictEqual(diff.plan(prev, next).strategy, "full", "Full changes should be a full frame write");
+
+    const fb = new spi.FrameBuffer(256, 64);
+    fb.setPixel(0, 0);
+    assert.deepStrictEqual(diff.plan(prev, fb).writes, [{ x: 0, y: 0, width: 1, height: 8 }], "FrameBuffer not diffed");
+    assert.throws(() => diff.plan(prev, Buffer.alloc(10)), undefined, "Wrong frame size did not throw");
+}
+
+function testImagePacker()
+{
+    const packer = new spi.ImagePacker(37, 21);
+    const rgba = new Uint8ClampedArray(37 * 21 * 4);
+    for (let i = 0; i < rgba.length; i++)
+        rgba[i] = (i * 7919) % 251;
+
+    console.log("Testing ImagePacker.pack() with kernel", packer.kernel());
+    const best = packer.kernel();
+    const packed = packer.pack(rgba);
+    assert.strictEqual(packed.length, 37 * 3, "Wrong packed size");
+    packer.kernel("scalar");
+    assert.deepStrictEqual(packer.pack(rgba.buffer), packed, "SIMD and scalar RGBA packing differ");
+
+    const gray = Buffer.alloc(37 * 21);
+    gray[1 * 37 + 5] = 255;
+    gray[20 * 37 + 36] = 200;
+    packer.format(spi.PIXEL.GRAY).kernel(best);
+    const out = Buffer.alloc(37 * 3);
+    assert.strictEqual(packer.pack(gray, out), out, "Output buffer not used");
+    assert.strictEqual(out[5 * 3], 0x40, "Wrong gray packing");
+    assert.strictEqual(out[36 * 3 + 2], 0x08, "Wrong gray packing in the last band");
+    packer.invert(true);
+    assert.strictEqual(packer.pack(gray)[36 * 3 + 2], 0xf0, "Inverted padding dots should stay off");
+
+    const fb = new spi.FrameBuffer(256, 64);
+    new spi.ImagePacker(256, 64).format(spi.PIXEL.GRAY).pack(Buffer.alloc(256 * 64, 255), fb);
+    assert.strictEqual(fb.getPixel(100, 50), true, "FrameBuffer not packed");
+    assert.throws(() => packer.kernel("vax"), undefined, "Unknown kernel did not throw");
+}
+
+function litDots(buffer)
+{
+    let count = 0;
+    for (const byte of buffer)
+        for (let bits = byte; bits; bits >>= 1)
+            count += bits & 1;
+    return count;
+}
+
+function testDither()
+{
+    const packer = new spi.ImagePacker(64, 36).format(spi.PIXEL.GRAY);
+    const gray = Buffer.alloc(64 * 36, 128);
+
+    console.log("Testing ImagePacker.dither()");
+    packer.dither(spi.DITHER.BAYER);
+    assert.strictEqual(litDots(packer.pack(gray)), 64 * 36 / 2, "Bayer should light half the dots at mid gray");
+    const bayer = packer.pack(gray);
+    assert.deepStrictEqual(packer.threads(3).pack(gray), bayer, "Threaded Bayer differs");
+
+    for (const mode of [spi.DITHER.FLOYD_STEINBERG, spi.DITHER.ATKINSON]) {
+        packer.dither(mode).threads(1);
+        const lit = litDots(packer.pack(gray));
+        assert(Math.abs(lit - 64 * 36 / 2) < 64, "Error diffusion should light about half the dots at mid gray");
+        assert(Math.abs(litDots(packer.threads(4).pack(gray)) - lit) < 64, "Threaded error diffusion differs too much");
+        assert.strictEqual(litDots(packer.pack(Buffer.alloc(64 * 36, 255))), 64 * 36, "White should be fully lit");
+        assert.strictEqual(litDots(packer.pack(Buffer.alloc(64 * 36, 0))), 0, "Black should not be lit");
+    }
+    assert.throws(() => packer.dither(42), undefined, "Unknown dithering mode did not throw");
+}
+
+const testBDF = [
+    "STARTFONT 2.1",
+    "FONT -test-fixed-medium-r-normal--10-100-75-75-C-50-ISO10646-1",
+    "SIZE 10 75 75",
+    "FONTBOUNDINGBOX 5 10 0 -2",
+    "STARTPROPERTIES 2",
+    "FONT_ASCENT 8",
+    "FONT_DESCENT 2",
+    "ENDPROPERTIES",
+    "CHARS 3",
+    "STARTCHAR space",
+    "ENCODING 32",
+    "DWIDTH 4 0",
+    "BBX 1 1 0 0",
+    "BITMAP",
+    "00",
+    "ENDCHAR",
+    "STARTCHAR I",
+    "ENCODING 73",
+    "DWIDTH 3 0",
+    "BBX 1 8 1 0",
+    "BITMAP",
+    "80", "80", "80", "80", "80", "80", "80", "80",
+    "ENDCHAR",
+    "STARTCHAR degree",
+    "ENCODING 176",
+    "DWIDTH 2 0",
+    "BBX 2 2 0 6",
+    "BITMAP",
+    "C0", "C0",
+    "ENDCHAR",
+    "ENDFONT"
+].join("\n");
+
+function testFont()
+{
+    const font = new spi.Font(testBDF);
+    assert.strictEqual(font.glyphs(), 3, "Wrong glyph count");
+    assert.strictEqual(font.height(), 10, "Wrong font height");
+    assert.strictEqual(font.rows(), 2, "Wrong font rows");
+
+    console.log("Testing Font.render()");
+    assert.strictEqual(font.measure("I I"), 10, "Wrong text width");
+    assert.deepStrictEqual([...font.render("I\u00b0")], [0, 0, 0xff, 0, 0, 0, 0xc0, 0, 0xc0, 0], "Wrong glyph rendering");
+    assert.strictEqual(font.measure("\u263a"), 0, "Missing glyphs without default should be skipped");
+
+    console.log("Testing Font.draw()");
+    const fb = new spi.FrameBuffer(256, 64);
+    assert.strictEqual(font.draw(fb, "I", 10, 20), 3, "Wrong drawn width");
+    assert.strictEqual(fb.getPixel(11, 20), true, "Glyph not drawn");
+    assert.strictEqual(fb.getPixel(11, 27), true, "Glyph not drawn");
+    assert.strictEqual(fb.getPixel(11, 28), false, "Glyph drawn too low");
+    assert.throws(() => new spi.Font("not a font"), undefined, "Invalid font did not throw");
+}
+
+function sleep(ms)
+{
+    Atomics.wait(new Int32Array(new SharedArrayBuffer(4)), 0, 0, ms);
+}
+
+function testScroller()
+{
+    const scroller = new spi.Scroller(256, 64);
+    assert.strictEqual(scroller.memoryWidth(), 512, "Wrong default memory width");
+
+    console.log("Testing Scroller.encodeStep()");
+    scroller.step(2).push(Buffer.alloc(3 * 8, 0xaa));
+    assert.strictEqual(scroller.pending(), 3, "Wrong pending column count");
+    const step = scroller.encodeStep();
+    assert.deepStrictEqual([...step.subarray(0, 6)], [0x1f, 0x24, 0x00, 0x01, 0x00, 0x00], "New columns not written past the screen");
+    assert.deepStrictEqual([...step.subarray(6 + 9 + 16)], [0x1f, 0x28, 0x61, 0x10, 8, 0, 2, 0, 0], "Wrong scroll command");
+    assert.strictEqual(scroller.position(), 2, "Screen not shifted");
+    assert.strictEqual(scroller.encodeStep().length, 6 + 9 + 8 + 9, "Partial step should only send what is left");
+    assert.strictEqual(scroller.encodeStep().length, 0, "Empty queue should not send anything");
+
+    const wrap = new spi.Scroller(256, 64).memoryWidth(257).step(2);
+    wrap.push(Buffer.alloc(2 * 8));
+    assert.strictEqual(wrap.encodeStep().length, 2 * (6 + 9 + 8) + 9, "Wrapping columns should be written in two parts");
+    assert.strictEqual(wrap.position(), 2, "Wrong position after wrapping");
+
+    console.log("Testing Scroller.start()");
+    const device = new spi.Spi("/dev/spi0.0");
+    scroller.interval(1).push(Buffer.alloc(8)).start(device);
+    assert.throws(() => scroller.start(device), undefined, "Starting twice did not throw");
+    for (let i = 0; i < 100 && scroller.running(); i++)
+        sleep(5);
+    assert.strictEqual(scroller.error(), "Device not opened", "I/O thread error not reported");
+    assert.strictEqual(scroller.pending(), 1, "Columns of a failed step should stay queued");
+    assert.doesNotThrow(() => scroller.start(device), undefined, "Could not restart after an error");
+    scroller.stop();
+    assert.strictEqual(scroller.running(), false, "Scroller still running");
+}
+
+function testAssetCache()
+{
+    const cache = new spi.AssetCache(64);
+    const enc = new spi.Encoder();
+    const icon = Buffer.alloc(16, 0x5a);
+
+    console.log("Testing AssetCache.image()");
+    cache.image(enc, 8, 2, icon);
+    assert.deepStrictEqual([...enc.buffer().subarray(0, 10)], [0x1f, 0x28, 0x66, 0x01, 0, 0, 0, 16, 0, 0],
+                           "Image not stored in the display RAM on miss");
+    enc.reset();
+    cache.image(enc, 8, 2, icon);
+    assert.deepStrictEqual([...enc.buffer()], [0x1f, 0x28, 0x66, 0x10, 1, 0, 0, 0, 2, 0, 8, 0, 2, 0, 1],
+                           "Stored image not shown with a short command on hit");
+    enc.reset();
+    cache.image(enc, 8, 6, Buffer.alloc(48, 1));
+    cache.image(enc, 8, 2, Buffer.alloc(16, 2));
+    assert.strictEqual(cache.stats().evictions, 1, "Least recently used image not evicted");
+    enc.reset();
+    cache.image(enc, 8, 2, icon);
+    assert.strictEqual(enc.length(), 10 + 16 + 15, "Evicted image should be stored again");
+    enc.reset();
+    cache.image(enc, 100, 1, Buffer.alloc(100));
+    assert.strictEqual(enc.length(), 9 + 100, "Image larger than the RAM should be sent as a real time bit image");
+
+    console.log("Testing AssetCache.text()");
+    const font = new spi.Font(testBDF);
+    enc.reset();
+    assert.strictEqual(cache.text(enc, font, "II"), 6, "Wrong text width");
+    assert.deepStrictEqual([...enc.buffer()], [0x1b, 0x25, 1, 0x1b, 0x26, 2, 0x80, 0x80, 3, 0, 0, 0xff, 0, 0, 0, 0x80, 0x80],
+                           "Glyph not downloaded once then used twice");
+    enc.reset();
+    cache.text(enc, font, "I");
+    assert.deepStrictEqual([...enc.buffer()], [0x80], "Downloaded glyph not reused");
+    const stats = cache.stats();
+    assert.strictEqual(stats.characters, 1, "Wrong downloaded character count");
+    assert.strictEqual(stats.hits, 3, "Wrong hit count");
+
+    console.log("Testing AssetCache.flush()");
+    const device = new spi.Spi("/dev/spi0.0");
+    enc.reset();
+    cache.image(enc, 8, 2, icon);
+    const length = enc.length();
+    assert.throws(() => cache.flush(device, enc), /not opened/, "Failed flush did not throw");
+    assert.strictEqual(enc.length(), length, "Commands lost on a failed flush");
+    assert.strictEqual(cache.stats().characters, 0, "Failed flush should forget the downloaded characters");
+    enc.reset();
+    cache.image(enc, 8, 2, icon);
+    assert.deepStrictEqual([...enc.buffer().subarray(0, 4)], [0x1f, 0x28, 0x66, 0x01], "Image not stored again after a failed flush");
+
+    cache.invalidate();
+    assert.strictEqual(cache.stats().images, 0, "invalidate() should forget the stored images");
+    assert.throws(() => cache.image(null, 1, 1, Buffer.alloc(1)), undefined, "Caching into nothing did not throw");
+}
+
+function testPageFlipper()
+{
+    const flipper = new spi.PageFlipper(256, 64);
+    const frame = Buffer.alloc(256 * 8);
+    const scroll = [0x1f, 0x28, 0x61, 0x10, 0x00, 0x08, 1, 0, 0];
+
+    console.log("Testing PageFlipper.encode()");
+    let bytes = flipper.encode(frame);
+    assert.deepStrictEqual([...bytes.subarray(0, 6)], [0x1f, 0x24, 0x00, 0x01, 0x00, 0x00], "First frame not written in the hidden page");
+    assert.strictEqual(bytes.length, 6 + 9 + 256 * 8 + 9, "First frame should be written in full");
+    assert.deepStrictEqual([...bytes.subarray(bytes.length - 9)], scroll, "Wrong page flip command");
+    assert.strictEqual(flipper.page(), 1, "Page not flipped");
+    assert.strictEqual(flipper.encode(frame).length, 0, "Frame already on screen should not be sent");
+
+    frame[3 * 8] = 0xff;
+    frame[4 * 8] = 0xff;
+    frame[200 * 8] = 0xff;
+    bytes = flipper.encode(frame);
+    assert.strictEqual(flipper.page(), 0, "Page not flipped back");
+    assert.strictEqual(bytes.length, 6 + 9 + 256 * 8 + 9, "Unknown page should be written in full");
+    frame[3 * 8] = 0;
+    bytes = flipper.encode(frame);
+    assert.deepStrictEqual([...bytes.subarray(0, 6)], [0x1f, 0x24, 4, 1, 0, 0], "Wrong changed column position");
+    assert.strictEqual(bytes.length, 2 * (6 + 9 + 8) + 9, "Only the columns that differ from the hidden page should be sent");
+
+    console.log("Testing PageFlipper.flip()");
+    const device = new spi.Spi("/dev/spi0.0");
+    frame[100 * 8] = 0xff;
+    assert.throws(() => flipper.flip(device, frame), /not opened/, "Failed flip did not throw");
+    assert.strictEqual(flipper.page(), 1, "Page flipped although the frame was not sent");
+    assert.strictEqual(flipper.encode(frame).length, 6 + 9 + 256 * 8 + 9, "Pages should be written in full after a failed flip");
+
+    console.log("Testing PageFlipper.start()");
+    assert.throws(() => flipper.submit(frame), undefined, "Submitting without the I/O thread did not throw");
+    flipper.invalidate().start(device).submit(frame);
+    for (let i = 0; i < 100 && flipper.running(); i++)
+        sleep(5);
+    assert.strictEqual(flipper.error(), "Device not opened", "I/O thread error not reported");
+    assert.strictEqual(flipper.page(), 0, "Page flipped although the frame was not sent");
+    assert.throws(() => flipper.submit(frame), /Not running/, "Submitting after the I/O thread stopped did not throw");
+    flipper.start(device);
+    flipper.stop();
+    assert.throws(() => new spi.PageFlipper(300, 64), undefined, "Two pages should fit in the display memory");
+}
+
+function testCompositor()
+{
+    const comp = new spi.Compositor(256, 64);
+    comp.window("clock", 0, 0, 32, 16).window("status", 0, 56, 256, 8);
+    assert.deepStrictEqual(comp.windows(), ["clock", "status"], "Wrong window list");
+    assert.deepStrictEqual(comp.window("status"), { x: 0, y: 56, width: 256, height: 8 }, "Wrong window geometry");
+
+    console.log("Testing Compositor.encode()");
+    let bytes = comp.encode();
+    assert.deepStrictEqual([...bytes.subarray(0, 5)], [0x1f, 0x28, 0x77, 0x01, 0], "First flush should select the base window");
+    assert.deepStrictEqual([...bytes.subarray(5)], [0x1f, 0x28, 0x64, 0x11, 2, 0, 0, 0, 0, 0, 255, 0, 63, 0],
+                           "Blank screen should be cleared with a filled box");
+    assert.strictEqual(comp.dirty(), false, "Nothing should be pending after a flush");
+    assert.strictEqual(comp.invalidate().fillAreas(false).fillAreas(), false, "Wrong fillAreas");
+    assert.strictEqual(comp.encode().length, 5 + 15 + 256 * 8, "First flush should write the whole screen");
+
+    comp.update("clock", Buffer.alloc(32 * 2, 0xff));
+    const status = Buffer.alloc(256);
+    status[10] = status[12] = 1;
+    comp.update("status", status);
+    bytes = comp.encode();
+    assert.deepStrictEqual([...bytes.subarray(0, 6)], [0x1f, 0x24, 0, 0, 0, 0], "Wrong clock update position");
+    assert.deepStrictEqual([...bytes.subarray(15 + 64, 15 + 64 + 6)], [0x1f, 0x24, 10, 0, 7, 0], "Wrong status update position");
+    assert.strictEqual(bytes.length, 15 + 64 + 15 + 3, "Close changes should be merged, unchanged columns skipped");
+
+    console.log("Testing Compositor.fillAreas()");
+    comp.fillAreas(true).update("clock", Buffer.alloc(32 * 2, 0));
+    assert.deepStrictEqual([...comp.encode()], [0x1f, 0x28, 0x64, 0x11, 2, 0, 0, 0, 0, 0, 31, 0, 15, 0],
+                           "Cleared clock should be a filled box");
+    comp.update("clock", Buffer.alloc(32 * 2, 0xff));
+    assert.deepStrictEqual([...comp.encode()], [0x1f, 0x28, 0x64, 0x11, 2, 1, 0, 0, 0, 0, 31, 0, 15, 0],
+                           "Lit clock should be a filled box");
+
+    console.log("Testing Compositor.remove()");
+    comp.fillAreas(false);
+    comp.window("popup", 16, 0, 32, 8).update("popup", Buffer.alloc(32, 0x0f));
+    assert.strictEqual(comp.encode().length, 15 + 32, "Only the popup columns should be sent");
+    comp.remove("popup");
+    assert.strictEqual(comp.encode().length, 15 + 32, "Removed window should uncover what was below");
+
+    comp.window("a", 64, 8, 8, 8).window("b", 72, 8, 8, 8);
+    comp.update("a", Buffer.alloc(8, 1)).update("b", Buffer.alloc(8, 2));
+    bytes = comp.encode();
+    assert.strictEqual(bytes.length, 15 + 16, "Side by side windows should be sent in a single write");
+    assert.throws(() => comp.window("bad", 0, 3, 8, 8), undefined, "Unaligned window did not throw");
+    assert.throws(() => comp.update("none", Buffer.alloc(1)), undefined, "Updating an unknown window did not throw");
+}
+
+function testTextScreen()
+{
+    const screen = new spi.TextScreen(42, 8, 1);
+    assert.strictEqual(screen.columns(), 42, "Wrong column count");
+
+    console.log("Testing TextScreen.encode()");
+    screen.write(0, 0, "12:34");
+    assert.deepStrictEqual([...screen.encode()],
+                           [0x0c, 0x1f, 0x28, 0x67, 0x01, 1, 0x1f, 0x72, 0,
+                            0x1f, 0x24, 0, 0, 0, 0, ...Buffer.from("12:34")],
+                           "First flush should clear the display and write the text");
+    assert.strictEqual(screen.dirty(), false, "Nothing should be pending after a flush");
+    assert.strictEqual(screen.encode().length, 0, "Unchanged screen should send nothing");
+
+    screen.write(3, 0, "35");
+    assert.deepStrictEqual([...screen.encode()], [0x1f, 0x24, 24, 0, 0, 0, 0x35], "Only the changed digit should be sent");
+    screen.write(0, 2, "a").write(3, 2, "b").write(5, 2, "c");
+    assert.deepStrictEqual([...screen.encode()], [0x1f, 0x24, 0, 0, 2, 0, ...Buffer.from("a  b c")],
+                           "Close changes should be sent as one run");
+    screen.write(6, 2, "d");
+    assert.deepStrictEqual([...screen.encode()], [0x64], "Cursor should not move when already there");
+
+    console.log("Testing TextScreen reverse");
+    screen.write(40, 7, "OK", true);
+    assert.deepStrictEqual([...screen.encode()], [0x1f, 0x24, 240, 0, 7, 0, 0x1f, 0x72, 1, 0x4f, 0x4b],
+                           "Wrong reverse text");
+    screen.write(40, 7, "OK");
+    assert.deepStrictEqual([...screen.encode()], [0x1f, 0x24, 240, 0, 7, 0, 0x1f, 0x72, 0, 0x4f, 0x4b],
+                           "Cursor should move after the end of a line");
+    assert.strictEqual(screen.line(0).toString().trimEnd(), "12:35", "Wrong line content");
+    assert.throws(() => screen.write(42, 0, "x"), undefined, "Writing off screen did not throw");
+    assert.throws(() => new spi.TextScreen(42, 8, 5), undefined, "Wrong font did not throw");
+}
+
+function testOptimizer()
+{
+    const opt = new spi.Optimizer();
+    const enc = new spi.Encoder();
+
+    console.log("Testing Optimizer.optimize()");
+    enc.font(1).cursor(0, 0).cursor(10, 1).text("A").font(1).reverse(false);
+    assert.deepStrictEqual([...opt.optimize(enc.buffer())],
+                           [0x1f, 0x28, 0x67, 0x01, 1, 0x1f, 0x24, 10, 0, 1, 0, 0x41, 0x1f, 0x72, 0],
+                           "Overridden cursor and repeated font should be dropped");
+    enc.reset().font(1).reverse(false).cursor(20, 2);
+    assert.deepStrictEqual([...opt.optimize(enc.buffer())], [0x1f, 0x24, 20, 0, 2, 0], "Known settings should be dropped");
+    assert.strictEqual(opt.optimize(enc.reset().cursor(20, 2).buffer()).length, 0, "Cursor already there should be dropped");
+
+    enc.reset().cursor(0, 0).bitImage(2, 1, Buffer.from([1, 2])).cursor(2, 0).bitImage(3, 1, Buffer.from([3, 4, 5]));
+    assert.deepStrictEqual([...opt.optimize(enc.buffer())],
+                           [0x1f, 0x24, 0, 0, 0, 0, 0x1f, 0x28, 0x66, 0x11, 5, 0, 1, 0, 1, 1, 2, 3, 4, 5],
+                           "Side by side images should be merged");
+    const mixture = (n) => Buffer.from([0x1f, 0x77, n]);
+    enc.reset().raw(mixture(0)).cursor(0, 0).bitImage(2, 1, Buffer.from([1, 2])).cursor(0, 0).bitImage(2, 1, Buffer.from([7, 8]));
+    assert.deepStrictEqual([...opt.optimize(enc.buffer())],
+                           [0x1f, 0x77, 0, 0x1f, 0x24, 0, 0, 0, 0, 0x1f, 0x28, 0x66, 0x11, 2, 0, 1, 0, 1, 7, 8],
+                           "Overwritten image should be dropped");
+    enc.reset().raw(mixture(1)).cursor(0, 0).bitImage(2, 1, Buffer.from([1, 2])).cursor(0, 0).bitImage(2, 1, Buffer.from([7, 8]));
+    assert.deepStrictEqual(opt.optimize(enc.buffer()), enc.buffer(), "Images under OR mixture should be left as is");
+
+    const header = Buffer.from([0x1f, 0x28, 0x66, 0x11, 2, 0, 1, 0, 1]);
+    assert.deepStrictEqual(opt.optimize(header), header, "Split command should be left as is");
+    assert.deepStrictEqual([...opt.optimize(Buffer.from([0x1f, 0x24, 0, 0]))], [0x1f, 0x24, 0, 0], "Split command should be left as is");
+    enc.reset().cursor(0, 0).font(1);
+    assert.strictEqual(opt.optimize(enc.buffer()).length, 11, "Split command should make it forget the display state");
+
+    const stats = opt.stats();
+    assert.strictEqual(stats.merged, 1, "Wrong merge count");
+    assert.strictEqual(stats.dropped, 7, "Wrong dropped count");
+    assert.strictEqual(stats.bytesSaved, stats.bytesIn - stats.bytesOut, "Wrong saved byte count");
+    assert.strictEqual(opt.invalidate().optimize(enc.buffer()).length, 11, "Invalidate should forget the display state");
+}
+
+function testMacros()
+{
+    const macros = new spi.Macros();
+    const enc = new spi.Encoder();
+    const template = enc.cursor(0, 0).text("Temp:").cursor(0, 2).text("Hum:").buffer();
+
+    console.log("Testing Macros.define()");
+    macros.define(template);
+    const stream = Buffer.concat([Buffer.from([0x0c]), template, enc.reset().cursor(40, 0).text("21C").buffer()]);
+    assert.deepStrictEqual(macros.substitute(stream), stream, "Nothing should be substituted before install");
+    assert.deepStrictEqual([...macros.encode().subarray(0, 4)], [0x1f, 0x3a, template.length, 0], "Wrong macro definition");
+    const out = macros.substitute(stream);
+    assert.deepStrictEqual([...out.subarray(0, 6)], [0x0c, 0x1f, 0x5e, 0, 0xff, 0], "Template should be a macro call");
+    assert.strictEqual(out.length, stream.length - template.length + 5, "Wrong substituted length");
+    assert.strictEqual(macros.stats().calls, 1, "Wrong macro call count");
+    assert.throws(() => macros.define(Buffer.from([0x1f, 0x24, 0])), undefined, "Partial command did not throw");
+    assert.throws(() => macros.define(Buffer.from("ABCDEFGH")), /cursor set/, "A macro without a cursor set did not throw");
+
+    console.log("Testing Macros.learn()");
+    const learner = new spi.Macros();
+    const icon = enc.reset().cursor(100, 1).bitImage(8, 1, Buffer.alloc(8, 0x3c)).buffer();
+    for (let i = 0; i < 4; i++)
+        learner.learn(Buffer.concat([icon, enc.reset().cursor(0, 0).text(String(i)).buffer()]));
+    assert.deepStrictEqual(learner.pick(), icon, "The repeated icon should be picked");
+    const cleared = Buffer.concat([enc.reset().cursor(0, 0).text("Status: OK").buffer(), Buffer.from([0x0c])]);
+    for (let i = 0; i < 4; i++)
+        learner.learn(cleared);
+    assert.strictEqual(learner.pick(), undefined, "A sequence with a clear should not be picked");
+    assert.throws(() => macros.define(enc.reset().cursor(0, 0).font(2).text("Hello").buffer()), undefined,
+                  "A macro changing the font did not throw");
+    assert.strictEqual(new spi.Macros().pick(), undefined, "Nothing should be picked without learning");
+    const text = new spi.Macros();
+    for (let i = 0; i < 4; i++)
+        text.learn(Buffer.from("Hello world"));
+    assert.strictEqual(text.pick(), undefined, "Text before the first cursor set should not be picked");
 }
 
 function illegalMode() {
@@ -134,6 +751,11 @@ function illegalMode() {
     instance.mode(99);
 }
 
+function illegalDataPins() {
+    const instance =  new spi.Spi("/dev/spi1.0");
+    instance.dataPins([2, 3, 4]);
+}
+
 function testBCM2835()
 {
     const instance =  new spi.Spi("/dev/spi0.0");
@@ -150,8 +772,36 @@ console.log("Constants");
 assert.doesNotThrow(testConstants, undefined, "Test constants are defined");
 console.log("Create instance, test functions")
 assert.doesNotThrow(testCreate, undefined, "testCreate threw an exception");
+console.log("Native command encoder");
+assert.doesNotThrow(testEncoder, undefined, "testEncoder threw an exception");
+console.log("Native framebuffer");
+assert.doesNotThrow(testFrameBuffer, undefined, "testFrameBuffer threw an exception");
+console.log("Native frame diff");
+assert.doesNotThrow(testFrameDiff, undefined, "testFrameDiff threw an exception");
+console.log("Native image packer");
+assert.doesNotThrow(testImagePacker, undefined, "testImagePacker threw an exception");
+console.log("Native dithering");
+assert.doesNotThrow(testDither, undefined, "testDither threw an exception");
+console.log("Native fonts");
+assert.doesNotThrow(testFont, undefined, "testFont threw an exception");
+console.log("Native scroller");
+assert.doesNotThrow(testScroller, undefined, "testScroller threw an exception");
+console.log("Native asset cache");
+assert.doesNotThrow(testAssetCache, undefined, "testAssetCache threw an exception");
+console.log("Native page flipping");
+assert.doesNotThrow(testPageFlipper, undefined, "testPageFlipper threw an exception");
+console.log("Native compositor");
+assert.doesNotThrow(testCompositor, undefined, "testCompositor threw an exception");
+console.log("Native text screen");
+assert.doesNotThrow(testTextScreen, undefined, "testTextScreen threw an exception");
+console.log("Native command optimizer");
+assert.doesNotThrow(testOptimizer, undefined, "testOptimizer threw an exception");
+console.log("Native display macros");
+assert.doesNotThrow(testMacros, undefined, "testMacros threw an exception");
 console.log("Check that illegal SPI modes are rejected");
 assert.throws(illegalMode, undefined, "testCreate threw an exception");
+console.log("Check that illegal data pins are rejected");
+assert.throws(illegalDataPins, undefined, "illegalDataPins did not throw");
 //console.log("Check the Linux BCM2835 driver works");
 //assert.doesNotThrow(testBCM2835, undefined, "testBMC2835 threw an exception");
 